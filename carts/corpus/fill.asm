@@ -0,0 +1,29 @@
+; Full-screen fill, one putpm per pixel (every pixel is a frame of its
+; own), with the color moving on every row and every screen.
+	let x, 0
+	let y, 0
+	let color, 0
+
+_start:
+	push 0
+	pop &y
+
+_row:
+	push 0
+	pop &x
+
+_pixel:
+	pushm &x
+	pushm &y
+	putpm &color
+	inc &x
+	cmp &x, 96
+	jlt _pixel
+
+	inc &color
+	inc &y
+	cmp &y, 96
+	jlt _row
+
+	inc &color
+	jmp _start
@@ -0,0 +1,21 @@
+; Mostly idle: waits 2048 ticks between frames, then clears the screen to
+; the next color and draws a cursor, like a title screen waiting for input.
+	let tick, 0
+
+_start:
+	push 4
+	wait
+
+	inc &tick
+	pushm &tick
+	push 7
+	and
+	sys 0xF0
+
+	pushm &tick
+	push 63
+	and
+	push 48
+	putp 7
+
+	jmp _start
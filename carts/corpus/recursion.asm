@@ -0,0 +1,28 @@
+; Deep call stack: recurses 200 calls deep, then draws a pixel per level
+; on the way back up. Each pass draws in another color.
+	let depth, 0
+	let pass, 0
+
+_start:
+	push 0
+	pop &depth
+	call _down
+	inc &pass
+	jmp _start
+
+_down:
+	inc &depth
+	cmp &depth, 200
+	jge _bottom
+	call _down
+
+_bottom:
+	pushm &depth
+	push 63
+	and			; X
+	push 2
+	pushm &depth
+	rsh			; Y
+	putpm &pass
+	dec &depth
+	ret
@@ -0,0 +1,430 @@
+; Sprite storm: 24 sprites from a sprite table, flipped, keyed and
+; wrapping around the screen edges, plus a puts per frame.
+	let ball, [
+		0, 0, 7, 7, 7, 7, 0, 0,
+		0, 7, 7, 7, 7, 7, 7, 0,
+		7, 7, 7, 7, 7, 7, 5, 7,
+		7, 7, 7, 7, 7, 7, 5, 7,
+		7, 7, 7, 7, 7, 5, 5, 7,
+		7, 7, 7, 7, 5, 5, 5, 7,
+		0, 7, 5, 5, 5, 5, 7, 0,
+		0, 0, 7, 7, 7, 7, 0, 0
+	]
+	let arrow, [
+		0, 0, 0, 3, 3, 0, 0, 0,
+		0, 0, 3, 3, 3, 3, 0, 0,
+		0, 3, 3, 3, 3, 3, 3, 0,
+		3, 3, 0, 3, 3, 0, 3, 3,
+		0, 0, 0, 3, 3, 0, 0, 0,
+		0, 0, 0, 3, 3, 0, 0, 0,
+		0, 0, 0, 2, 2, 0, 0, 0,
+		0, 0, 0, 2, 2, 0, 0, 0
+	]
+
+; The table: consecutive lets are laid out back to back, one entry is x, y, sprite, flags.
+	let s0x, 82
+	let s0y, 38
+	let s0d, 64
+	let s0f, 4
+	let s1x, 18
+	let s1y, 24
+	let s1d, 0
+	let s1f, 1
+	let s2x, 54
+	let s2y, 9
+	let s2d, 0
+	let s2f, 6
+	let s3x, 107
+	let s3y, 17
+	let s3d, 64
+	let s3f, 3
+	let s4x, 108
+	let s4y, 15
+	let s4d, 0
+	let s4f, 4
+	let s5x, 57
+	let s5y, 15
+	let s5d, 0
+	let s5f, 1
+	let s6x, 12
+	let s6y, 56
+	let s6d, 64
+	let s6f, 6
+	let s7x, 74
+	let s7y, 107
+	let s7d, 0
+	let s7f, 3
+	let s8x, 78
+	let s8y, 46
+	let s8d, 0
+	let s8f, 4
+	let s9x, 95
+	let s9y, 24
+	let s9d, 64
+	let s9f, 1
+	let s10x, 15
+	let s10y, 52
+	let s10d, 0
+	let s10f, 6
+	let s11x, 80
+	let s11y, 119
+	let s11d, 0
+	let s11f, 3
+	let s12x, 92
+	let s12y, 76
+	let s12d, 64
+	let s12f, 4
+	let s13x, 62
+	let s13y, 20
+	let s13d, 0
+	let s13f, 1
+	let s14x, 126
+	let s14y, 87
+	let s14d, 0
+	let s14f, 6
+	let s15x, 73
+	let s15y, 18
+	let s15d, 64
+	let s15f, 3
+	let s16x, 42
+	let s16y, 87
+	let s16d, 0
+	let s16f, 4
+	let s17x, 107
+	let s17y, 10
+	let s17d, 0
+	let s17f, 1
+	let s18x, 80
+	let s18y, 87
+	let s18d, 64
+	let s18f, 6
+	let s19x, 127
+	let s19y, 116
+	let s19d, 0
+	let s19f, 3
+	let s20x, 69
+	let s20y, 121
+	let s20d, 0
+	let s20f, 4
+	let s21x, 15
+	let s21y, 79
+	let s21d, 64
+	let s21f, 1
+	let s22x, 72
+	let s22y, 98
+	let s22d, 0
+	let s22f, 6
+	let s23x, 5
+	let s23y, 118
+	let s23d, 0
+	let s23f, 3
+	let frame, 0
+
+_start:
+	push 1
+	sys 0xF0
+
+	push &s0x
+	push 24
+	sys 0xF2
+
+	pushm &frame
+	pushm &s0y
+	pushm &s0x
+	puts &ball
+
+	pushm &frame
+	push 1
+	xor
+	pop &frame
+
+	pushm &s0x
+	push 125
+	add
+	push 127
+	and
+	pop &s0x
+	pushm &s0y
+	push 1
+	add
+	push 127
+	and
+	pop &s0y
+	pushm &s1x
+	push 3
+	add
+	push 127
+	and
+	pop &s1x
+	pushm &s1y
+	push 1
+	add
+	push 127
+	and
+	pop &s1y
+	pushm &s2x
+	push 1
+	add
+	push 127
+	and
+	pop &s2x
+	pushm &s2y
+	push 127
+	add
+	push 127
+	and
+	pop &s2y
+	pushm &s3x
+	push 2
+	add
+	push 127
+	and
+	pop &s3x
+	pushm &s3y
+	push 1
+	add
+	push 127
+	and
+	pop &s3y
+	pushm &s4x
+	push 126
+	add
+	push 127
+	and
+	pop &s4x
+	pushm &s4y
+	push 1
+	add
+	push 127
+	and
+	pop &s4y
+	pushm &s5x
+	push 126
+	add
+	push 127
+	and
+	pop &s5x
+	pushm &s5y
+	push 127
+	add
+	push 127
+	and
+	pop &s5y
+	pushm &s6x
+	push 1
+	add
+	push 127
+	and
+	pop &s6x
+	pushm &s6y
+	push 2
+	add
+	push 127
+	and
+	pop &s6y
+	pushm &s7x
+	push 2
+	add
+	push 127
+	and
+	pop &s7x
+	pushm &s7y
+	push 1
+	add
+	push 127
+	and
+	pop &s7y
+	pushm &s8x
+	push 1
+	add
+	push 127
+	and
+	pop &s8x
+	pushm &s8y
+	push 2
+	add
+	push 127
+	and
+	pop &s8y
+	pushm &s9x
+	push 126
+	add
+	push 127
+	and
+	pop &s9x
+	pushm &s9y
+	push 1
+	add
+	push 127
+	and
+	pop &s9y
+	pushm &s10x
+	push 125
+	add
+	push 127
+	and
+	pop &s10x
+	pushm &s10y
+	push 127
+	add
+	push 127
+	and
+	pop &s10y
+	pushm &s11x
+	push 126
+	add
+	push 127
+	and
+	pop &s11x
+	pushm &s11y
+	push 127
+	add
+	push 127
+	and
+	pop &s11y
+	pushm &s12x
+	push 2
+	add
+	push 127
+	and
+	pop &s12x
+	pushm &s12y
+	push 2
+	add
+	push 127
+	and
+	pop &s12y
+	pushm &s13x
+	push 126
+	add
+	push 127
+	and
+	pop &s13x
+	pushm &s13y
+	push 126
+	add
+	push 127
+	and
+	pop &s13y
+	pushm &s14x
+	push 127
+	add
+	push 127
+	and
+	pop &s14x
+	pushm &s14y
+	push 127
+	add
+	push 127
+	and
+	pop &s14y
+	pushm &s15x
+	push 1
+	add
+	push 127
+	and
+	pop &s15x
+	pushm &s15y
+	push 127
+	add
+	push 127
+	and
+	pop &s15y
+	pushm &s16x
+	push 2
+	add
+	push 127
+	and
+	pop &s16x
+	pushm &s16y
+	push 127
+	add
+	push 127
+	and
+	pop &s16y
+	pushm &s17x
+	push 127
+	add
+	push 127
+	and
+	pop &s17x
+	pushm &s17y
+	push 1
+	add
+	push 127
+	and
+	pop &s17y
+	pushm &s18x
+	push 127
+	add
+	push 127
+	and
+	pop &s18x
+	pushm &s18y
+	push 126
+	add
+	push 127
+	and
+	pop &s18y
+	pushm &s19x
+	push 1
+	add
+	push 127
+	and
+	pop &s19x
+	pushm &s19y
+	push 1
+	add
+	push 127
+	and
+	pop &s19y
+	pushm &s20x
+	push 127
+	add
+	push 127
+	and
+	pop &s20x
+	pushm &s20y
+	push 1
+	add
+	push 127
+	and
+	pop &s20y
+	pushm &s21x
+	push 127
+	add
+	push 127
+	and
+	pop &s21x
+	pushm &s21y
+	push 127
+	add
+	push 127
+	and
+	pop &s21y
+	pushm &s22x
+	push 127
+	add
+	push 127
+	and
+	pop &s22x
+	pushm &s22y
+	push 126
+	add
+	push 127
+	and
+	pop &s22y
+	pushm &s23x
+	push 3
+	add
+	push 127
+	and
+	pop &s23x
+	pushm &s23y
+	push 2
+	add
+	push 127
+	and
+	pop &s23y
+
+	jmp _start
@@ -0,0 +1,57 @@
+; Tile layer scrolling: a 1x1 map, so its tile wraps over the whole
+; screen, one color per tile row. Every frame moves the tile set a row down
+; the color list and scrolls, then flips. Colors stay within the palette
+; and off 0, the VRAM color the layer shows through.
+	let map, [0]
+	let colors, [
+		1, 1, 1, 1, 2, 2, 2, 2,
+		2, 2, 2, 2, 3, 3, 3, 3,
+		3, 3, 3, 3, 4, 4, 4, 4,
+		4, 4, 4, 4, 5, 5, 5, 5,
+		5, 5, 5, 5, 6, 6, 6, 6,
+		6, 6, 6, 6, 7, 7, 7, 7,
+		7, 7, 7, 7, 1, 1, 1, 1,
+		1, 1, 1, 1, 2, 2, 2, 2,
+		2, 2, 2, 2, 3, 3, 3, 3,
+		3, 3, 3, 3, 4, 4, 4, 4,
+		4, 4, 4, 4, 5, 5, 5, 5,
+		5, 5, 5, 5, 6, 6, 6, 6,
+		6, 6, 6, 6, 7, 7, 7, 7,
+		7, 7, 7, 7, 1, 1, 1, 1,
+		1, 1, 1, 1, 2, 2, 2, 2,
+		2, 2, 2, 2, 3, 3, 3, 3
+	]
+	let frame, 0
+
+_start:
+	; VRAM stays 0, the color the layer shows through.
+	sys 0xF0
+	push &map
+	pop 2563		; OptsTileMap
+	push 1
+	pop 2565		; OptsTileMapWidth
+	push 1
+	pop 2566		; OptsTileMapHeight
+	push 1
+	pop 2562		; OptsTileControl, enabled with key 0
+
+_frame:
+	pushm &frame
+	push 7
+	and
+	push 8
+	mul
+	push &colors
+	add
+	pop 2564		; OptsTileSet
+
+	pushm &frame
+	pop 2567		; OptsScrollX
+	pushm &frame
+	push 3
+	mul
+	pop 2568		; OptsScrollY
+
+	inc &frame
+	sys 0xF1
+	jmp _frame
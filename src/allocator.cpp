@@ -0,0 +1,140 @@
+#include "allocator.h"
+
+#include <algorithm>
+
+Allocator::Allocator(uint32_t capacity) {
+	m_stats.capacity = capacity;
+	reset();
+}
+
+void Allocator::reset() {
+	uint32_t capacity = m_stats.capacity;
+	m_free.clear();
+	m_used.clear();
+	m_bySize.clear();
+	m_stats = AllocatorStats();
+	m_stats.capacity = capacity;
+	if (capacity > 0) insertFree(0, capacity);
+	m_stats.largestFree = capacity;
+}
+
+void Allocator::insertFree(uint32_t addr, uint32_t size) {
+	m_free.emplace(addr, size);
+	m_bySize.emplace(size, addr);
+	m_stats.freeBlocks++;
+}
+
+void Allocator::eraseFree(std::map<uint32_t, uint32_t>::iterator it) {
+	m_bySize.erase({ it->second, it->first });
+	m_free.erase(it);
+	m_stats.freeBlocks--;
+}
+
+void Allocator::markUsed(uint32_t addr, uint32_t size) {
+	m_used.emplace(addr, size);
+	m_stats.blocks++;
+	m_stats.used += size;
+	m_stats.peakUsed = std::max(m_stats.peakUsed, m_stats.used);
+	m_stats.highWater = std::max(m_stats.highWater, addr + size);
+	m_stats.largestFree = m_bySize.empty() ? 0 : m_bySize.rbegin()->first;
+}
+
+uint32_t Allocator::alloc(uint32_t size) {
+	auto fit = size > 0 ? m_bySize.lower_bound({ size, 0 }) : m_bySize.end();
+	if (fit == m_bySize.end()) {
+		m_stats.failures++;
+		return Invalid;
+	}
+
+	uint32_t addr = fit->second, blockSize = fit->first;
+	eraseFree(m_free.find(addr));
+	if (blockSize > size) insertFree(addr + size, blockSize - size);
+
+	markUsed(addr, size);
+	m_stats.allocations++;
+	return addr;
+}
+
+bool Allocator::reserve(uint32_t addr, uint32_t size) {
+	if (size == 0) return false;
+
+	// The free block containing addr, if any.
+	auto it = m_free.upper_bound(addr);
+	if (it == m_free.begin()) return false;
+	--it;
+
+	uint32_t blockAddr = it->first, blockEnd = it->first + it->second;
+	if (uint64_t(addr) + size > blockEnd) return false;
+
+	eraseFree(it);
+	if (addr > blockAddr) insertFree(blockAddr, addr - blockAddr);
+	if (addr + size < blockEnd) insertFree(addr + size, blockEnd - (addr + size));
+
+	markUsed(addr, size);
+	return true;
+}
+
+bool Allocator::free(uint32_t addr) {
+	auto used = m_used.find(addr);
+	if (used == m_used.end()) return false;
+
+	uint32_t size = used->second;
+	m_used.erase(used);
+	m_stats.blocks--;
+	m_stats.used -= size;
+	m_stats.frees++;
+
+	// Coalesce with the free blocks right before and after.
+	auto next = m_free.lower_bound(addr);
+	if (next != m_free.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == addr) {
+			addr = prev->first;
+			size += prev->second;
+			eraseFree(prev);
+		}
+	}
+	if (next != m_free.end() && addr + size == next->first) {
+		size += next->second;
+		eraseFree(next);
+	}
+
+	insertFree(addr, size);
+	m_stats.largestFree = m_bySize.rbegin()->first;
+	return true;
+}
+
+uint32_t Allocator::sizeOf(uint32_t addr) const {
+	auto it = m_used.find(addr);
+	return it == m_used.end() ? 0 : it->second;
+}
+
+bool Allocator::verify() const {
+	if (m_free.size() != m_bySize.size() || m_free.size() != m_stats.freeBlocks) return false;
+	if (m_used.size() != m_stats.blocks) return false;
+
+	// Walking free and used blocks in address order must tile the whole
+	// range, and no two free blocks may touch.
+	auto f = m_free.begin();
+	auto u = m_used.begin();
+	uint32_t addr = 0, used = 0, largest = 0;
+	bool lastFree = false;
+	while (f != m_free.end() || u != m_used.end()) {
+		if (f != m_free.end() && f->first == addr) {
+			if (lastFree || f->second == 0 || !m_bySize.count({ f->second, f->first })) return false;
+			largest = std::max(largest, f->second);
+			addr += f->second;
+			lastFree = true;
+			++f;
+		} else if (u != m_used.end() && u->first == addr) {
+			if (u->second == 0) return false;
+			used += u->second;
+			addr += u->second;
+			lastFree = false;
+			++u;
+		} else {
+			return false;
+		}
+	}
+	return addr == m_stats.capacity && used == m_stats.used && largest == m_stats.largestFree;
+}
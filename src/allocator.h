@@ -0,0 +1,74 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+
+struct AllocatorStats {
+	uint32_t capacity{ 0 }, used{ 0 };
+	uint32_t peakUsed{ 0 };			// Most cells ever in use at once
+	uint32_t highWater{ 0 };		// Highest end address ever in use
+	uint32_t blocks{ 0 }, freeBlocks{ 0 }, largestFree{ 0 };
+	uint64_t allocations{ 0 }, frees{ 0 }, failures{ 0 };
+
+	uint32_t available() const { return capacity - used; }
+
+	/// Share of the free cells outside the largest free block: 0 when free
+	/// space is in one piece, close to 1 when it's scattered.
+	double fragmentation() const { return available() > 0 ? 1.0 - double(largestFree) / double(available()) : 0.0; }
+};
+
+/**
+ * Allocator for a range of cells [0, capacity) of console memory. The
+ * bookkeeping lives on the host, so nothing a cart writes can corrupt it.
+ *
+ * Allocation is best fit (the smallest free block that fits, the lowest
+ * address among equals), so sequential allocations on a fresh allocator are
+ * laid out back to back from 0. Freed blocks are coalesced with their free
+ * neighbours right away. Every operation is O(log n) in the number of
+ * blocks.
+*/
+class Allocator {
+public:
+	static constexpr uint32_t Invalid = UINT32_MAX;
+
+	Allocator(uint32_t capacity = 0);
+	~Allocator() = default;
+
+	/// Returns the address of `size` free cells, or Invalid.
+	uint32_t alloc(uint32_t size);
+
+	/// Marks [addr, addr + size) as used, for memory placed by other means.
+	/// False if any of it isn't free. The block can be free()d like any other.
+	bool reserve(uint32_t addr, uint32_t size);
+
+	/// Frees the block starting at `addr`. False if no block starts there.
+	bool free(uint32_t addr);
+
+	/// Size of the block starting at `addr`, 0 if there's none.
+	uint32_t sizeOf(uint32_t addr) const;
+
+	/// Frees everything, keeping the capacity. Counters and peaks are reset too.
+	void reset();
+
+	const AllocatorStats& stats() const { return m_stats; }
+
+	/// Blocks in use, address -> size.
+	const std::map<uint32_t, uint32_t>& blocks() const { return m_used; }
+
+	/// Checks the internal invariants (for tests and debugging).
+	bool verify() const;
+
+private:
+	void insertFree(uint32_t addr, uint32_t size);
+	void eraseFree(std::map<uint32_t, uint32_t>::iterator it);
+	void markUsed(uint32_t addr, uint32_t size);
+
+	std::map<uint32_t, uint32_t> m_free, m_used;	// Address -> size
+	std::set<std::pair<uint32_t, uint32_t>> m_bySize;	// (size, address) of the free blocks
+	AllocatorStats m_stats;
+};
+
+#endif // ALLOCATOR_H
@@ -1,305 +1,321 @@
 #include "asm.h"
+#include "hash.h"
 
 #include <iostream>
-#include <cctype>
-#include <regex>
+#include <algorithm>
 
 #define error(x) std::cerr << x << std::endl
 
-Scanner::Scanner(const std::string& input)
-	: m_input(input), m_pos(0)
-{
-//	std::cout << "INPUT:\n" << input << std::endl;
+namespace {
+	uint64_t initHash(const ByteList& words) {
+		uint64_t hash = FnvOffsetBasis;
+		for (Byte word : words) hash = fnv1aWord(hash, word);
+		return hash;
+	}
 }
 
-char Scanner::next() {
-	if (m_pos >= m_input.size()) return '\0';
-	return m_input[m_pos++];
+std::string Token::toString() const {
+	std::string lex(lexeme);
+	switch (type) {
+		case TokEnd: return "END";
+		case TokIdentifier: return "ID(" + lex + ")";
+		case TokOpCode: return "OP(" + lex + ")";
+		case TokNumber: return "NUM(" + std::to_string(value) + ")";
+		case TokReference: return "REF(&" + lex + ")";
+		case TokNewLabel: return "NEWLABEL(" + lex + ")";
+		case TokOpenBracket: return "OPEN_BRACKET";
+		case TokCloseBracket: return "CLOSE_BRACKET";
+		case TokLet: return "LET";
+		case TokComma: return "COMMA";
+	}
+	return "";
 }
 
-char Scanner::peek() const {
-	if (m_pos+1 >= m_input.size()) return '\0';
-	return m_input[m_pos + 1];
-}
+// -------------- ASM ---------------
 
-char Scanner::prev() const {
-	if (m_pos - 1 < 0) return '\0';
-	return m_input[m_pos - 1];
-}
+ASM::ASM(const std::string& input, Console *console)
+	: m_input(input), m_console(console)
+{}
 
-void Scanner::advance(int n) {
-	if (m_pos+n >= m_input.size()) return;
-	m_pos += n;
+void ASM::printTokens() {
+	Scanner scanner(m_input);
+	for (Token tok = scanner.next(); tok.type != TokEnd; tok = scanner.next()) {
+		std::cout << tok.toString() << " ";
+	}
+	std::cout << std::endl;
 }
 
-// -------------- ASM ---------------
+ByteList ASM::compile() {
+	m_code.clear();
+	m_insns.clear();
+	m_fixups.clear();
+	m_symbols.clear();
+	m_labelIndex.clear();
+	m_refIndex.clear();
+	m_labels.clear();
+	m_refs.clear();
+	m_lets.clear();
+	m_errors = 0;
+
+	parse();
+	resolve();
+
+	for (auto&& kept : m_kept) m_console->heap().free(kept.second.address);
+	m_kept.clear();
+	return m_optimize ? peephole() : m_code;
+}
 
-ASM::ASM(const std::string& input, Console *console)
-	: m_scanner(Scanner(input)), m_console(console)
-{}
+const std::map<std::string, uint32_t>& ASM::labels() const {
+	if (m_labels.empty()) {
+		for (auto&& sym : m_symbols) {
+			if (!sym.data && sym.defined) m_labels.emplace(sym.name, sym.address);
+		}
+	}
+	return m_labels;
+}
 
-void ASM::tokenize() {
-	m_tokens.clear();
+const std::map<std::string, uint32_t>& ASM::refs() const {
+	if (m_refs.empty()) {
+		for (auto&& sym : m_symbols) {
+			if (sym.data && sym.defined) m_refs.emplace(sym.name, sym.address);
+		}
+	}
+	return m_refs;
+}
 
-	const std::regex symbolRE("[-!$%^&*()_+|~=`{}\\[\\]:<>?,.\\/\\\\]");
+const std::map<std::string, LetBlock>& ASM::lets() const {
+	if (m_lets.empty()) {
+		for (auto&& sym : m_symbols) {
+			if (sym.data && sym.defined) m_lets.emplace(sym.name, LetBlock{ sym.address, sym.size, sym.init });
+		}
+	}
+	return m_lets;
+}
 
-#define C m_scanner.current()
-#define P m_scanner.prev()
-#define N m_scanner.peek()
-#define S std::string(1, C)
+uint32_t ASM::symbol(std::string_view name, bool data) {
+	auto& index = data ? m_refIndex : m_labelIndex;
+	auto it = index.emplace(name, uint32_t(m_symbols.size()));
+	if (it.second) m_symbols.push_back({ name, 0, 0, 0, data, false });
+	return it.first->second;
+}
 
-	while (m_scanner.hasNext()) {
-		if (std::isalpha(C) || C == '_' || C == '&') { // TokIdentifier/TokRef/TokNewLabel
-			std::string res = "";
-			while ((std::isalnum(C) || C == '_' || C == '&' || C == ':') && m_scanner.hasNext()) {
-				res += C;
-				m_scanner.next();
-			}
+void ASM::parse() {
+	m_scanner = Scanner(m_input);
+	m_labelIndex.reserve(m_input.size() / 64);
+	advance();
+	while (m_token.type != TokEnd) {
+		switch (m_token.type) {
+			case TokLet: let(); break;
+			case TokOpCode: instruction(); break;
+			case TokNewLabel: {
+				Symbol& label = m_symbols[symbol(m_token.lexeme, false)];
+				label.address = uint32_t(m_code.size());
+				label.defined = true;
+				advance();
+			}	break;
+			default:
+				unexpected("an instruction");
+				advance();
+				break;
+		}
+	}
+}
 
-			std::string rlow = res;
-			std::transform(rlow.begin(), rlow.end(), rlow.begin(), ::tolower);
-
-			TokenType type = TokenType::TokIdentifier;
-			Byte value = 0;
-			if (res[0] == '&') {
-				type = TokenType::TokReference;
-				res.erase(0, 1);
-			} else if (res[res.size() - 1] == ':') {
-				type = TokenType::TokNewLabel;
-				res.erase(res.size() - 1, 1);
-			} else if (rlow == "let") {
-				type = TokenType::TokLet;
-			} else if (OP_CODES.find(rlow) != OP_CODES.end()) {
-				type = TokenType::TokOpCode;
-				value = OP_CODES[rlow];
+void ASM::let() {
+	advance();
+	if (m_token.type != TokIdentifier) {
+		unexpected("a name after \"let\"");
+		return;
+	}
+	const std::string_view name = m_token.lexeme;
+	advance();
+
+	m_params.clear();
+	if (m_token.type == TokComma) {
+		advance();
+		if (m_token.type == TokNumber) {
+			m_params.push_back(m_token.value);
+			advance();
+		} else if (m_token.type == TokOpenBracket) {
+			advance();
+			while (m_token.type == TokNumber) {
+				m_params.push_back(m_token.value);
+				advance();
+				if (m_token.type != TokComma) break;
+				advance();
 			}
-			m_tokens.push_back(Token(type, res, value));
-		} else if (std::isdigit(C)) {
-			std::string res = "";
-			int base = 10;
-			if (C == '0' && (N == 'x' || N == 'X')) {
-				m_scanner.next();
-				m_scanner.next();
-				base = 16;
+			if (m_token.type != TokCloseBracket) {
+				unexpected("a number in the data block");
+				while (m_token.type != TokCloseBracket && m_token.type != TokEnd) advance();
 			}
+			advance();
+		}
+	}
 
-			while ((std::isdigit(C) || std::isalpha(C)) && m_scanner.hasNext()) {
-				res += C;
-				m_scanner.next();
-			}
-			m_tokens.push_back(Token(TokenType::TokNumber, res, Byte(std::stoi(res, nullptr, base))));
-		} else if (C == '[') {
-			m_tokens.push_back(Token(TokenType::TokOpenBracket, "[", 0));
-			m_scanner.next();
-		} else if (C == ']') {
-			m_tokens.push_back(Token(TokenType::TokCloseBracket, "]", 0));
-			m_scanner.next();
-		} else if (C == ',') {
-			m_tokens.push_back(Token(TokenType::TokComma, ",", 0));
-			m_scanner.next();
-		} else if (C == ';') {
-			while (C != '\n' && C != '\r' && m_scanner.hasNext()) {
-				m_scanner.next();
-			}
+	const uint32_t size = std::max<uint32_t>(uint32_t(m_params.size()), 1);
+	const uint64_t init = initHash(m_params);
+	Allocator& heap = m_console->heap();
+
+	Byte addr = Allocator::Invalid;
+	bool initialize = true;
+	auto kept = m_kept.find(name);
+	if (kept != m_kept.end()) {
+		if (kept->second.size == size) {
+			addr = kept->second.address;
+			initialize = kept->second.init != init;
 		} else {
-			m_scanner.next();
+			heap.free(kept->second.address);
+		}
+		m_kept.erase(kept);
+	}
+	if (addr == Allocator::Invalid) addr = heap.alloc(size);
+
+	if (addr == Allocator::Invalid) {
+		m_errors++;
+		error("ERROR: Out of data memory for \"" << name << "\".");
+	} else {
+		Symbol& ref = m_symbols[symbol(name, true)];
+		ref.address = addr;
+		ref.size = size;
+		ref.init = init;
+		ref.defined = true;
+		if (initialize) {
+			Byte* data = m_console->data() + addr;
+			std::fill(data, data + size, 0);
+			std::copy(m_params.begin(), m_params.end(), data);
 		}
 	}
-
-//	printTokens();
 }
 
-ByteList ASM::compile() {
-	ByteList code;
+void ASM::instruction() {
+	const uint32_t at = uint32_t(m_code.size());
+	m_code.push_back(m_token.value);
+	advance();
 
-	tokenize();
-	readLabelsAndRefs();
-
-	while (m_pos < m_tokens.size()) {
-		ByteList part = instruction();
-		code.insert(code.end(), part.begin(), part.end());
+	atom();
+	while (m_token.type == TokComma) {
+		advance();
+		atom();
 	}
-
-	return code;
+	m_insns.push_back({ at, uint32_t(m_code.size()) - at });
 }
 
-void ASM::printTokens() {
-	for (auto&& tok : m_tokens) {
-		std::cout << tok.toString() << " ";
+bool ASM::atom() {
+	switch (m_token.type) {
+		case TokIdentifier:
+		case TokReference:
+			m_fixups.push_back({ uint32_t(m_code.size()), m_scanner.line(), symbol(m_token.lexeme, m_token.type == TokReference) });
+			m_code.push_back(0);
+			break;
+		case TokNumber:
+			m_code.push_back(m_token.value);
+			break;
+		default:
+			return false;
 	}
-	std::cout << std::endl;
+	advance();
+	return true;
 }
 
-bool ASM::accept(TokenType type, const std::string& param, bool regex, bool forceCheck) {
-	if (m_pos >= m_tokens.size()) return false;
-	if (current().type == type) {
-		if (forceCheck) {
-			bool test = regex ? std::regex_match(current().lexeme, std::regex(param)) : current().lexeme == param;
-			if (test) return next();
-			else return false;
+void ASM::resolve() {
+	for (auto&& fixup : m_fixups) {
+		const Symbol& sym = m_symbols[fixup.symbol];
+		if (sym.defined) {
+			m_code[fixup.at] = sym.address;
+		} else {
+			m_errors++;
+			error("ERROR: Unknown " << (sym.data ? "data \"&" : "label \"") << sym.name << "\" on line " << fixup.line << ".");
 		}
-		return next();
 	}
-	return false;
 }
 
-bool ASM::expect(TokenType type, const std::string& param, bool regex, bool forceCheck) {
-	if (accept(type, param, regex, forceCheck)) {
-		return true;
+void ASM::advance() {
+	const uint32_t malformed = m_scanner.errors();
+	m_token = m_scanner.next();
+	if (m_scanner.errors() > malformed) {
+		error("ERROR: Malformed number \"" << m_token.lexeme << "\" on line " << m_scanner.line() << ".");
 	}
+}
 
-	std::string expc = "Unknown";
-	switch (type) {
-		case TokenType::TokIdentifier: expc = "Identifier"; break;
-		case TokenType::TokNumber: expc = "Number"; break;
-		case TokenType::TokReference: expc = "Reference"; break;
-		case TokenType::TokNewLabel: expc = "New Label"; break;
-		case TokenType::TokOpenBracket: expc = "Open Bracket"; break;
-		case TokenType::TokCloseBracket: expc = "Close Bracket"; break;
-		case TokenType::TokComma: expc = "Comma"; break;
-		default: break;
+void ASM::unexpected(const char* expected) {
+	m_errors++;
+	if (m_token.type == TokEnd) {
+		error("ERROR: Unexpected end of the source, expected " << expected << ".");
+	} else {
+		error("ERROR: Unexpected symbol \"" << m_token.lexeme << "\" on line " << m_scanner.line() << ", expected " << expected << ".");
 	}
-
-	error(
-		"ERROR: Unexpected symbol \"" <<
-		current().lexeme <<
-		"\". Expected \"" <<
-		expc <<
-		"\" Near \"" <<
-		last().lexeme <<
-		"\"."
-	);
-	return false;
 }
 
-bool ASM::next() {
-	if (m_pos >= m_tokens.size()) return false;
-	m_pos++;
-	return true;
-}
+ByteList ASM::peephole() {
+	std::vector<bool> targets(m_code.size() + 1);
+	for (auto&& sym : m_symbols) {
+		if (!sym.data && sym.defined) targets[sym.address] = true;
+	}
 
-void ASM::stepBack() {
-	if (m_pos - 1 < 0) return;
-	m_pos--;
-}
+	// Jumps and calls to a number instead of a label are targets too, and move with the code.
+	std::vector<bool> labelled(m_code.size());
+	for (auto&& fixup : m_fixups) labelled[fixup.at] = true;
+	std::vector<uint32_t> literals;
+	for (auto&& insn : m_insns) {
+		if (!isBranch(m_code.data(), insn) || labelled[insn.at + 1]) continue;
+		literals.push_back(insn.at + 1);
+		if (m_code[insn.at + 1] <= m_code.size()) targets[m_code[insn.at + 1]] = true;
+	}
 
-Token& ASM::last() {
-	if (m_pos - 1 < 0) return m_tokens[m_pos];
-	return m_tokens[m_pos - 1];
-}
+	// Sequence length at each fused instruction, 0 elsewhere; new address of each old one.
+	std::vector<uint32_t> fused(m_insns.size());
+	std::vector<uint32_t> moved(m_code.size() + 1, UINT32_MAX);
+	uint32_t newPos = 0;
+	bool any = false;
+	for (uint32_t i = 0; i < m_insns.size();) {
+		uint32_t count = fusableLength(m_code.data(), m_insns.data(), uint32_t(m_insns.size()), i);
+
+		// Nothing may jump into the middle of the sequence.
+		for (uint32_t k = 1; k < count; k++) {
+			if (targets[m_insns[i + k].at]) count = 0;
+		}
 
-void ASM::readLabelsAndRefs() {
-	std::vector<uint32_t> remove;
-	for (uint32_t i = 0; i < m_tokens.size(); i++) {
-		Token tok = m_tokens[i];
-		if (tok.type == TokLet) {
-			remove.push_back(i);
+		moved[m_insns[i].at] = newPos;
+		if (count > 0) {
+			fused[i] = count;
+			newPos += fusedSize(m_code[m_insns[i].at]);
+			any = true;
+			i += count;
+		} else {
+			newPos += m_insns[i].size;
 			i++;
-			Token vn = m_tokens[i];
-			if (vn.type == TokenType::TokIdentifier) {
-				std::string varName = vn.lexeme;
-				remove.push_back(i);
-				i++;
-				Token cm = m_tokens[i];
-				if (cm.type == TokenType::TokComma) {
-					remove.push_back(i);
-					i++;
-					Token nb = m_tokens[i];
-					ByteList params;
-					if (nb.type == TokenType::TokNumber) {
-						remove.push_back(i);
-						params.push_back(m_tokens[i].value);
-					} else if (nb.type == TokenType::TokOpenBracket) {
-						remove.push_back(i);
-						i++;
-						Token curr = m_tokens[i];
-						while (curr.type != TokenType::TokCloseBracket) {
-							if (curr.type == TokenType::TokNumber) {
-								params.push_back(curr.value);
-								remove.push_back(i);
-								i++;
-								if (m_tokens[i].type == TokenType::TokCloseBracket) {
-									i--;
-								} else if (m_tokens[i].type != TokenType::TokComma) {
-									error("ERROR: Expected a Comma after a number in the Data Block.");
-									error("At \"" << m_tokens[i-1].lexeme << "\"");
-									error("Before \"" << m_tokens.back().lexeme << "\"");
-									break;
-								} else {
-									remove.push_back(i);
-								}
-							}
-							i++;
-							curr = m_tokens[i];
-						}
-						remove.push_back(i);
-					}
-					m_refs[varName] = m_dataPtr;
-					for (Byte b : params) {
-						m_console->data()[m_dataPtr++] = b;
-					}
-				} else {
-					m_refs[varName] = m_dataPtr;
-					m_dataPtr++;
-				}
-				i--;
-			}
 		}
 	}
+	moved[m_code.size()] = newPos;
+	if (!any) return m_code;
 
-	std::reverse(remove.begin(), remove.end());
-	for (auto&& i : remove)
-		m_tokens.erase(m_tokens.begin() + i);
-	remove.clear();
-
-	uint32_t pos = 0, i = 0;
-	for (auto&& tok : m_tokens) {
-		if (tok.type == TokIdentifier ||
-			tok.type == TokNumber ||
-			tok.type == TokOpCode ||
-			tok.type == TokReference ||
-			tok.type == TokIdentifier)
-			pos++;
-		else if (tok.type == TokNewLabel) {
-			m_labels[tok.lexeme] = pos;
-			remove.push_back(i);
-		}
-		i++;
+	// A number pointing into an instruction would point elsewhere once the code moves, so nothing is fused.
+	for (uint32_t at : literals) {
+		if (m_code[at] <= m_code.size() && moved[m_code[at]] == UINT32_MAX) return m_code;
 	}
 
-	std::reverse(remove.begin(), remove.end());
-	for (auto&& i : remove)
-		m_tokens.erase(m_tokens.begin() + i);
-
-}
-
-ByteList ASM::atom() {
-	ByteList ret;
-	if (accept(TokenType::TokIdentifier)) {
-		Token tok = last();
-		ret.push_back(m_labels[tok.lexeme]);
-		return ret;
-	} else if (accept(TokenType::TokNumber)) {
-		ret.push_back(last().value);
-		return ret;
-	} else if (accept(TokenType::TokReference)) {
-		ret.push_back(m_refs[last().lexeme]);
-		return ret;
+	for (auto&& sym : m_symbols) {
+		if (!sym.data && sym.defined) sym.address = moved[sym.address];
+	}
+	for (auto&& fixup : m_fixups) {
+		const Symbol& sym = m_symbols[fixup.symbol];
+		if (!sym.data && sym.defined) m_code[fixup.at] = sym.address;
+	}
+	for (uint32_t at : literals) {
+		if (m_code[at] <= m_code.size()) m_code[at] = moved[m_code[at]];
 	}
-	return ret;
-}
 
-ByteList ASM::instruction() {
-	ByteList ret;
-	if (expect(TokenType::TokOpCode)) {
-		Token tok = last();
-		ret.push_back(tok.value);
-		ByteList a = atom();
-		if (!a.empty()) ret.insert(ret.end(), a.begin(), a.end());
-		while (accept(TokenType::TokComma)) {
-			ByteList rest = atom();
-			ret.insert(ret.end(), rest.begin(), rest.end());
+	ByteList code;
+	code.reserve(newPos);
+	for (uint32_t i = 0; i < m_insns.size();) {
+		if (fused[i] > 0) {
+			fuseSequence(m_code.data(), m_insns.data(), i, code);
+			i += fused[i];
+		} else {
+			const Byte* insn = m_code.data() + m_insns[i].at;
+			code.insert(code.end(), insn, insn + m_insns[i].size);
+			i++;
 		}
 	}
-	return ret;
+	return code;
 }
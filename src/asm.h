@@ -3,10 +3,16 @@
 
 #include "console.h"
 
+#include <algorithm>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
-#include <sstream>
+#include <unordered_map>
+
+/// Bump when the same source assembles to something else, cached carts (see cart.h) are keyed on it.
+constexpr uint32_t AssemblerVersion = 1;
 
 enum TokenType {
 	TokEnd = 0,
@@ -21,56 +27,34 @@ enum TokenType {
 	TokComma
 };
 
+/// A token, its lexeme is a view into the source (without the `&` of a reference or the `:` of a label).
 struct Token {
-	TokenType type;
-	std::string lexeme;
-
-	Byte value;
-
-	std::string toString() {
-		std::stringstream ret;
-		switch (type) {
-			case TokEnd: ret << "END"; break;
-			case TokIdentifier: ret << "ID(" << lexeme << ")"; break;
-			case TokNumber: ret << "NUM(" << value << ")"; break;
-			case TokReference: ret << "REF(&" << value << ")"; break;
-			case TokNewLabel: ret << "NEWLABEL(" << lexeme << ")"; break;
-			case TokOpenBracket: ret << "OPEN_BRACKET"; break;
-			case TokCloseBracket: ret << "CLOSE_BRACKET"; break;
-			case TokComma: ret << "COMMA"; break;
-		}
-		return ret.str();
-	}
+	TokenType type{ TokEnd };
+	std::string_view lexeme;
 
-	Token() = default;
-	Token(TokenType type, const std::string& lex, Byte val)
-		: type(type), lexeme(lex), value(val)
-	{}
-};
+	Byte value{ 0 };
 
-class Scanner {
-public:
-	Scanner() = default;
-	~Scanner() = default;
-
-	Scanner(const std::string& input);
+	std::string toString() const;
+};
 
-	char next();
-	char current() const { return m_input[m_pos]; }
-	char peek() const;
-	char prev() const;
-	bool hasNext() const { return m_pos < m_input.size(); }
+constexpr char lowerCase(char c) {
+	return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
 
-private:
-	std::string m_input;
-	int m_pos;
+constexpr bool equalsNoCase(std::string_view a, std::string_view b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (lowerCase(a[i]) != lowerCase(b[i])) return false;
+	}
+	return true;
+}
 
-	void advance(int n = 1);
+struct OpCodeName {
+	std::string_view name;
+	OpCode op;
 };
 
-using ByteList = std::vector<Byte>;
-
-static std::map<std::string, OpCode> OP_CODES = {
+constexpr OpCodeName OP_CODES[] = {
 	{ "halt", OpHalt },
 	{ "push", OpPush },
 	{ "pushm", OpPushM },
@@ -106,6 +90,260 @@ static std::map<std::string, OpCode> OP_CODES = {
 	{ "noop", OpNoop }
 };
 
+/// Names of the fused opcodes, which have no syntax of their own, for listings.
+constexpr std::string_view FUSED_OP_NAMES[] = {
+	"addmi", "submi", "mulmi", "divmi", "lshmi", "rshmi", "andmi", "ormi", "xormi", "cmpj", "cmpmj"
+};
+static_assert(std::size(FUSED_OP_NAMES) == OpCmpMJ - OpNoop, "Missing fused opcode names");
+
+static_assert([] {
+	for (size_t i = 0; i < std::size(OP_CODES); i++) {
+		if (OP_CODES[i].op != OpCode(i)) return false;
+	}
+	return std::size(OP_CODES) == OpNoop + 1;
+}(), "OP_CODES must list the opcodes in order");
+
+/// Mnemonic of `op` ("?" if it isn't an opcode).
+constexpr std::string_view opCodeName(Byte op) {
+	if (op <= OpNoop) return OP_CODES[op].name;
+	if (op <= OpCmpMJ) return FUSED_OP_NAMES[op - OpNoop - 1];
+	return "?";
+}
+
+constexpr uint32_t OpCodeSlots = 128;
+
+constexpr uint32_t mnemonicHash(std::string_view name, uint32_t seed) {
+	uint32_t hash = seed;
+	for (char c : name) hash = (hash ^ uint8_t(lowerCase(c))) * 16777619u;
+	return hash >> 25;
+}
+
+/// Seed under which no two mnemonics share a slot, searched for at compile time.
+constexpr uint32_t findOpCodeSeed() {
+	for (uint32_t seed = 2166136261u;; seed++) {
+		bool used[OpCodeSlots]{}, perfect = true;
+		for (auto&& entry : OP_CODES) {
+			uint32_t slot = mnemonicHash(entry.name, seed);
+			perfect = perfect && !used[slot];
+			used[slot] = true;
+		}
+		if (perfect) return seed;
+	}
+}
+
+struct OpCodeTable {
+	uint32_t seed{ 0 };
+	uint8_t slots[OpCodeSlots]{};	// Index into OP_CODES + 1, 0 for none
+	size_t longest{ 0 };
+};
+
+constexpr OpCodeTable buildOpCodeTable() {
+	OpCodeTable table;
+	table.seed = findOpCodeSeed();
+	for (size_t i = 0; i < std::size(OP_CODES); i++) {
+		table.slots[mnemonicHash(OP_CODES[i].name, table.seed)] = uint8_t(i + 1);
+		table.longest = std::max(table.longest, OP_CODES[i].name.size());
+	}
+	return table;
+}
+
+constexpr OpCodeTable OpCodeLookup = buildOpCodeTable();
+
+/// Looks a mnemonic up in OP_CODES, ignoring case. False if it isn't one.
+constexpr bool findOpCode(std::string_view name, OpCode& op) {
+	if (name.empty() || name.size() > OpCodeLookup.longest) return false;
+	uint8_t slot = OpCodeLookup.slots[mnemonicHash(name, OpCodeLookup.seed)];
+	if (slot == 0 || !equalsNoCase(name, OP_CODES[slot - 1].name)) return false;
+	op = OP_CODES[slot - 1].op;
+	return true;
+}
+
+/**
+ * Splits a source into tokens on demand, in one pass and without copying
+ * any of it. Everything is constexpr, so the compile-time assembler (see
+ * bake.h) reads sources exactly the way ASM does.
+*/
+class Scanner {
+public:
+	constexpr Scanner() = default;
+	~Scanner() = default;
+
+	constexpr Scanner(std::string_view input) : m_input(input) {}
+
+	/// The next token, TokEnd once the input is over.
+	constexpr Token next();
+
+	/// Line of the last token returned, from 1.
+	constexpr uint32_t line() const { return m_line; }
+
+	/// Malformed tokens seen so far.
+	constexpr uint32_t errors() const { return m_errors; }
+
+private:
+	static constexpr bool isAlpha(char c) { return lowerCase(c) >= 'a' && lowerCase(c) <= 'z'; }
+	static constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+	static constexpr bool isIdentifier(char c) { return isAlpha(c) || isDigit(c) || c == '_' || c == '&' || c == ':'; }
+
+	static constexpr int digitValue(char c) {
+		if (isDigit(c)) return c - '0';
+		if (isAlpha(c)) return lowerCase(c) - 'a' + 10;
+		return -1;
+	}
+
+	constexpr Token number();
+
+	std::string_view m_input;
+	size_t m_pos{ 0 };
+	uint32_t m_line{ 1 }, m_errors{ 0 };
+};
+
+constexpr Token Scanner::next() {
+	while (m_pos < m_input.size()) {
+		const char c = m_input[m_pos];
+		if (isAlpha(c) || c == '_' || c == '&') { // TokIdentifier/TokRef/TokNewLabel
+			size_t begin = m_pos;
+			while (m_pos < m_input.size() && isIdentifier(m_input[m_pos])) m_pos++;
+
+			Token tok{ TokIdentifier, m_input.substr(begin, m_pos - begin), 0 };
+			OpCode op{};
+			if (tok.lexeme.front() == '&') {
+				tok.type = TokReference;
+				tok.lexeme.remove_prefix(1);
+			} else if (tok.lexeme.back() == ':') {
+				tok.type = TokNewLabel;
+				tok.lexeme.remove_suffix(1);
+			} else if (equalsNoCase(tok.lexeme, "let")) {
+				tok.type = TokLet;
+			} else if (findOpCode(tok.lexeme, op)) {
+				tok.type = TokOpCode;
+				tok.value = op;
+			}
+			return tok;
+		}
+		if (isDigit(c)) return number();
+
+		switch (c) {
+			case '[': return { TokOpenBracket, m_input.substr(m_pos++, 1), 0 };
+			case ']': return { TokCloseBracket, m_input.substr(m_pos++, 1), 0 };
+			case ',': return { TokComma, m_input.substr(m_pos++, 1), 0 };
+			case ';':
+				while (m_pos < m_input.size() && m_input[m_pos] != '\n' && m_input[m_pos] != '\r') m_pos++;
+				break;
+			case '\n': m_line++; m_pos++; break;
+			default: m_pos++; break;
+		}
+	}
+	return { TokEnd, {}, 0 };
+}
+
+/// A malformed number is still a TokNumber (of the digits up to the bad one), counted in errors().
+constexpr Token Scanner::number() {
+	const size_t begin = m_pos;
+	uint32_t base = 10;
+	if (m_input[m_pos] == '0' && m_pos + 1 < m_input.size() && lowerCase(m_input[m_pos + 1]) == 'x') {
+		m_pos += 2;
+		base = 16;
+	}
+
+	const size_t digits = m_pos;
+	while (m_pos < m_input.size() && (isAlpha(m_input[m_pos]) || isDigit(m_input[m_pos]))) m_pos++;
+
+	uint64_t value = 0;
+	size_t i = digits;
+	for (; i < m_pos; i++) {
+		int digit = digitValue(m_input[i]);
+		if (digit < 0 || uint32_t(digit) >= base || value * base + digit > UINT32_MAX) break;
+		value = value * base + digit;
+	}
+
+	if (i == digits || i != m_pos) m_errors++;
+	return { TokNumber, m_input.substr(begin, m_pos - begin), Byte(value) };
+}
+
+using ByteList = std::vector<Byte>;
+
+/// An instruction of assembled code: where it starts and how many words it takes.
+struct AsmInsn {
+	uint32_t at, size;
+};
+
+/**
+ * Peephole rules, shared with the compile-time assembler (see bake.h).
+ * Returns how many of the `count` instructions from insns[i] fuse into a
+ * single one (pushm/push/<op>/pop on one address, cmp followed by a
+ * jump), 0 if they don't.
+*/
+constexpr uint32_t fusableLength(const Byte* code, const AsmInsn* insns, uint32_t count, uint32_t i) {
+	auto is = [&](uint32_t at, Byte op) {
+		return at < count && insns[at].size == 1 + operandCount(op) && code[insns[at].at] == op;
+	};
+	auto isAlu = [&](uint32_t at) {
+		return at < count && insns[at].size == 1 && code[insns[at].at] >= OpAdd && code[insns[at].at] <= OpXor;
+	};
+	auto isJump = [&](uint32_t at) {
+		return at < count && insns[at].size == 2 && code[insns[at].at] >= OpJeq && code[insns[at].at] <= OpJle;
+	};
+	auto operand = [&](uint32_t at) { return code[insns[at].at + 1]; };
+
+	// push k / pushm &x / <op> / pop &x  =>  x = x <op> k
+	if (is(i, OpPush) && is(i + 1, OpPushM) && isAlu(i + 2) && is(i + 3, OpPop) && operand(i + 1) == operand(i + 3))
+		return 4;
+
+	// pushm &x / push k / <op> / pop &x  =>  x = k <op> x, the same for the commutative ones
+	if (is(i, OpPushM) && is(i + 1, OpPush) && isAlu(i + 2) && is(i + 3, OpPop) && operand(i) == operand(i + 3)) {
+		Byte op = code[insns[i + 2].at];
+		if (op == OpAdd || op == OpMul || op == OpAnd || op == OpOr || op == OpXor) return 4;
+	}
+
+	// cmp(m) &x, y / j<cond> label
+	if ((is(i, OpCmp) || is(i, OpCmpM)) && isJump(i + 1))
+		return 2;
+
+	return 0;
+}
+
+/// Whether `insn` is a jump or a call, whose operand is a program address.
+constexpr bool isBranch(const Byte* code, const AsmInsn& insn) {
+	const Byte op = code[insn.at];
+	return insn.size == 2 && ((op >= OpJmp && op <= OpJle) || op == OpCall);
+}
+
+/// Words of the instruction a sequence starting with `op` fuses into.
+constexpr uint32_t fusedSize(Byte op) {
+	return 1 + operandCount(op == OpCmp || op == OpCmpM ? OpCmpJ : OpAddMI);
+}
+
+/// Appends the instruction fusing the sequence from insns[i] (see fusableLength()) to `out`.
+template<typename Out>
+constexpr void fuseSequence(const Byte* code, const AsmInsn* insns, uint32_t i, Out& out) {
+	const Byte* first = code + insns[i].at;
+	if (first[0] == OpCmp || first[0] == OpCmpM) {
+		const Byte* jump = code + insns[i + 1].at;
+		const Byte fused[] = { Byte(first[0] == OpCmp ? OpCmpJ : OpCmpMJ), first[1], first[2], jump[0], jump[1] };
+		for (Byte word : fused) out.push_back(word);
+		return;
+	}
+
+	const Byte* second = code + insns[i + 1].at;
+	const Byte* mem = first[0] == OpPushM ? first : second;
+	const Byte* lit = first[0] == OpPushM ? second : first;
+	Byte alu = code[insns[i + 2].at];
+	const Byte fused[] = { Byte(OpAddMI + (alu - OpAdd)), mem[1], lit[1] };
+	for (Byte word : fused) out.push_back(word);
+}
+
+/// A `let` of a compile(): its block of data memory and a hash of its initial values.
+struct LetBlock {
+	uint32_t address, size;
+	uint64_t init;
+};
+
+/**
+ * Assembles a source in a single pass over it: tokens are scanned as the
+ * parser asks for them, code is emitted straight away and operands naming
+ * a label or a `let` are backpatched once the whole source has been seen.
+ * Symbol names are views into the source, nothing is allocated per token.
+*/
 class ASM {
 public:
 	ASM() = default;
@@ -115,32 +353,82 @@ public:
 
 	void printTokens();
 
-	void tokenize();
 	ByteList compile();
-private:
-	void readLabelsAndRefs();
 
-	ByteList atom();
-	ByteList instruction();
+	/// Enables the peephole pass (on by default), which fuses common idioms into single instructions.
+	void setOptimize(bool optimize) { m_optimize = optimize; }
 
-	bool accept(TokenType type, const std::string& param = "", bool regex = true, bool forceCheck = false);
-	bool expect(TokenType type, const std::string& param = "", bool regex = true, bool forceCheck = false);
+	/// Symbols of the last compile(): program addresses of labels, data addresses of `let`s.
+	const std::map<std::string, uint32_t>& labels() const;
+	const std::map<std::string, uint32_t>& refs() const;
+	const std::map<std::string, LetBlock>& lets() const;
 
-	bool next();
-	void stepBack();
+	/**
+	 * Lets an earlier compile() placed in the console (see lets()), for
+	 * assembling a new version of the source into a running console. A
+	 * let with the same name and size stays where it is and keeps its
+	 * current value, unless its initial values changed. The others are
+	 * freed once they're resized or gone from the source.
+	*/
+	void keepLets(const std::map<std::string, LetBlock>& lets) { m_kept.insert(lets.begin(), lets.end()); }
 
-	Token& current() { return m_tokens[m_pos]; }
-	Token& last();
+	/// Errors reported by the last compile().
+	uint32_t errors() const { return m_errors + m_scanner.errors(); }
+private:
+	/// A label (or a `let`, if `data`), from the first time the source names it.
+	struct Symbol {
+		std::string_view name;
+		uint32_t address, size;
+		uint64_t init;
+		bool data, defined;
+	};
 
-	std::vector<Token> m_tokens;
-	uint32_t m_pos{ 0 }, m_dataPtr{ 0 };
+	/// An operand waiting for the address of m_symbols[symbol].
+	struct Fixup {
+		uint32_t at, line, symbol;
+	};
 
-	std::map<std::string, uint32_t> m_labels;
-	std::map<std::string, uint32_t> m_refs;
+	void parse();
+	void let();
+	void instruction();
+	bool atom();
 
-	Console *m_console;
+	/// Writes the symbol addresses into the operands waiting for them.
+	void resolve();
+
+	/**
+	 * Peephole pass. Finds the instruction sequences that have a fused
+	 * opcode (see fusableLength()), moves the labels to the shrunk
+	 * addresses and returns the new code. Sequences with a label inside are
+	 * left alone.
+	*/
+	ByteList peephole();
+
+	/// Index of the symbol `name` in m_symbols, added undefined if it's new.
+	uint32_t symbol(std::string_view name, bool data);
+
+	void advance();
+	void unexpected(const char* expected);
 
+	std::string m_input;
 	Scanner m_scanner;
+	Token m_token;
+	bool m_optimize{ true };
+	uint32_t m_errors{ 0 };
+
+	ByteList m_code, m_params;
+	std::vector<AsmInsn> m_insns;
+	std::vector<Fixup> m_fixups;
+	std::vector<Symbol> m_symbols;
+	std::unordered_map<std::string_view, uint32_t> m_labelIndex, m_refIndex;
+	std::map<std::string, LetBlock, std::less<>> m_kept;
+
+	// Built from m_symbols when asked for.
+	mutable std::map<std::string, uint32_t> m_labels;
+	mutable std::map<std::string, uint32_t> m_refs;
+	mutable std::map<std::string, LetBlock> m_lets;
+
+	Console *m_console;
 };
 
 #endif // ASM_H
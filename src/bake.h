@@ -0,0 +1,376 @@
+#ifndef BAKE_H
+#define BAKE_H
+
+#include "asm.h"
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Bakes a cart source into the binary: CONSOLE_BAKE_CART(source, optimize)
+ * assembles a string literal (or a constexpr char array) at compile time
+ * into a BakedCart, so the program never runs the assembler for it.
+ *
+ *     constexpr auto Cart = CONSOLE_BAKE_CART(Source, true);
+ *     Cart.load(console);
+ *
+ * It reads the source with the same Scanner and applies the same peephole
+ * rules as ASM, and lays the `let`s out the way a fresh console's heap
+ * does, so the code and data are word for word what ASM::compile()
+ * places in a new console (tests/bake_check.cpp holds it to that).
+ * Errors fail the build with a static_assert naming the kind of error,
+ * and the line it's on shows up in the comparison the compiler reduces
+ * it to.
+*/
+#define CONSOLE_BAKE_CART(source, optimize) bakeCart<optimize>([]() { return std::string_view(source); })
+
+/// A block of the data heap a baked cart takes.
+struct BakedBlock {
+	uint32_t address, size;
+};
+
+/// A cart assembled at compile time, see CONSOLE_BAKE_CART.
+template<size_t CodeSize, size_t DataWords, size_t Blocks>
+struct BakedCart {
+	std::array<Byte, CodeSize> code;
+	std::array<Byte, DataWords> data;
+	std::array<BakedBlock, Blocks> heap;
+
+	/// Copies the cart into the console, like Cart::load().
+	void load(Console& console) const {
+		std::copy(data.begin(), data.end(), console.data());
+		console.heap().reset();
+		for (auto&& block : heap) console.heap().reserve(block.address, block.size);
+		console.writeProgram(0, code.data(), uint32_t(CodeSize));
+	}
+};
+
+enum BakeError {
+	BakeNoError = 0,
+	BakeMalformedNumber,
+	BakeUnexpectedSymbol,
+	BakeUnknownLabel,
+	BakeUnknownData,
+	BakeOutOfDataMemory
+};
+
+/// Upper bounds on what assembling a source takes, from its tokens.
+struct BakeCapacity {
+	uint32_t words{ 1 }, insns{ 1 }, symbols{ 1 }, params{ 1 }, lets{ 1 };
+	uint32_t slots{ 2 };	// Symbol hash table, a power of two over twice the symbols
+};
+
+constexpr BakeCapacity bakeCapacity(std::string_view source) {
+	BakeCapacity cap;
+	Scanner scanner(source);
+	for (Token tok = scanner.next(); tok.type != TokEnd; tok = scanner.next()) {
+		switch (tok.type) {
+			case TokOpCode: cap.words++; cap.insns++; break;
+			case TokNumber: cap.words++; cap.params++; break;
+			case TokIdentifier: case TokReference: cap.words++; cap.symbols++; break;
+			case TokNewLabel: cap.symbols++; break;
+			case TokLet: cap.lets++; break;
+			default: break;
+		}
+	}
+	while (cap.slots < cap.symbols * 2) cap.slots *= 2;
+	return cap;
+}
+
+/// Fixed capacity list for the compile-time assembler.
+template<typename T, size_t N>
+struct BakeList {
+	std::array<T, N> items{};
+	uint32_t count{ 0 };
+
+	constexpr void push_back(const T& item) { items[count++] = item; }
+	constexpr T& operator [](uint32_t i) { return items[i]; }
+	constexpr const T& operator [](uint32_t i) const { return items[i]; }
+	constexpr uint32_t size() const { return count; }
+};
+
+/**
+ * ASM as a literal type: it assembles its source in the constructor,
+ * entirely at compile time when the object is constexpr. The parser
+ * mirrors ASM's, down to how it recovers from what it skips, but stops at
+ * the first error.
+*/
+template<uint32_t Words, uint32_t Insns, uint32_t Symbols, uint32_t Params, uint32_t Lets, uint32_t Slots>
+class BakeAssembler {
+public:
+	constexpr BakeAssembler(std::string_view source, bool optimize)
+		: m_scanner(source)
+	{
+		advance();
+		parse();
+		resolve();
+		if (optimize && m_error == BakeNoError) peephole();
+	}
+
+	/// Line of the first error if it's of `kind`, 0 otherwise.
+	constexpr uint32_t errorLine(BakeError kind) const { return m_error == kind ? m_errorLine : 0; }
+
+	constexpr uint32_t codeSize() const { return m_code.size(); }
+	constexpr Byte code(uint32_t i) const { return m_code[i]; }
+
+	/// Words of data memory the `let`s take, from 0.
+	constexpr uint32_t dataSize() const { return m_dataUsed; }
+	constexpr Byte data(uint32_t i) const { return m_data[i]; }
+
+	constexpr uint32_t blockCount() const { return m_blocks.size(); }
+	constexpr BakedBlock block(uint32_t i) const { return m_blocks[i]; }
+
+private:
+	struct Symbol {
+		std::string_view name;
+		uint32_t address{ 0 };
+		bool data{ false }, defined{ false };
+	};
+
+	struct Fixup {
+		uint32_t at{ 0 }, line{ 0 }, symbol{ 0 };
+	};
+
+	constexpr void fail(BakeError kind, uint32_t line) {
+		if (m_error != BakeNoError) return;
+		m_error = kind;
+		m_errorLine = line;
+	}
+
+	constexpr void advance() {
+		const uint32_t malformed = m_scanner.errors();
+		m_token = m_scanner.next();
+		if (m_scanner.errors() > malformed) fail(BakeMalformedNumber, m_scanner.line());
+	}
+
+	constexpr uint32_t symbol(std::string_view name, bool data) {
+		uint32_t hash = data ? 2166136261u : 16777619u;
+		for (char c : name) hash = (hash ^ uint8_t(c)) * 16777619u;
+
+		uint32_t slot = hash & (Slots - 1);
+		while (m_slots[slot] != 0) {
+			const Symbol& sym = m_symbols[m_slots[slot] - 1];
+			if (sym.data == data && sym.name == name) return m_slots[slot] - 1;
+			slot = (slot + 1) & (Slots - 1);
+		}
+		m_symbols.push_back({ name, 0, data, false });
+		m_slots[slot] = m_symbols.size();
+		return m_symbols.size() - 1;
+	}
+
+	constexpr void parse() {
+		while (m_token.type != TokEnd && m_error == BakeNoError) {
+			switch (m_token.type) {
+				case TokLet: let(); break;
+				case TokOpCode: instruction(); break;
+				case TokNewLabel: {
+					Symbol& label = m_symbols[symbol(m_token.lexeme, false)];
+					label.address = m_code.size();
+					label.defined = true;
+					advance();
+				}	break;
+				default: fail(BakeUnexpectedSymbol, m_scanner.line()); break;
+			}
+		}
+	}
+
+	constexpr void let() {
+		advance();
+		if (m_token.type != TokIdentifier) {
+			fail(BakeUnexpectedSymbol, m_scanner.line());
+			return;
+		}
+		const std::string_view name = m_token.lexeme;
+		const uint32_t line = m_scanner.line();
+		advance();
+
+		m_params.count = 0;
+		if (m_token.type == TokComma) {
+			advance();
+			if (m_token.type == TokNumber) {
+				m_params.push_back(m_token.value);
+				advance();
+			} else if (m_token.type == TokOpenBracket) {
+				advance();
+				while (m_token.type == TokNumber) {
+					m_params.push_back(m_token.value);
+					advance();
+					if (m_token.type != TokComma) break;
+					advance();
+				}
+				if (m_token.type != TokCloseBracket) {
+					fail(BakeUnexpectedSymbol, m_scanner.line());
+					return;
+				}
+				advance();
+			}
+		}
+
+		// A fresh heap hands blocks out back to back from 0 (see Allocator).
+		const uint32_t size = std::max<uint32_t>(m_params.size(), 1);
+		if (size > DataSize - m_dataUsed) {
+			fail(BakeOutOfDataMemory, line);
+			return;
+		}
+		const uint32_t addr = m_dataUsed;
+		m_dataUsed += size;
+		m_blocks.push_back({ addr, size });
+
+		Symbol& ref = m_symbols[symbol(name, true)];
+		ref.address = addr;
+		ref.defined = true;
+		for (uint32_t i = 0; i < m_params.size(); i++) m_data[addr + i] = m_params[i];
+	}
+
+	constexpr void instruction() {
+		const uint32_t at = m_code.size();
+		m_code.push_back(m_token.value);
+		advance();
+
+		atom();
+		while (m_token.type == TokComma) {
+			advance();
+			atom();
+		}
+		m_insns.push_back({ at, m_code.size() - at });
+	}
+
+	constexpr void atom() {
+		switch (m_token.type) {
+			case TokIdentifier:
+			case TokReference:
+				m_fixups.push_back({ m_code.size(), m_scanner.line(), symbol(m_token.lexeme, m_token.type == TokReference) });
+				m_code.push_back(0);
+				break;
+			case TokNumber:
+				m_code.push_back(m_token.value);
+				break;
+			default:
+				return;
+		}
+		advance();
+	}
+
+	constexpr void resolve() {
+		for (uint32_t i = 0; i < m_fixups.size(); i++) {
+			const Fixup& fixup = m_fixups[i];
+			const Symbol& sym = m_symbols[fixup.symbol];
+			if (sym.defined) m_code[fixup.at] = sym.address;
+			else fail(sym.data ? BakeUnknownData : BakeUnknownLabel, fixup.line);
+		}
+	}
+
+	/// ASM::peephole(), into m_code.
+	constexpr void peephole() {
+		const Byte* code = m_code.items.data();
+		const AsmInsn* insns = m_insns.items.data();
+		const uint32_t count = m_insns.size();
+
+		std::array<bool, Words + 1> targets{};
+		for (uint32_t i = 0; i < m_symbols.size(); i++) {
+			if (!m_symbols[i].data && m_symbols[i].defined) targets[m_symbols[i].address] = true;
+		}
+
+		std::array<bool, Words + 1> labelled{}, starts{};
+		for (uint32_t i = 0; i < m_fixups.size(); i++) labelled[m_fixups[i].at] = true;
+		BakeList<uint32_t, Insns> literals;
+		for (uint32_t i = 0; i < count; i++) {
+			starts[insns[i].at] = true;
+			if (!isBranch(code, insns[i]) || labelled[insns[i].at + 1]) continue;
+			literals.push_back(insns[i].at + 1);
+			if (code[insns[i].at + 1] <= m_code.size()) targets[code[insns[i].at + 1]] = true;
+		}
+		starts[m_code.size()] = true;
+
+		std::array<uint32_t, Insns> fused{};
+		std::array<uint32_t, Words + 1> moved{};
+		uint32_t newPos = 0;
+		bool any = false;
+		for (uint32_t i = 0; i < count;) {
+			uint32_t length = fusableLength(code, insns, count, i);
+			for (uint32_t k = 1; k < length; k++) {
+				if (targets[insns[i + k].at]) length = 0;
+			}
+
+			moved[insns[i].at] = newPos;
+			if (length > 0) {
+				fused[i] = length;
+				newPos += fusedSize(code[insns[i].at]);
+				any = true;
+				i += length;
+			} else {
+				newPos += insns[i].size;
+				i++;
+			}
+		}
+		moved[m_code.size()] = newPos;
+		if (!any) return;
+		for (uint32_t i = 0; i < literals.size(); i++) {
+			if (code[literals[i]] <= m_code.size() && !starts[code[literals[i]]]) return;
+		}
+
+		for (uint32_t i = 0; i < m_symbols.size(); i++) {
+			Symbol& sym = m_symbols[i];
+			if (!sym.data && sym.defined) sym.address = moved[sym.address];
+		}
+		for (uint32_t i = 0; i < m_fixups.size(); i++) {
+			const Symbol& sym = m_symbols[m_fixups[i].symbol];
+			if (!sym.data && sym.defined) m_code[m_fixups[i].at] = sym.address;
+		}
+		for (uint32_t i = 0; i < literals.size(); i++) {
+			if (m_code[literals[i]] <= m_code.size()) m_code[literals[i]] = moved[m_code[literals[i]]];
+		}
+
+		BakeList<Byte, Words> out;
+		for (uint32_t i = 0; i < count;) {
+			if (fused[i] > 0) {
+				fuseSequence(code, insns, i, out);
+				i += fused[i];
+			} else {
+				for (uint32_t k = 0; k < insns[i].size; k++) out.push_back(code[insns[i].at + k]);
+				i++;
+			}
+		}
+		m_code = out;
+	}
+
+	Scanner m_scanner;
+	Token m_token;
+	BakeError m_error{ BakeNoError };
+	uint32_t m_errorLine{ 0 };
+
+	BakeList<Byte, Words> m_code;
+	BakeList<AsmInsn, Insns> m_insns;
+	BakeList<Fixup, Symbols> m_fixups;
+	BakeList<Symbol, Symbols> m_symbols;
+	std::array<uint32_t, Slots> m_slots{};	// Index into m_symbols + 1, 0 for none
+	BakeList<Byte, Params> m_params;
+
+	std::array<Byte, DataSize> m_data{};
+	uint32_t m_dataUsed{ 0 };
+	BakeList<BakedBlock, Lets> m_blocks;
+};
+
+/// Use CONSOLE_BAKE_CART, `source` is a lambda returning the source.
+template<bool Optimize, typename Source>
+constexpr auto bakeCart(Source source) {
+	constexpr std::string_view text = source();
+	constexpr BakeCapacity cap = bakeCapacity(text);
+	constexpr BakeAssembler<cap.words, cap.insns, cap.symbols, cap.params, cap.lets, cap.slots> assembler(text, Optimize);
+
+	static_assert(assembler.errorLine(BakeMalformedNumber) == 0, "Malformed number in a baked cart, on the line below");
+	static_assert(assembler.errorLine(BakeUnexpectedSymbol) == 0, "Unexpected symbol in a baked cart, on the line below");
+	static_assert(assembler.errorLine(BakeUnknownLabel) == 0, "Unknown label in a baked cart, on the line below");
+	static_assert(assembler.errorLine(BakeUnknownData) == 0, "Unknown data in a baked cart, on the line below");
+	static_assert(assembler.errorLine(BakeOutOfDataMemory) == 0, "A baked cart is out of data memory, on the line below");
+	static_assert(assembler.codeSize() <= ProgramSize, "A baked cart doesn't fit in program memory");
+
+	BakedCart<assembler.codeSize(), assembler.dataSize(), assembler.blockCount()> cart{};
+	for (uint32_t i = 0; i < assembler.codeSize(); i++) cart.code[i] = assembler.code(i);
+	for (uint32_t i = 0; i < assembler.dataSize(); i++) cart.data[i] = assembler.data(i);
+	for (uint32_t i = 0; i < assembler.blockCount(); i++) cart.heap[i] = assembler.block(i);
+	return cart;
+}
+
+#endif // BAKE_H
@@ -0,0 +1,276 @@
+#include "cart.h"
+#include "asm.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CONSOLE_CART_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	size_t alignSegment(size_t offset) {
+		return (offset + CartAlignment - 1) / CartAlignment * CartAlignment;
+	}
+
+	/// Number of words up to the last non-zero one.
+	uint32_t trimmed(const Byte* words, uint32_t count) {
+		while (count > 0 && words[count - 1] == 0) count--;
+		return count;
+	}
+
+	void appendWords(std::vector<uint8_t>& out, const void* words, size_t count) {
+		const uint8_t* bytes = static_cast<const uint8_t*>(words);
+		out.insert(out.end(), bytes, bytes + count * sizeof(Byte));
+	}
+}
+
+bool Cart::open(const std::string& path) {
+	close();
+#ifdef CONSOLE_CART_MMAP
+	int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		if (fd >= 0) ::close(fd);
+		std::cerr << "ERROR: Could not open \"" << path << "\"." << std::endl;
+		return false;
+	}
+
+	void* mem = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		std::cerr << "ERROR: Could not map \"" << path << "\"." << std::endl;
+		return false;
+	}
+	m_data = static_cast<const uint8_t*>(mem);
+	m_size = size_t(info.st_size);
+	m_mapped = true;
+#else
+	std::ifstream fs(path, std::ios::binary);
+	if (!fs.good()) {
+		std::cerr << "ERROR: Could not open \"" << path << "\"." << std::endl;
+		return false;
+	}
+	m_image.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+	m_data = m_image.data();
+	m_size = m_image.size();
+#endif
+	return check(path);
+}
+
+bool Cart::open(std::vector<uint8_t>&& image) {
+	close();
+	m_image = std::move(image);
+	m_data = m_image.data();
+	m_size = m_image.size();
+	return check("cart image");
+}
+
+void Cart::close() {
+#ifdef CONSOLE_CART_MMAP
+	if (m_mapped) munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_mapped = false;
+	m_image.clear();
+}
+
+bool Cart::check(const std::string& name) {
+	const char* problem = nullptr;
+	if (m_size < sizeof(CartHeader) || header().magic != CartMagic) problem = "is not a cart";
+	else if (header().version != CartVersion) problem = "was built for another version of the console";
+	else if (header().contentHash != fnv1a(m_data + sizeof(CartHeader), m_size - sizeof(CartHeader))) problem = "is corrupt";
+
+	const uint32_t limits[CartSegmentCount] = {
+		ProgramSize * sizeof(Byte), DataSize * sizeof(Byte), OptsSize * sizeof(Byte), DataSize * 2 * sizeof(Byte), UINT32_MAX
+	};
+	for (uint32_t i = 0; !problem && i < CartSegmentCount; i++) {
+		const CartSegment& segment = header().segments[i];
+		if (segment.offset % sizeof(Byte) != 0 || segment.size % sizeof(Byte) != 0 || segment.size > limits[i] ||
+			segment.offset < sizeof(CartHeader) || uint64_t(segment.offset) + segment.size > m_size) {
+			problem = "has a broken segment table";
+		}
+	}
+
+	if (problem) {
+		std::cerr << "ERROR: \"" << name << "\" " << problem << "." << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+const Byte* Cart::words(CartSegmentType type, uint32_t& count) const {
+	const CartSegment& segment = header().segments[type];
+	count = segment.size / sizeof(Byte);
+	return reinterpret_cast<const Byte*>(m_data + segment.offset);
+}
+
+std::map<std::string, uint32_t> Cart::symbols(CartSymbolKind kind) const {
+	std::map<std::string, uint32_t> symbols;
+	const CartSegment& segment = header().segments[CartSymbols];
+	size_t pos = segment.offset, end = size_t(segment.offset) + segment.size;
+	while (pos + sizeof(CartSymbol) <= end) {
+		CartSymbol symbol;
+		std::memcpy(&symbol, m_data + pos, sizeof(symbol));
+		pos += sizeof(symbol);
+		if (symbol.nameLength > end - pos) break;
+
+		if (symbol.kind == uint32_t(kind)) {
+			symbols[std::string(reinterpret_cast<const char*>(m_data + pos), symbol.nameLength)] = symbol.value;
+		}
+		pos += (symbol.nameLength + sizeof(Byte) - 1) / sizeof(Byte) * sizeof(Byte);
+	}
+	return symbols;
+}
+
+void Cart::load(Console& console) const {
+	uint32_t count;
+	const Byte* words = this->words(CartData, count);
+	std::copy(words, words + count, console.data());
+	words = this->words(CartOpts, count);
+	std::copy(words, words + count, console.opts());
+
+	console.heap().reset();
+	words = this->words(CartHeap, count);
+	for (uint32_t i = 0; i + 1 < count; i += 2) {
+		console.heap().reserve(words[i], words[i + 1]);
+	}
+
+	words = this->words(CartProgram, count);
+	console.writeProgram(0, words, count);
+}
+
+uint64_t cartSourceHash(const std::string& source, bool optimize) {
+	const uint32_t settings[] = { CartVersion, AssemblerVersion, optimize };
+	return fnv1a(settings, sizeof(settings), fnv1a(source.data(), source.size()));
+}
+
+bool buildCart(const std::string& source, bool optimize, std::vector<uint8_t>& image) {
+	std::unique_ptr<Console> console(new Console());
+	ASM assembler(source, console.get());
+	assembler.setOptimize(optimize);
+	ByteList code = assembler.compile();
+	if (code.size() > ProgramSize) {
+		std::cerr << "ERROR: The program takes " << code.size() << " words, the console has " << ProgramSize << "." << std::endl;
+		return false;
+	}
+	// The errors were printed as they were found, a broken source makes no cart.
+	if (assembler.errors() > 0) return false;
+
+	// The data segment keeps all of the heap the assembler took, even where it's zero.
+	const Allocator& heap = console->heap();
+	uint32_t dataSize = std::max(trimmed(console->data(), DataSize), heap.stats().highWater);
+	uint32_t optsSize = trimmed(console->opts(), OptsSize);
+
+	CartHeader header;
+	header.sourceHash = cartSourceHash(source, optimize);
+	image.assign(sizeof(CartHeader), 0);
+
+	auto beginSegment = [&](CartSegmentType type) {
+		image.resize(alignSegment(image.size()), 0);
+		header.segments[type].offset = uint32_t(image.size());
+	};
+	auto endSegment = [&](CartSegmentType type) {
+		header.segments[type].size = uint32_t(image.size() - header.segments[type].offset);
+	};
+
+	beginSegment(CartProgram);
+	appendWords(image, code.data(), code.size());
+	endSegment(CartProgram);
+
+	beginSegment(CartData);
+	appendWords(image, console->data(), dataSize);
+	endSegment(CartData);
+
+	beginSegment(CartOpts);
+	appendWords(image, console->opts(), optsSize);
+	endSegment(CartOpts);
+
+	beginSegment(CartHeap);
+	for (auto&& block : heap.blocks()) {
+		Byte pair[2] = { block.first, block.second };
+		appendWords(image, pair, 2);
+	}
+	endSegment(CartHeap);
+
+	beginSegment(CartSymbols);
+	auto addSymbols = [&](const std::map<std::string, uint32_t>& symbols, CartSymbolKind kind) {
+		for (auto&& entry : symbols) {
+			CartSymbol symbol{ entry.second, uint32_t(kind), uint32_t(entry.first.size()) };
+			appendWords(image, &symbol, sizeof(symbol) / sizeof(Byte));
+			image.insert(image.end(), entry.first.begin(), entry.first.end());
+			image.resize((image.size() + sizeof(Byte) - 1) / sizeof(Byte) * sizeof(Byte), 0);
+		}
+	};
+	addSymbols(assembler.labels(), CartSymbolLabel);
+	addSymbols(assembler.refs(), CartSymbolData);
+	endSegment(CartSymbols);
+
+	header.contentHash = fnv1a(image.data() + sizeof(CartHeader), image.size() - sizeof(CartHeader));
+	std::memcpy(image.data(), &header, sizeof(header));
+	return true;
+}
+
+bool writeCart(const std::string& path, const std::vector<uint8_t>& image) {
+	std::string temp = path + ".tmp" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+	{
+		std::ofstream fs(temp, std::ios::binary);
+		fs.write(reinterpret_cast<const char*>(image.data()), image.size());
+		if (!fs.good()) {
+			fs.close();
+			std::remove(temp.c_str());
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temp, path, error);
+	if (error) std::remove(temp.c_str());
+	return !error;
+}
+
+std::string defaultCartCacheDir() {
+	if (const char* dir = std::getenv("CONSOLE_CART_CACHE")) return dir;
+	if (const char* dir = std::getenv("XDG_CACHE_HOME")) return std::string(dir) + "/fantasy-console";
+	if (const char* dir = std::getenv("HOME")) return std::string(dir) + "/.cache/fantasy-console";
+	return "";
+}
+
+bool openCachedCart(Cart& cart, const std::string& source, bool optimize, const std::string& cacheDir) {
+	const uint64_t hash = cartSourceHash(source, optimize);
+
+	std::string path;
+	if (!cacheDir.empty()) {
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.cart", static_cast<unsigned long long>(hash));
+		path = cacheDir + "/" + name;
+
+		std::error_code error;
+		if (std::filesystem::exists(path, error) && cart.open(path) && cart.header().sourceHash == hash) return true;
+	}
+
+	std::vector<uint8_t> image;
+	if (!buildCart(source, optimize, image)) return false;
+
+	if (!path.empty()) {
+		std::error_code error;
+		std::filesystem::create_directories(cacheDir, error);
+		if (!error && writeCart(path, image) && cart.open(path)) return true;
+	}
+	return cart.open(std::move(image));
+}
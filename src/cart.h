@@ -0,0 +1,113 @@
+#ifndef CART_H
+#define CART_H
+
+#include "console.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+constexpr uint32_t CartMagic = 0x54524346; // "FCRT"
+constexpr uint16_t CartVersion = 1;
+
+/// Segments start at multiples of this many bytes into the file.
+constexpr uint32_t CartAlignment = 16;
+
+enum CartSegmentType {
+	CartProgram = 0,	// Code words for prog()
+	CartData,			// Words for data(), up to the last non-zero one
+	CartOpts,			// Words for opts(), up to the last non-zero one
+	CartHeap,			// (address, size) word pairs of the data heap blocks the assembler used
+	CartSymbols,		// CartSymbol records, each followed by its name padded to a whole word
+	CartSegmentCount
+};
+
+struct CartSegment {
+	uint32_t offset, size;	// In bytes from the start of the file
+};
+
+/**
+ * Cart file layout, in host byte order: this header, then the segments.
+ * Code, data and opts are stored as the console's own words, so loading
+ * is one copy per segment out of the mapped file, no parsing.
+*/
+struct CartHeader {
+	uint32_t magic{ CartMagic };
+	uint16_t version{ CartVersion };
+	uint16_t flags{ 0 };
+	uint64_t contentHash{ 0 };	// FNV-1a of everything after the header
+	uint64_t sourceHash{ 0 };	// cartSourceHash() of what it was built from
+	CartSegment segments[CartSegmentCount]{};
+};
+
+enum CartSymbolKind {
+	CartSymbolLabel = 0,	// Program address
+	CartSymbolData			// Data address of a `let`
+};
+
+struct CartSymbol {
+	uint32_t value, kind, nameLength;
+};
+
+/**
+ * A cart file, mapped read-only (or held in memory where mmap isn't
+ * available, or for images fresh out of buildCart()).
+*/
+class Cart {
+public:
+	Cart() = default;
+	~Cart() { close(); }
+
+	Cart(const Cart&) = delete;
+	Cart& operator =(const Cart&) = delete;
+
+	/// Maps the cart at `path` and checks it. False, with the error on std::cerr, if it isn't a valid cart.
+	bool open(const std::string& path);
+
+	/// Takes over a cart image, see buildCart().
+	bool open(std::vector<uint8_t>&& image);
+
+	void close();
+
+	bool valid() const { return m_data != nullptr; }
+	const CartHeader& header() const { return *reinterpret_cast<const CartHeader*>(m_data); }
+
+	/// Words of a code, data, opts or heap segment.
+	const Byte* words(CartSegmentType type, uint32_t& count) const;
+
+	/// Symbols of `kind`, name -> value.
+	std::map<std::string, uint32_t> symbols(CartSymbolKind kind) const;
+
+	/// Copies the cart into the console: program, data, opts and the heap blocks.
+	void load(Console& console) const;
+
+private:
+	bool check(const std::string& name);
+
+	const uint8_t* m_data{ nullptr };
+	size_t m_size{ 0 };
+	bool m_mapped{ false };
+	std::vector<uint8_t> m_image;
+};
+
+/// Hash identifying a source and the assembler settings, the cart cache key.
+uint64_t cartSourceHash(const std::string& source, bool optimize);
+
+/// Assembles `source` into a cart image. False (errors on std::cerr) if it has errors or doesn't fit the console.
+bool buildCart(const std::string& source, bool optimize, std::vector<uint8_t>& image);
+
+/// Writes a cart image to `path`, through a temporary file so readers never see half of it.
+bool writeCart(const std::string& path, const std::vector<uint8_t>& image);
+
+/// $CONSOLE_CART_CACHE, or fantasy-console under $XDG_CACHE_HOME or ~/.cache. Empty if none of them is set.
+std::string defaultCartCacheDir();
+
+/**
+ * Opens the cart built from `source` out of `cacheDir`, so repeated starts
+ * skip the assembler. On a miss it's built and stored there; if the cache
+ * can't be written, the cart is still opened from memory.
+*/
+bool openCachedCart(Cart& cart, const std::string& source, bool optimize, const std::string& cacheDir);
+
+#endif // CART_H
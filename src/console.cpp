@@ -1,254 +1,385 @@
 #include "console.h"
+#include "threaded.h"
+#include "jit.h"
+#include "native.h"
+#include "verifier.h"
+#include "profiler.h"
 
-#include <thread>
-#include <mutex>
-#include <fstream>
-#include <iostream>
-
-constexpr uint8_t PALETTE[][3] = {
-	{  21,  25,  26 },
-	{ 138,  76,  88 },
-	{ 217,  98, 117 },
-	{ 230, 184, 193 },
-	{  69, 107, 115 },
-	{  75, 151, 166 },
-	{ 165, 189, 194 },
-	{ 255, 245, 247 }
-};
+#include <cstring>
+#include <algorithm>
 
-Byte Console::next() {
-	return prog()[m_pc++];
+Console::Console() {
+	m_video = Video(vram(), VideoSize, ConsoleScreenWidth, ConsoleScreenHeight);
+	m_threaded = std::make_unique<ThreadedEngine>(this);
+	m_jit = std::make_unique<JitEngine>(this);
+	m_native = std::make_unique<NativeEngine>(this);
+	m_verifier = std::make_unique<Verifier>();
 }
 
-void Console::tick() {
-#define unpack(v) (v.type == Value::Literal ? v.val : data()[v.val])
-#define mop(name, op) \
-case name: { \
-	Byte a = unpack(m_stack.top()); m_stack.pop(); \
-	Byte b = unpack(m_stack.top()); m_stack.pop(); \
-	m_stack.push(Value(a op b, Value::Literal)); \
-} break;
+Console::~Console() = default;
 
-	if (m_waitTimer > 0) {
-		m_waitTimer--;
-	} else {
-		OpCode op = OpCode(next());
-		switch (op) {
-			case OpHalt: m_halted = true; break;
-			case OpPush: m_stack.push(Value(next(), Value::Literal)); break;
-			case OpPushM: m_stack.push(Value(next(), Value::MemoryAddr)); break;
-			case OpPop: {
-				Byte value = unpack(m_stack.top());
-				data()[next()] = value;
-				m_stack.pop();
-			} break;
-			case OpWait: {
-				Byte N = unpack(m_stack.top()); m_stack.pop();
-				m_waitTimer = N * 512;
-			} break;
-
-			mop(OpAdd, +)
-			mop(OpSub, -)
-			mop(OpMul, *)
-			mop(OpDiv, /)
-			mop(OpAnd, &)
-			mop(OpOr, |)
-			mop(OpXor, ^)
-
-			case OpInc: data()[next()]++; break;
-			case OpDec: data()[next()]--; break;
-
-			case OpRsh: {
-				Byte a = unpack(m_stack.top()); m_stack.pop();
-				Byte n = unpack(m_stack.top()); m_stack.pop();
-				m_stack.push(Value(a >> n, Value::Literal));
-			} break;
-
-			case OpLsh: {
-				Byte a = unpack(m_stack.top()); m_stack.pop();
-				Byte n = unpack(m_stack.top()); m_stack.pop();
-				m_stack.push(Value(a << n, Value::Literal));
-			} break;
-			
-			case OpNot: {
-				Byte a = unpack(m_stack.top()); m_stack.pop();
-				m_stack.push(Value(~a, Value::Literal));
-			} break;
-
-			case OpCmp: {
-				Byte mem = data()[next()];
-				Byte lit = next();
-				if (mem == lit) m_cmpResult = CmpEquals;
-				else if (mem > lit) m_cmpResult = CmpGreater;
-				else if (mem < lit) m_cmpResult = CmpLess;
-			} break;
-			case OpCmpM: {
-				Byte a = data()[next()];
-				Byte b = data()[next()];
-				if (a == b) m_cmpResult = CmpEquals;
-				else if (a > b) m_cmpResult = CmpGreater;
-				else if (a < b) m_cmpResult = CmpLess;
-			} break;
-			case OpJmp: m_pc = next(); break;
-			case OpJeq: { Byte pos = next(); if (m_cmpResult == CmpEquals) m_pc = pos; } break;
-			case OpJne: { Byte pos = next(); if (m_cmpResult != CmpEquals) m_pc = pos; } break;
-			case OpJgt: { Byte pos = next(); if (m_cmpResult == CmpGreater) m_pc = pos; } break;
-			case OpJlt: { Byte pos = next(); if (m_cmpResult == CmpLess) m_pc = pos; } break;
-			case OpJge: { Byte pos = next(); if (m_cmpResult == CmpGreater || m_cmpResult == CmpEquals) m_pc = pos; } break;
-			case OpJle: { Byte pos = next(); if (m_cmpResult == CmpLess || m_cmpResult == CmpEquals) m_pc = pos; } break;
-			case OpCall: m_callStack.push(m_pc); m_pc = next(); break;
-			case OpRet: m_pc = m_callStack.top(); m_callStack.pop(); next(); break;
-			case OpPutP: {
-				Byte y = unpack(m_stack.top()); m_stack.pop();
-				Byte x = unpack(m_stack.top()); m_stack.pop();
-				m_video.put(x, y, next());
-			} break;
-			case OpPutPM: {
-				Byte y = unpack(m_stack.top()); m_stack.pop();
-				Byte x = unpack(m_stack.top()); m_stack.pop();
-				m_video.put(x, y, data()[next()]);
-			} break;
-			case OpPutS: {
-				Byte y = unpack(m_stack.top()); m_stack.pop();
-				Byte x = unpack(m_stack.top()); m_stack.pop();
-				Byte frame = 0;
-				if (!m_stack.empty()) {
-					frame = unpack(m_stack.top()); m_stack.pop();
-				}
-				m_video.sprite(x, y, &data()[next() + 64 * frame]);
-			} break;
-			case OpNoop: break;
-			case OpSys: {
-				Byte sc = SystemCall(next());
-				switch (sc) {
-					case SysClearScreen: {
-						Byte color = 0;
-						if (!m_stack.empty()) {
-							color = unpack(m_stack.top()); m_stack.pop();
-						}
-						m_video.clear(color);
-					} break;
-				}
-			} break;
-			default: break;
-		}
+void Console::writeProgram(uint16_t addr, const Byte* code, uint32_t size) {
+	assert(addr + size <= ProgramSize && "Program too big");
+	std::memcpy(prog() + addr, code, sizeof(Byte) * size);
+	invalidateProgram(addr, addr + size);
+}
+
+void Console::invalidateProgram(uint16_t begin, uint16_t end) {
+	m_threaded->invalidate(begin, end);
+	m_jit->invalidate(begin, end);
+	m_native->invalidate(begin, end);
+	m_verifyPending = true;
+	m_fast = false;
+}
+
+const Verifier& Console::verifier() {
+	if (m_verifyPending) {
+		m_verifier->verify(prog());
+		m_verifyPending = false;
 	}
+	return *m_verifier;
 }
 
-void Console::flip() {
-	m_lock.lock();
-	Uint8 *pixels;
-	int pitch;
-	int w, h;
-	Uint32 format;
-	SDL_QueryTexture(m_buffer, &format, nullptr, &w, &h);
+void Console::setNativeCart(const NativeCart* cart) {
+	m_native->setCart(cart);
+}
 
-	SDL_LockTexture(m_buffer, nullptr, (void**) &pixels, &pitch);
-	SDL_PixelFormat fmt;
-	fmt.format = format;
+void Console::reset() {
+	m_pc = 0;
+	m_waitTimer = 0;
+	m_cmpResult = CmpEquals;
+	m_stack.clear();
+	m_callStack.clear();
+	m_halted = false;
+	m_video.markAsNotDirty();
+}
+
+uint64_t Console::run(uint64_t maxInstructions) {
+	// The engines skip the checks, what the verifier can't vouch for is interpreted.
+	m_fast = verifier().admits(*this);
 
-	for (uint32_t y = 0; y < ConsoleScreenHeight; y++) {
-		for (uint32_t x = 0; x < ConsoleScreenWidth; x++) {
-			uint32_t i = x + y * ConsoleScreenWidth;
-			uint32_t j = i * 3;
+#if CONSOLE_TRACE
+	// The engines don't record, traced consoles are interpreted.
+	const bool engines = m_fast && !m_trace;
+#else
+	const bool engines = m_fast;
+#endif
 
-			uint8_t col = vram()[i];
-			pixels[j + 0] = PALETTE[col][0];
-			pixels[j + 1] = PALETTE[col][1];
-			pixels[j + 2] = PALETTE[col][2];
+	uint64_t count = 0;
+#if CONSOLE_PROFILER
+	if (m_profiler) {
+		count = m_profiler->run(*this, maxInstructions);
+	} else
+#endif
+	if (engines && m_engine == EngineJIT && m_jit->available()) {
+		count = m_jit->run(maxInstructions);
+	} else if (engines && m_engine == EngineNative && m_native->valid()) {
+		count = m_native->run(maxInstructions);
+	} else if (engines && m_engine != EngineInterpreter) {
+		count = m_threaded->run(maxInstructions);
+	} else {
+		while (count < maxInstructions && !m_halted && !m_video.dirty()) {
+			tick();
+			count++;
 		}
 	}
-	SDL_UnlockTexture(m_buffer);
 
-	SDL_RenderClear(m_renderer);
-	SDL_Rect dst = { 0, 0, ConsoleScreenWidth * PixelSize, ConsoleScreenHeight * PixelSize };
-	SDL_RenderCopy(m_renderer, m_buffer, nullptr, &dst);
-	SDL_RenderPresent(m_renderer);
+	return count;
+}
 
-	m_video.markAsNotDirty();
+Byte Console::next() {
+	return prog()[m_pc++];
+}
+
+bool Console::taken(Byte jump) const {
+	switch (jump) {
+		case OpJeq: return m_cmpResult == CmpEquals;
+		case OpJne: return m_cmpResult != CmpEquals;
+		case OpJgt: return m_cmpResult == CmpGreater;
+		case OpJlt: return m_cmpResult == CmpLess;
+		case OpJge: return m_cmpResult == CmpGreater || m_cmpResult == CmpEquals;
+		case OpJle: return m_cmpResult == CmpLess || m_cmpResult == CmpEquals;
+		default: return false;
+	}
+}
+
+bool Console::tileLayer(TileLayer& layer) {
+	const Byte* regs = opts();
+	if (!(regs[OptsTileControl] & TileControlEnable)) return false;
 
-	m_lock.unlock();
+	Byte map = regs[OptsTileMap], tiles = regs[OptsTileSet];
+	uint64_t width = regs[OptsTileMapWidth], height = regs[OptsTileMapHeight];
+	if (width == 0 || height == 0 || map >= DataAddressable || tiles >= DataAddressable) return false;
+	if (width * height > DataAddressable - map) return false;
+
+	layer.map = data() + map;
+	layer.tiles = data() + tiles;
+	layer.mapWidth = uint32_t(width);
+	layer.mapHeight = uint32_t(height);
+	layer.tileCount = (DataAddressable - tiles) / (SpriteSize * SpriteSize);
+	layer.scrollX = regs[OptsScrollX];
+	layer.scrollY = regs[OptsScrollY];
+	layer.key = uint8_t(regs[OptsTileControl] >> TileControlKeyShift);
+	return true;
 }
 
-void Console::init() {
-	if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
-		return;
+const Pixel* Console::composeFrame() {
+	TileLayer layer;
+	if (!tileLayer(layer)) return vram();
+
+	m_composed.resize(VideoSize);
+	m_video.compose(m_composed.data(), layer);
+	return m_composed.data();
+}
+
+uint32_t Console::drawSpriteTable(Byte table, Byte count) {
+	if (table >= DataAddressable) return 0;
+	count = std::min<Byte>(count, (DataAddressable - table) / SpriteEntrySize);
+
+	for (uint32_t i = 0; i < count; i++) {
+		const Byte* entry = data() + table + i * SpriteEntrySize;
+		Byte sprite = entry[SpriteEntryData];
+		if (sprite > DataAddressable - SpriteSize * SpriteSize) continue;
+		m_video.blit(entry[SpriteEntryX], entry[SpriteEntryY], data() + sprite, entry[SpriteEntryFlags]);
 	}
+	return count;
+}
 
-	m_window = SDL_CreateWindow(
-		"Console",
-		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-		ConsoleScreenWidth * PixelSize, ConsoleScreenHeight * PixelSize,
-		SDL_WINDOW_SHOWN
-	);
+void Console::tick() {
+	m_ticks++;
+	if (m_waitTimer > 0) {
+		m_waitTimer--;
+		m_cycles++;
+	} else {
+#if CONSOLE_TRACE
+		if (m_trace) traceInstruction();
+#endif
+		// A PC past the program halts in step() and costs what a halt does, without reading past prog().
+		m_cycles += cycleCost(m_pc < ProgramSize ? prog()[m_pc] : Byte(OpHalt));
+		execute();
+	}
+}
 
-	if (m_window == nullptr) {
-		SDL_Quit();
-		return;
+#if CONSOLE_TRACE
+static_assert(LEN(TraceRecord{}.operands) >= MaxOperandCount, "Trace records must hold every operand");
+
+void Console::traceInstruction() {
+	TraceRecord record{};
+	record.cycle = m_cycles;
+	record.pc = uint16_t(std::min<Byte>(m_pc, 0xFFFF));
+	record.stackDepth = uint16_t(m_stack.size());
+	record.callDepth = uint16_t(m_callStack.size());
+	if (m_pc < ProgramSize) {
+		Byte op = prog()[m_pc];
+		record.op = uint8_t(std::min<Byte>(op, 0xFF));
+		for (uint32_t i = 0; i < operandCount(op) && m_pc + 1 + i < ProgramSize; i++) record.operands[i] = prog()[m_pc + 1 + i];
 	}
+	m_trace->push(record);
+}
+#endif
 
-	m_renderer = SDL_CreateRenderer(
-		m_window,
-		-1,
-		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
-	);
+void Console::execute() {
+	if (m_fast) step<false>();
+	else step<true>();
+}
 
-	if (m_renderer == nullptr) {
-		SDL_Quit();
+template <bool Checked>
+void Console::step() {
+	// Running off the end of program memory halts, instead of executing
+	// whatever the memory layout happens to put after it.
+	if (m_pc >= ProgramSize) {
+		m_halted = true;
 		return;
 	}
 
-	m_buffer = SDL_CreateTexture(
-		m_renderer,
-		SDL_PIXELFORMAT_RGB24,
-		SDL_TEXTUREACCESS_STREAMING,
-		ConsoleScreenWidth, ConsoleScreenHeight
-	);
+	const Byte* at = prog() + m_pc;
+	if (namesCycleCounter(at[0], at[1], at[2])) {
+		opts()[OptsCycleCounter] = Byte(m_cycles);
+		opts()[OptsCycleCounterHigh] = Byte(m_cycles >> 32);
+	}
 
-	m_video = Video(vram(), VideoSize, ConsoleScreenWidth, ConsoleScreenHeight);
+	auto mem = [this](Byte addr) -> Byte& {
+		if (Checked && addr >= DataAddressable) {
+			m_openBus = 0;
+			return m_openBus;
+		}
+		return data()[addr];
+	};
+	auto pop = [&]() -> Byte {
+		if (Checked && m_stack.empty()) return 0;
+		Value v = m_stack.top();
+		m_stack.pop();
+		return v.type == Value::Literal ? v.val : mem(v.val);
+	};
 
-	m_halted = false;
+#define mop(name, op) \
+case name: { \
+	Byte a = pop(); \
+	Byte b = pop(); \
+	m_stack.push(Value(a op b, Value::Literal)); \
+} break;
+#define mopmi(name, op) \
+case name: { \
+	Byte& m = mem(next()); \
+	Byte lit = next(); \
+	m = m op lit; \
+} break;
+
+	OpCode op = OpCode(next());
+	switch (op) {
+		case OpHalt: m_halted = true; break;
+		case OpPush: m_stack.push(Value(next(), Value::Literal)); break;
+		case OpPushM: m_stack.push(Value(next(), Value::MemoryAddr)); break;
+		case OpPop: {
+			Byte value = pop();
+			mem(next()) = value;
+		} break;
+		case OpWait: {
+			Byte N = pop();
+			m_waitTimer = N * 512;
+		} break;
+
+		mop(OpAdd, +)
+		mop(OpSub, -)
+		mop(OpMul, *)
+		case OpDiv: {
+			Byte a = pop();
+			Byte b = pop();
+			m_stack.push(Value(quotient(a, b), Value::Literal));
+		} break;
+		mop(OpAnd, &)
+		mop(OpOr, |)
+		mop(OpXor, ^)
 
-	std::thread cpu([](Console* console){
-		while (!console->m_halted) {
-			if (!console->m_video.dirty()) {
-				console->tick();
-				// wait
-				for (int i = 0; i < 512; i++);
+		case OpInc: mem(next())++; break;
+		case OpDec: mem(next())--; break;
+
+		case OpRsh: {
+			Byte a = pop();
+			Byte n = pop();
+			m_stack.push(Value(a >> (n & ShiftMask), Value::Literal));
+		} break;
+
+		case OpLsh: {
+			Byte a = pop();
+			Byte n = pop();
+			m_stack.push(Value(a << (n & ShiftMask), Value::Literal));
+		} break;
+		
+		case OpNot: {
+			Byte a = pop();
+			m_stack.push(Value(~a, Value::Literal));
+		} break;
+
+		case OpCmp: {
+			Byte m = mem(next());
+			Byte lit = next();
+			if (m == lit) m_cmpResult = CmpEquals;
+			else if (m > lit) m_cmpResult = CmpGreater;
+			else if (m < lit) m_cmpResult = CmpLess;
+		} break;
+		case OpCmpM: {
+			Byte a = mem(next());
+			Byte b = mem(next());
+			if (a == b) m_cmpResult = CmpEquals;
+			else if (a > b) m_cmpResult = CmpGreater;
+			else if (a < b) m_cmpResult = CmpLess;
+		} break;
+		case OpJmp: m_pc = next(); break;
+		case OpJeq: { Byte pos = next(); if (m_cmpResult == CmpEquals) m_pc = pos; } break;
+		case OpJne: { Byte pos = next(); if (m_cmpResult != CmpEquals) m_pc = pos; } break;
+		case OpJgt: { Byte pos = next(); if (m_cmpResult == CmpGreater) m_pc = pos; } break;
+		case OpJlt: { Byte pos = next(); if (m_cmpResult == CmpLess) m_pc = pos; } break;
+		case OpJge: { Byte pos = next(); if (m_cmpResult == CmpGreater || m_cmpResult == CmpEquals) m_pc = pos; } break;
+		case OpJle: { Byte pos = next(); if (m_cmpResult == CmpLess || m_cmpResult == CmpEquals) m_pc = pos; } break;
+		case OpCall: m_callStack.push(m_pc); m_pc = next(); break;
+		case OpRet:
+			if (Checked && m_callStack.empty()) {
+				m_halted = true;
+				break;
 			}
-		}
-	}, this);
-
-	SDL_Event evt{};
-	while (!m_halted) {
-		while (SDL_PollEvent(&evt)) {
-			switch (evt.type) {
-				case SDL_QUIT: m_halted = true; break;
-				case SDL_KEYDOWN: {
-					if (evt.key.keysym.sym == SDLK_F10) {
-						m_lock.lock();
-						std::ofstream fs("memory.dat", std::ios::binary | std::ios::ate);
-						if (fs.good()) {
-							fs.write(reinterpret_cast<char*>(m_ram.data().data()), sizeof(Byte) * m_ram.data().size());
-							fs.close();
-							std::cout << "Saved memory dump" << std::endl;
-						}
-						m_lock.unlock();
-					}
+			m_pc = m_callStack.top(); m_callStack.pop(); next();
+			break;
+		case OpPutP: {
+			Byte y = pop();
+			Byte x = pop();
+			m_video.put(x, y, next());
+		} break;
+		case OpPutPM: {
+			Byte y = pop();
+			Byte x = pop();
+			m_video.put(x, y, mem(next()));
+		} break;
+		case OpPutS: {
+			Byte y = pop();
+			Byte x = pop();
+			Byte frame = 0;
+			if (!m_stack.empty()) frame = pop();
+			// The frame is only known now, even verified code checks it.
+			Byte addr = next();
+			if (spriteFits(addr, frame)) m_video.sprite(x, y, &data()[addr + 64 * frame]);
+		} break;
+		case OpNoop: break;
+
+		mopmi(OpAddMI, +)
+		mopmi(OpSubMI, -)
+		mopmi(OpMulMI, *)
+		case OpDivMI: {
+			Byte& m = mem(next());
+			m = quotient(m, next());
+		} break;
+		case OpLshMI: {
+			Byte& m = mem(next());
+			m = m << (next() & ShiftMask);
+		} break;
+		case OpRshMI: {
+			Byte& m = mem(next());
+			m = m >> (next() & ShiftMask);
+		} break;
+		mopmi(OpAndMI, &)
+		mopmi(OpOrMI, |)
+		mopmi(OpXorMI, ^)
+
+		case OpCmpJ:
+		case OpCmpMJ: {
+			Byte a = mem(next());
+			Byte b = op == OpCmpJ ? next() : mem(next());
+			Byte jump = next();
+			Byte pos = next();
+			if (a == b) m_cmpResult = CmpEquals;
+			else if (a > b) m_cmpResult = CmpGreater;
+			else if (a < b) m_cmpResult = CmpLess;
+			if (taken(jump)) m_pc = pos;
+		} break;
+		case OpSys: {
+			Byte sc = SystemCall(next());
+			switch (sc) {
+				case SysClearScreen: {
+					Byte color = 0;
+					if (!m_stack.empty()) color = pop();
+					m_video.clear(color);
+				} break;
+				case SysDrawSprites: {
+					Byte count = pop();
+					Byte table = pop();
+					m_cycles += SpriteEntryCycles * drawSpriteTable(table, count);
+				} break;
+				case SysFlip: m_video.flip(); break;
+				case SysAlloc: {
+					Byte size = pop();
+					Byte addr = m_heap.alloc(size);
+					if (addr != Allocator::Invalid) std::fill_n(data() + addr, size, 0u);
+					m_stack.push(Value(addr, Value::Literal));
+				} break;
+				case SysFree: {
+					Byte addr = pop();
+					m_heap.free(addr);
 				} break;
-				default: break;
 			}
-		}
-
-		if (m_video.dirty()) {
-			flip();
-		}
+		} break;
+		default: break;
 	}
 
-	cpu.join();
-
-	SDL_DestroyTexture(m_buffer);
-	SDL_DestroyRenderer(m_renderer);
-	SDL_DestroyWindow(m_window);
-	SDL_Quit();
+#undef mop
+#undef mopmi
 }
@@ -1,18 +1,17 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
-#if !__has_include("SDL2.h")
-#include "SDL2/SDL.h"
-#else
-#include "SDL2.h"
-#endif
-
 #include "ram.h"
+#include "allocator.h"
 #include "video.h"
+#include "stack.h"
+#if CONSOLE_TRACE
+#include "trace.h"
+#endif
 
-#include <stack>
 #include <vector>
-#include <mutex>
+#include <atomic>
+#include <memory>
 
 /**
  * Memory Layout
@@ -38,6 +37,12 @@
  * |    CONSOLE OPTS    |
  * |                    |
  * +--------------------+
+ *
+ * Sizes are in 32-bit words. This is the layout with CONSOLE_VRAM_BPP=32.
+ * By default VRAM holds a byte per pixel in its own buffer, and RAM shrinks
+ * to 15KB words, with data storage at 0x3000 and opts at 0x3A00. Programs
+ * can't tell the difference: they reach data through data() offsets and
+ * VRAM only through the video chip.
 */
 
 constexpr int ConsoleScreenWidth = 96;
@@ -49,6 +54,20 @@ constexpr uint16_t VideoSize = 9216;
 constexpr uint16_t DataSize = 2560;
 constexpr uint16_t OptsSize = 512;
 constexpr uint16_t RenderWaitTime = 16384;
+constexpr uint32_t DataAddressable = DataSize + OptsSize; // Words reachable from data()
+
+#if CONSOLE_VRAM_BPP == 32
+constexpr uint16_t RamSizeKB = 24;
+constexpr uint16_t VideoAddress = 0x3000;
+constexpr uint16_t DataAddress = 0x5400;
+#else
+constexpr uint16_t RamSizeKB = 15;
+constexpr uint16_t DataAddress = 0x3000;
+#endif
+constexpr uint16_t OptsAddress = DataAddress + DataSize;
+static_assert(OptsAddress + OptsSize == RamSizeKB * 1024, "The memory layout must fill the RAM");
+constexpr uint32_t StackSize = 1024;
+constexpr uint32_t CallStackSize = 256;
 
 #define LEN(x) (sizeof(x) / sizeof(x[0]))
 
@@ -64,9 +83,9 @@ enum OpCode {
 	OpAdd,				// Pops 2 values from the stack, adds them and pushes the result to it
 	OpSub,				// Pops 2 values from the stack, subtracts them and pushes the result to it
 	OpMul,				// Pops 2 values from the stack, multiplies them and pushes the result to it
-	OpDiv,				// Pops 2 values from the stack, divides them and pushes the result to it
-	OpLsh,				// Pops a value from the stack, shifts it to the left and pushes the result to it
-	OpRsh,				// Pops a value from the stack, shifts it to the right and pushes the result to it
+	OpDiv,				// Pops a value, then a divisor, and pushes quotient(value, divisor)
+	OpLsh,				// Pops a value, then a count, and pushes the value shifted left by count & ShiftMask
+	OpRsh,				// Pops a value, then a count, and pushes the value shifted right by count & ShiftMask
 	OpAnd,				// Pops 2 values from the stack, bitwise ANDs them and pushes the result to it
 	OpOr,				// Pops 2 values from the stack, bitwise ORs them and pushes the result to it
 	OpXor,				// Pops 2 values from the stack, bitwise XORs them and pushes the result to it
@@ -99,36 +118,282 @@ enum OpCode {
 
 	OpSys,				// System call
 
-	OpNoop
+	OpNoop,
+
+	/* FUSED (emitted by the assembler's peephole pass, see ASM::setOptimize) */
+	OpAddMI,			// MEMORY = MEMORY + LITERAL
+	OpSubMI,			// MEMORY = MEMORY - LITERAL
+	OpMulMI,			// MEMORY = MEMORY * LITERAL
+	OpDivMI,			// MEMORY = quotient(MEMORY, LITERAL)
+	OpLshMI,			// MEMORY = MEMORY << LITERAL
+	OpRshMI,			// MEMORY = MEMORY >> LITERAL
+	OpAndMI,			// MEMORY = MEMORY & LITERAL
+	OpOrMI,				// MEMORY = MEMORY | LITERAL
+	OpXorMI,			// MEMORY = MEMORY ^ LITERAL
+	OpCmpJ,				// OpCmp followed by a jump: MEMORY, LITERAL, jump opcode (OpJeq..OpJle), target
+	OpCmpMJ				// OpCmpM followed by a jump: MEMORY, MEMORY, jump opcode (OpJeq..OpJle), target
 };
 
 enum SystemCall {
 	SysNone = 0,
 	SysClearScreen = 0xF0,	// Pops a color from the stack and clears the screen, if the stack is empty, 0 is used.
-	SysFlip,				// Flips the backbuffer to the screen
+	SysFlip,				// Ends the frame, for carts that only changed the tile layer
+	SysDrawSprites,			// Pops an entry count, then the data address of a sprite table, and draws it
+	SysAlloc,				// Pops a size, pushes the data address of that many zeroed words (0xFFFFFFFF if they don't fit)
+	SysFree,				// Pops a data address returned by SysAlloc and frees it
+};
+
+/**
+ * Sprite table entry drawn by SysDrawSprites, SpriteEntrySize words of
+ * data memory each: position, data address of the sprite's 64 words and
+ * SpriteFlags (color key in bits 8-15). Entries whose sprite doesn't fit
+ * in data memory are skipped.
+*/
+enum SpriteEntryField {
+	SpriteEntryX = 0,
+	SpriteEntryY,
+	SpriteEntryData,
+	SpriteEntryFlags,
+	SpriteEntrySize
 };
 
+/// Most operand words any instruction has.
+constexpr uint32_t MaxOperandCount = 4;
+
+/// Shifts only use the low bits of their count, like x86 does for 32-bit words, on every engine.
+constexpr Byte ShiftMask = 31;
+
+/// Division on every engine: dividing by zero gives 0 (OpDivMI stores it too, so fusing never changes a result).
+constexpr Byte quotient(Byte value, Byte divisor) {
+	return divisor != 0 ? value / divisor : 0;
+}
+
+/// Number of operand words that follow an opcode in the program.
+constexpr uint32_t operandCount(Byte op) {
+	switch (op) {
+		case OpPush: case OpPushM: case OpPop:
+		case OpInc: case OpDec:
+		case OpJmp: case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle:
+		case OpCall:
+		case OpPutP: case OpPutPM: case OpPutS:
+		case OpSys:
+			return 1;
+		case OpCmp: case OpCmpM:
+		case OpAddMI: case OpSubMI: case OpMulMI: case OpDivMI: case OpLshMI:
+		case OpRshMI: case OpAndMI: case OpOrMI: case OpXorMI:
+			return 2;
+		case OpCmpJ: case OpCmpMJ:
+			return 4;
+		default: return 0;
+	}
+}
+
+/**
+ * Cycles taken by each opcode, the timing model the frame scheduler
+ * (see scheduler.h) budgets against. Fused opcodes cost as much as the
+ * sequence they replace, so the peephole pass doesn't change timing.
+ * Opcodes missing from the table take 1 cycle, as do ticks spent waiting.
+*/
+constexpr uint8_t OpCycles[] = {
+	1,						// OpHalt
+	1, 1, 2,				// OpPush, OpPushM, OpPop
+	2,						// OpWait
+	1, 1, 3, 8,				// OpAdd, OpSub, OpMul, OpDiv
+	1, 1, 1, 1, 1, 1,		// OpLsh, OpRsh, OpAnd, OpOr, OpXor, OpNot
+	2, 2,					// OpInc, OpDec
+	2, 3,					// OpCmp, OpCmpM
+	2, 2, 2, 2, 2, 2, 2,	// OpJmp..OpJle
+	3, 3,					// OpCall, OpRet
+	4, 4, 64,				// OpPutP, OpPutPM, OpPutS
+	32,						// OpSys
+	1,						// OpNoop
+	5, 5, 7, 12, 5, 5, 5, 5, 5,	// OpAddMI..OpXorMI
+	4, 5					// OpCmpJ, OpCmpMJ
+};
+static_assert(sizeof(OpCycles) == OpCmpMJ + 1, "Missing opcode costs");
+
+/// SysDrawSprites takes this many cycles per table entry, on top of OpSys.
+constexpr uint32_t SpriteEntryCycles = 16;
+
+inline uint32_t cycleCost(Byte op) {
+	return op < sizeof(OpCycles) ? OpCycles[op] : 1;
+}
+
+/// Whether the 64 words puts reads for `frame` of the sprite at data address `addr` are in data memory.
+inline bool spriteFits(Byte addr, Byte frame) {
+	return uint64_t(addr) + uint64_t(SpriteSize * SpriteSize) * (uint64_t(frame) + 1) <= DataAddressable;
+}
+
+/// Registers at the start of opts(), readable by carts at data address DataSize + register.
+enum OptsRegister {
+	OptsCycleCounter = 0,	// Cycles executed so far (low word), see namesCycleCounter()
+	OptsCycleCounterHigh,	// High word of the cycle counter
+
+	/* TILE LAYER (see TileLayer), composed under VRAM whenever a frame is presented */
+	OptsTileControl,		// Bit 0 enables the layer, bits 8-15 are the VRAM color it shows through
+	OptsTileMap,			// Data address of the map, OptsTileMapWidth * OptsTileMapHeight tile indices
+	OptsTileSet,			// Data address of the tiles, 64 words each
+	OptsTileMapWidth,		// Map size in tiles
+	OptsTileMapHeight,
+	OptsScrollX,			// Screen position within the map in pixels, wrapping around
+	OptsScrollY
+};
+
+/**
+ * Whether the instruction op a b names a cycle counter register as a data
+ * operand. The counter is brought up to date, cycles of that instruction
+ * included, right before such an instruction executes and at no other
+ * time, so what a cart reads from it doesn't depend on how the host
+ * slices Console::run(). The engines hand these to Console::execute().
+*/
+inline bool namesCycleCounter(Byte op, Byte a, Byte b) {
+	auto counter = [](Byte addr) { return addr - (DataSize + OptsCycleCounter) <= OptsCycleCounterHigh - OptsCycleCounter; };
+	switch (op) {
+		case OpPushM: case OpPop: case OpInc: case OpDec: case OpPutPM: case OpCmp: case OpCmpJ:
+			return counter(a);
+		case OpCmpM: case OpCmpMJ:
+			return counter(a) || counter(b);
+		default:
+			return op >= OpAddMI && op <= OpXorMI && counter(a);
+	}
+}
+
+constexpr uint32_t TileControlEnable = 1 << 0;
+constexpr uint32_t TileControlKeyShift = 8;
+
+enum EngineType {
+	EngineInterpreter = 0,	// Reference interpreter (Console::tick)
+	EngineThreaded,			// Pre-decoded, direct-threaded interpreter (see threaded.h)
+	EngineJIT,				// x86-64 native code (see jit.h), EngineThreaded where unavailable
+	EngineNative			// Cart recompiled to C++ (see native.h), EngineThreaded without one
+};
+
+class ThreadedEngine;
+class JitEngine;
+class NativeEngine;
+class NativeMachine;
+class SaveState;
+class HotPatch;
+class Verifier;
+class Profiler;
+struct NativeCart;
+
+/**
+ * The console core. It owns the memory and the video chip and executes
+ * the program, but knows nothing about windows or threads: frontends
+ * (SDL, headless) drive it through run() and pick up finished frames
+ * from video().
+*/
 class Console {
 public:
-	Console() = default;
-	~Console() = default;
+	Console();
+	~Console();
+
+	Console(const Console&) = delete;
+	Console& operator =(const Console&) = delete;
 
-	void init();
+	/// Resets the CPU state (PC, stacks, flags). Memory is left untouched.
+	void reset();
 
 	Byte* prog() { return &m_ram[0x0000u]; }
-	Byte* vram() { return &m_ram[0x3000u]; }
-	Byte* data() { return &m_ram[0x5400u]; }
-	Byte* opts() { return &m_ram[0x5E00u]; }
+	Byte* data() { return &m_ram[DataAddress]; }
+	Byte* opts() { return &m_ram[OptsAddress]; }
+#if CONSOLE_VRAM_BPP == 32
+	Pixel* vram() { return &m_ram[VideoAddress]; }
+#else
+	Pixel* vram() { return m_vram.map(0); }
+#endif
 
-	RAM<24>& ram() { return m_ram; }
+	RAM<RamSizeKB>& ram() { return m_ram; }
+	Video& video() { return m_video; }
+
+	/// Allocator for data memory (DataSize words from data(), the opts are
+	/// not in it). The assembler places `let` data with it and carts reach
+	/// it through SysAlloc and SysFree.
+	Allocator& heap() { return m_heap; }
+
+	/// Reads the tile layer from the opts registers. False if it's disabled or doesn't fit in data memory.
+	bool tileLayer(TileLayer& layer);
+
+	/// The frame to present: VRAM, composed over the tile layer if it's enabled.
+	const Pixel* composeFrame();
+
+	/// Copies `size` words of code to `prog()[addr]`. Host code must write
+	/// program memory through here (or call invalidateProgram()), so the
+	/// execution engines can drop what they decoded from the old code.
+	void writeProgram(uint16_t addr, const Byte* code, uint32_t size);
+	void invalidateProgram(uint16_t begin = 0, uint16_t end = ProgramSize);
+
+	/**
+	 * The verifier's verdict on the program (see verifier.h). Verified
+	 * programs run on unchecked paths, the others on checked ones that
+	 * treat what would be out of bounds as harmless.
+	*/
+	const Verifier& verifier();
+
+	void setEngine(EngineType engine) { m_engine = engine; }
+	void setNativeCart(const NativeCart* cart);
+	EngineType engine() const { return m_engine; }
+
+#if CONSOLE_PROFILER
+	/// Runs the program under `profiler` (see profiler.h) until it's set back to null. Not owned.
+	void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+	Profiler* profiler() const { return m_profiler; }
+#endif
+
+#if CONSOLE_TRACE
+	/// Records every instruction executed into `ring` (see trace.h) until it's set back to null. Not owned.
+	void setTrace(TraceRing* ring) { m_trace = ring; }
+	TraceRing* trace() const { return m_trace; }
+#endif
 
 	void tick();
 
+	/// Ticks until a frame is ready, the console halts or
+	/// `maxInstructions` ticks were executed. Returns the number of ticks.
+	uint64_t run(uint64_t maxInstructions);
+
+	bool halted() const { return m_halted; }
+	void halt() { m_halted = true; }
+
+	uint64_t ticks() const { return m_ticks; }
+	uint64_t cycles() const { return m_cycles; }
+	Byte pc() const { return m_pc; }
+
 private:
-	void flip();
+	friend class ThreadedEngine;
+	friend class JitEngine;
+	friend class NativeEngine;
+	friend class NativeMachine;
+	friend class SaveState;
+	friend class HotPatch;
+	friend class Verifier;
+	friend class Profiler;
+
+	/// Executes the instruction at the PC (tick() minus the wait timer, tick and cycle counts).
+	void execute();
+
+	/**
+	 * execute() with or without the checks. Checked, stack underflows pop
+	 * 0, memory operands out of data memory read 0 and drop writes and a
+	 * return with an empty call stack halts.
+	*/
+	template <bool Checked>
+	void step();
 
 	Byte next();
 
+#if CONSOLE_TRACE
+	/// Pushes the instruction at the PC, about to be executed, to m_trace.
+	void traceInstruction();
+#endif
+
+	/// Whether the jump opcode `jump` (OpJeq..OpJle) branches on the current compare result.
+	bool taken(Byte jump) const;
+
+	/// Draws `count` entries of the sprite table at data address `table`, returns how many it read.
+	uint32_t drawSpriteTable(Byte table, Byte count);
+
 	struct Value {
 		Byte val{ 0 };
 		enum Type { Unknown = 0, Literal, MemoryAddr } type{ Unknown };
@@ -143,23 +408,41 @@ private:
 		CmpLess
 	};
 
-	SDL_Window *m_window;
-	SDL_Renderer *m_renderer;
-	SDL_Texture *m_buffer;
-
 	// Console components
-	RAM<24> m_ram; // 24KB
+	RAM<RamSizeKB> m_ram;
+#if CONSOLE_VRAM_BPP != 32
+	RAM<VideoSize / 1024, Pixel> m_vram;
+#endif
 	Video m_video;
+	std::vector<Pixel> m_composed;
+	Allocator m_heap{ DataSize };
 
-	Byte m_pc, m_waitTimer = 0;
-	CmpResult m_cmpResult;
+	Byte m_pc{ 0 }, m_waitTimer{ 0 };
+	CmpResult m_cmpResult{ CmpEquals };
 
-	std::stack<Value> m_stack;
-	std::stack<Byte> m_callStack;
+	FixedStack<Value, StackSize> m_stack;
+	FixedStack<Byte, CallStackSize> m_callStack;
 
-	std::mutex m_lock;
+	uint64_t m_ticks{ 0 }, m_cycles{ 0 };
+
+	EngineType m_engine{ EngineThreaded };
+	std::unique_ptr<ThreadedEngine> m_threaded;
+	std::unique_ptr<JitEngine> m_jit;
+	std::unique_ptr<NativeEngine> m_native;
+
+	std::unique_ptr<Verifier> m_verifier;
+	bool m_verifyPending{ true };
+	bool m_fast{ false };	// The verifier admitted the state run() started from
+	Byte m_openBus{ 0 };	// What checked reads and writes out of data memory go to
+
+#if CONSOLE_PROFILER
+	Profiler* m_profiler{ nullptr };
+#endif
+#if CONSOLE_TRACE
+	TraceRing* m_trace{ nullptr };
+#endif
 
-	bool m_halted;
+	std::atomic<bool> m_halted{ false };
 };
 
 #endif // CONSOLE_H
@@ -0,0 +1,28 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 64-bit FNV-1a, for cart, source and memory hashes. Hashing bytes and
+ * hashing whole words give different values, so each hash sticks to the
+ * one it was defined with: cart hashes are over bytes, the hashes of
+ * `let` values and of savestate memory are over words.
+*/
+constexpr uint64_t FnvOffsetBasis = 14695981039346656037ull;
+constexpr uint64_t FnvPrime = 1099511628211ull;
+
+/// Folds one word (or byte) into `hash`.
+constexpr uint64_t fnv1aWord(uint64_t hash, uint64_t word) {
+	return (hash ^ word) * FnvPrime;
+}
+
+/// FNV-1a of `size` bytes, continuing from `hash`.
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FnvOffsetBasis) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) hash = fnv1aWord(hash, bytes[i]);
+	return hash;
+}
+
+#endif // HASH_H
@@ -0,0 +1,126 @@
+#include "headless.h"
+
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+void CallbackSink::frame(uint64_t index, const Pixel* vram, int width, int height) {
+	if (m_callback) m_callback(index, vram, width, height);
+}
+
+RawFileSink::RawFileSink(const std::string& fileName)
+	: m_file(fileName, std::ios::binary | std::ios::trunc)
+{}
+
+void RawFileSink::frame(uint64_t, const Pixel* vram, int width, int height) {
+	m_row.resize(width);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			m_row[x] = uint8_t(vram[x + y * width]);
+		}
+		m_file.write(reinterpret_cast<const char*>(m_row.data()), m_row.size());
+	}
+}
+
+Headless::Headless(Console* console, FrameSink* sink)
+	: m_console(console), m_sink(sink)
+{}
+
+void Headless::emitFrame(HeadlessStats& stats) {
+	if (m_sink) m_sink->frame(m_frameIndex, m_console->composeFrame(), ConsoleScreenWidth, ConsoleScreenHeight);
+	m_console->video().markAsNotDirty();
+	m_frameIndex++;
+	m_frameTicks = 0;
+	stats.frames++;
+}
+
+bool Headless::step(uint64_t maxInstructions, HeadlessStats& stats) {
+	uint64_t budget = std::min(maxInstructions, m_frameTickLimit - m_frameTicks);
+	uint64_t cycles = m_console->cycles();
+	uint64_t count = m_console->run(budget);
+	stats.instructions += count;
+	stats.cycles += m_console->cycles() - cycles;
+	m_frameTicks += count;
+
+	if (m_console->video().dirty() || m_frameTicks >= m_frameTickLimit) {
+		emitFrame(stats);
+		return true;
+	}
+	return false;
+}
+
+HeadlessStats Headless::runFrames(uint64_t frames) {
+	HeadlessStats stats{};
+	auto start = std::chrono::steady_clock::now();
+	while (stats.frames < frames && !m_console->halted()) {
+		if (m_scheduler) {
+			FrameReport frame = m_scheduler->runFrame();
+			stats.instructions += frame.ticks;
+			stats.cycles += frame.cycles;
+			emitFrame(stats);
+			m_scheduler->waitForNextFrame();
+			continue;
+		}
+		step(m_frameTickLimit, stats);
+	}
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+HeadlessStats Headless::runInstructions(uint64_t instructions) {
+	HeadlessStats stats{};
+	auto start = std::chrono::steady_clock::now();
+	while (stats.instructions < instructions && !m_console->halted()) {
+		step(instructions - stats.instructions, stats);
+	}
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+bool runDifferential(Console& reference, Console& candidate, uint64_t instructions, uint64_t slice) {
+	uint64_t done = 0;
+	while (done < instructions && !reference.halted() && !candidate.halted()) {
+		uint64_t n = std::min(slice, instructions - done);
+		uint64_t a = reference.run(n), b = candidate.run(n);
+		if (reference.cycles() != candidate.cycles()) {
+			std::cerr << "MISMATCH: After " << done << " ticks, the reference counted " << reference.cycles()
+					  << " cycles and the candidate " << candidate.cycles() << "." << std::endl;
+			return false;
+		}
+		if (a != b || reference.pc() != candidate.pc()) {
+			std::cerr << "MISMATCH: After " << done << " ticks, the reference ran " << a
+					  << " ticks (PC " << reference.pc() << ") and the candidate " << b
+					  << " ticks (PC " << candidate.pc() << ")." << std::endl;
+			return false;
+		}
+		done += a;
+		if (reference.video().dirty()) reference.video().markAsNotDirty();
+		if (candidate.video().dirty()) candidate.video().markAsNotDirty();
+	}
+
+	if (reference.halted() != candidate.halted()) {
+		std::cerr << "MISMATCH: Only one of the consoles halted after " << done << " ticks." << std::endl;
+		return false;
+	}
+
+	auto&& ra = reference.ram();
+	auto&& rb = candidate.ram();
+	for (uint32_t i = 0; i < ra.Size; i++) {
+		if (ra[i] != rb[i]) {
+			std::cerr << "MISMATCH: RAM differs at 0x" << std::hex << i << std::dec
+					  << " after " << done << " ticks (" << ra[i] << " != " << rb[i] << ")." << std::endl;
+			return false;
+		}
+	}
+
+	const Pixel* va = reference.vram();
+	const Pixel* vb = candidate.vram();
+	for (uint32_t i = 0; i < VideoSize; i++) {
+		if (va[i] != vb[i]) {
+			std::cerr << "MISMATCH: VRAM differs at pixel " << i << " after " << done << " ticks ("
+					  << uint32_t(va[i]) << " != " << uint32_t(vb[i]) << ")." << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,107 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "console.h"
+#include "scheduler.h"
+
+#include <functional>
+#include <fstream>
+#include <string>
+
+/// Throughput the headless backend is expected to sustain on the reference
+/// interpreter (demo cart, null sink, optimized build), in millions of ticks per second.
+constexpr double HeadlessTargetMIPS = 50.0;
+
+/// A frame is forced out after this many ticks, so carts that never draw
+/// still make progress when running for a fixed number of frames.
+constexpr uint64_t HeadlessFrameTickLimit = 1u << 20;
+
+/**
+ * Receives every finished frame, composed over the tile layer. `vram`
+ * holds one palette index per pixel.
+*/
+class FrameSink {
+public:
+	virtual ~FrameSink() = default;
+	virtual void frame(uint64_t index, const Pixel* vram, int width, int height) = 0;
+};
+
+/// Discards every frame.
+class NullSink : public FrameSink {
+public:
+	void frame(uint64_t, const Pixel*, int, int) override {}
+};
+
+using FrameCallback = std::function<void(uint64_t, const Pixel*, int, int)>;
+
+/// Forwards every frame to a user function.
+class CallbackSink : public FrameSink {
+public:
+	CallbackSink(const FrameCallback& callback) : m_callback(callback) {}
+	void frame(uint64_t index, const Pixel* vram, int width, int height) override;
+
+private:
+	FrameCallback m_callback;
+};
+
+/// Appends every frame to a file as width * height bytes (palette indices).
+class RawFileSink : public FrameSink {
+public:
+	RawFileSink(const std::string& fileName);
+	void frame(uint64_t index, const Pixel* vram, int width, int height) override;
+
+	bool good() const { return m_file.good(); }
+
+private:
+	std::ofstream m_file;
+	std::vector<uint8_t> m_row;
+};
+
+struct HeadlessStats {
+	uint64_t frames{ 0 }, instructions{ 0 }, cycles{ 0 };
+	double seconds{ 0.0 };
+
+	double mips() const { return seconds > 0.0 ? (instructions / seconds) / 1e6 : 0.0; }
+	double fps() const { return seconds > 0.0 ? frames / seconds : 0.0; }
+
+	/// Average share of FrameCycleBudget used per frame.
+	double budgetUsage() const { return frames > 0 ? double(cycles) / double(frames * FrameCycleBudget) : 0.0; }
+};
+
+/**
+ * Runs a console with no window, handing every finished frame to a
+ * FrameSink. It runs as fast as possible, unless a Scheduler is set: then
+ * runFrames() runs in real time, one scheduler frame per frame.
+*/
+class Headless {
+public:
+	Headless(Console* console, FrameSink* sink);
+	~Headless() = default;
+
+	/// Runs until `frames` frames were produced or the console halts.
+	HeadlessStats runFrames(uint64_t frames);
+
+	/// Runs until `instructions` ticks were executed or the console halts.
+	HeadlessStats runInstructions(uint64_t instructions);
+
+	void setFrameTickLimit(uint64_t limit) { m_frameTickLimit = limit; }
+	void setScheduler(Scheduler* scheduler) { m_scheduler = scheduler; }
+
+private:
+	bool step(uint64_t maxInstructions, HeadlessStats& stats);
+	void emitFrame(HeadlessStats& stats);
+
+	Console *m_console;
+	FrameSink *m_sink;
+	Scheduler *m_scheduler{ nullptr };
+
+	uint64_t m_frameTickLimit{ HeadlessFrameTickLimit }, m_frameTicks{ 0 }, m_frameIndex{ 0 };
+};
+
+/// Runs two consoles side by side for `instructions` ticks, in slices of
+/// `slice` ticks, and checks that they execute the same number of ticks and
+/// cycles and leave identical RAM. Used to check an execution engine against the
+/// reference interpreter. Mismatches are reported to std::cerr.
+bool runDifferential(Console& reference, Console& candidate, uint64_t instructions, uint64_t slice = 4096);
+
+#endif // HEADLESS_H
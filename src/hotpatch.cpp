@@ -0,0 +1,167 @@
+#include "hotpatch.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+	/// Addresses of the instructions in code[begin, end).
+	void decode(const ByteList& code, uint32_t begin, uint32_t end, std::vector<uint32_t>& insns) {
+		insns.clear();
+		for (uint32_t pos = begin; pos < end; pos += 1 + operandCount(code[pos])) insns.push_back(pos);
+	}
+}
+
+HotPatch::HotPatch(Console* console, bool optimize)
+	: m_console(console), m_optimize(optimize)
+{}
+
+Byte HotPatch::relocate(Byte address, const ByteList& code) {
+	if (address >= m_code.size()) return Byte(code.size());
+
+	// The last block starting at or before the address, there's always the one at 0.
+	auto block = std::upper_bound(m_anchors.begin(), m_anchors.end(), address, [](Byte a, const Anchor& anchor) {
+		return a < anchor.from;
+	}) - 1;
+	auto oldNext = block + 1;
+	auto newNext = std::upper_bound(m_starts.begin(), m_starts.end(), block->to);
+	decode(m_code, block->from, oldNext == m_anchors.end() ? uint32_t(m_code.size()) : oldNext->from, m_oldInsns);
+	decode(code, block->to, newNext == m_starts.end() ? uint32_t(code.size()) : *newNext, m_newInsns);
+
+	const size_t n = m_oldInsns.size(), m = m_newInsns.size();
+	size_t prefix = 0, suffix = 0;
+	while (prefix < std::min(n, m) && m_code[m_oldInsns[prefix]] == code[m_newInsns[prefix]]) prefix++;
+	while (suffix < std::min(n, m) - prefix && m_code[m_oldInsns[n - 1 - suffix]] == code[m_newInsns[m - 1 - suffix]]) suffix++;
+
+	size_t k = std::lower_bound(m_oldInsns.begin(), m_oldInsns.end(), address) - m_oldInsns.begin();
+	if (k >= prefix) k = k >= n - suffix ? k - n + m : prefix;
+	if (k < m) return Byte(m_newInsns[k]);
+	return Byte(newNext == m_starts.end() ? code.size() : *newNext);
+}
+
+bool HotPatch::patch(const std::string& source) {
+	const auto start = std::chrono::steady_clock::now();
+	Console& c = *m_console;
+
+	// The assembler places the lets straight into the console, this undoes it if it fails.
+	Allocator heap = c.heap();
+	std::vector<Byte> data(c.data(), c.data() + DataSize);
+
+	ASM assembler(source, m_console);
+	assembler.setOptimize(m_optimize);
+	assembler.keepLets(m_lets);
+	ByteList code = assembler.compile();
+	if (code.size() > ProgramSize) {
+		std::cerr << "ERROR: The program takes " << code.size() << " words, the console has " << ProgramSize << "." << std::endl;
+	}
+	if (assembler.errors() > 0 || code.size() > ProgramSize) {
+		c.heap() = heap;
+		std::copy(data.begin(), data.end(), c.data());
+		return false;
+	}
+
+	HotPatchStats stats;
+	const std::map<std::string, uint32_t>& labels = assembler.labels();
+	m_anchors.assign(1, Anchor{ 0, 0 });
+	m_starts.clear();
+	for (auto&& label : m_labels) {
+		auto it = labels.find(label.first);
+		if (it == labels.end()) continue;
+		m_anchors.push_back({ label.second, it->second });
+		m_starts.push_back(it->second);
+		if (label.second != it->second) stats.movedLabels++;
+	}
+	std::stable_sort(m_anchors.begin(), m_anchors.end(), [](const Anchor& a, const Anchor& b) { return a.from < b.from; });
+	std::sort(m_starts.begin(), m_starts.end());
+
+	// Nothing ran from the code yet the first time.
+	if (!m_code.empty()) {
+		auto move = [&](Byte& address) {
+			Byte to = relocate(address, code);
+			if (to != address) stats.relocated++;
+			address = to;
+		};
+		move(c.m_pc);
+
+		// Calls push the address of their operand, returns go to the word after it.
+		for (uint32_t i = 0; i < c.m_callStack.size(); i++) {
+			Byte& entry = c.m_callStack.data()[i];
+			Byte next = entry + 1;
+			move(next);
+			entry = next - 1;
+		}
+	}
+
+	// Only the words that changed are written, the old ones past the new end are cleared.
+	const uint32_t size = uint32_t(code.size()), end = std::max<uint32_t>(size, uint32_t(m_code.size()));
+	code.resize(end, 0);
+	const Byte* prog = c.prog();
+	for (uint32_t i = 0; i < end;) {
+		if (prog[i] == code[i]) {
+			i++;
+			continue;
+		}
+		uint32_t begin = i;
+		while (i < end && prog[i] != code[i]) i++;
+		c.writeProgram(uint16_t(begin), code.data() + begin, i - begin);
+		stats.words += i - begin;
+	}
+	code.resize(size);
+
+	m_code = std::move(code);
+	m_labels = labels;
+	m_lets = assembler.lets();
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	m_stats = stats;
+	return true;
+}
+
+bool readSourceFile(const std::string& path, std::string& source) {
+	std::ifstream fs(path, std::ios::binary);
+	if (!fs.good()) return false;
+	source.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+	return true;
+}
+
+SourceWatcher::SourceWatcher(const std::string& path)
+	: m_path(path)
+{
+	readSourceFile(m_path, m_source);
+	m_thread = std::thread(&SourceWatcher::watch, this);
+}
+
+SourceWatcher::~SourceWatcher() {
+	m_stop = true;
+	m_thread.join();
+}
+
+void SourceWatcher::watch() {
+	std::error_code error;
+	auto last = std::filesystem::last_write_time(m_path, error);
+	std::string source;
+	while (!m_stop) {
+		std::this_thread::sleep_for(WatchPollInterval);
+
+		// Editors that save through a new file leave it missing for a moment.
+		auto time = std::filesystem::last_write_time(m_path, error);
+		if (error || time == last || !readSourceFile(m_path, source)) continue;
+		last = time;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (source == m_source) continue;
+		m_source.swap(source);
+		m_changed = true;
+		m_seen = Clock::now();
+	}
+}
+
+bool SourceWatcher::poll(std::string& source, Clock::time_point& seen) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_changed) return false;
+	source = m_source;
+	seen = m_seen;
+	m_changed = false;
+	return true;
+}
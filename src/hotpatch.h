@@ -0,0 +1,116 @@
+#ifndef HOTPATCH_H
+#define HOTPATCH_H
+
+#include "console.h"
+#include "asm.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// How often SourceWatcher looks at its file.
+constexpr std::chrono::milliseconds WatchPollInterval{ 2 };
+
+struct HotPatchStats {
+	uint32_t words{ 0 };			// Program words written
+	uint32_t movedLabels{ 0 };		// Labels now at another address
+	uint32_t relocated{ 0 };		// PC and return addresses that moved with the code
+	double milliseconds{ 0.0 };		// Assembling and patching
+};
+
+/**
+ * Patches new versions of a cart source into a running console.
+ *
+ * The whole source is assembled again (which takes well under a
+ * millisecond for anything that fits in program memory) into the console,
+ * keeping the data of the `let`s it still has (see ASM::keepLets()), and
+ * only the program words that changed are written, so the execution
+ * engines only drop what they decoded from those.
+ *
+ * The code between two labels both versions have is a block. Blocks move
+ * around as the ones before them grow or shrink, and the PC and the
+ * return addresses on the call stack move with them. Within a block, the
+ * instructions before and after the part that was edited are matched up
+ * by opcode from either end, and an address in the edited part goes to
+ * the start of its new version. A label that was added, renamed or removed
+ * makes one block out of the two around it.
+*/
+class HotPatch {
+public:
+	HotPatch(Console* console, bool optimize = true);
+	~HotPatch() = default;
+
+	/**
+	 * Assembles `source` into the console. The first time it's a plain
+	 * load into a fresh console. Call it between run() calls, on the thread
+	 * running the console. On errors (reported on std::cerr) the console is
+	 * left as it was and it returns false.
+	*/
+	bool patch(const std::string& source);
+
+	/// Of the last successful patch().
+	const HotPatchStats& stats() const { return m_stats; }
+
+private:
+	/// A block: a label both versions have, where it was and where it is.
+	struct Anchor {
+		uint32_t from, to;
+	};
+
+	/// Where the code at `address` in m_code is in `code`, see the class comment.
+	Byte relocate(Byte address, const ByteList& code);
+
+	Console *m_console;
+	bool m_optimize;
+
+	// What's in the console: the code, its labels and its lets.
+	ByteList m_code;
+	std::map<std::string, uint32_t> m_labels;
+	std::map<std::string, LetBlock> m_lets;
+
+	std::vector<Anchor> m_anchors;	// By old address
+	std::vector<uint32_t> m_starts;	// New addresses of the anchors, sorted
+	std::vector<uint32_t> m_oldInsns, m_newInsns;
+	HotPatchStats m_stats;
+};
+
+/// Reads a whole file. False if it can't be opened.
+bool readSourceFile(const std::string& path, std::string& source);
+
+/**
+ * Watches a file from a thread of its own, looking at its modification
+ * time every WatchPollInterval, and hands its contents over when they
+ * change.
+*/
+class SourceWatcher {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	SourceWatcher(const std::string& path);
+	~SourceWatcher();
+
+	SourceWatcher(const SourceWatcher&) = delete;
+	SourceWatcher& operator =(const SourceWatcher&) = delete;
+
+	/// The new contents of the file if they changed since the last call, and when the change was seen.
+	bool poll(std::string& source, Clock::time_point& seen);
+
+private:
+	void watch();
+
+	std::string m_path;
+	std::atomic<bool> m_stop{ false };
+
+	std::mutex m_mutex;
+	std::string m_source;
+	bool m_changed{ false };
+	Clock::time_point m_seen;
+
+	std::thread m_thread;
+};
+
+#endif // HOTPATCH_H
@@ -0,0 +1,695 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#ifdef CONSOLE_JIT_X64
+#include <sys/mman.h>
+#endif
+
+constexpr size_t JitCodeSize = 1024 * 1024;
+constexpr uint32_t JitMaxBlockLength = 64;
+constexpr uint32_t JitMaxVirtualStack = 16;
+
+static_assert(ShiftMask == 31, "Shifts by CL use the low 5 bits of their count");
+
+// Machine state shared between run() and the compiled code.
+struct JitEngine::State {
+	Byte* data;
+	void* sp;
+	Byte* csp;
+	void* stackEnd;
+	Byte* callEnd;
+	uint64_t left;
+	uint64_t cycles;
+	uint32_t cmp;
+	uint32_t pc;
+	uint32_t exit;
+	uint8_t* patch;
+};
+
+enum JitExit {
+	JitExitContinue = 0,	// Continue at State::pc (compile it if needed)
+	JitExitBail				// Block guards failed, interpret one instruction at State::pc
+};
+
+#ifdef CONSOLE_JIT_X64
+
+namespace {
+
+enum Reg {
+	RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Condition codes
+enum Cond {
+	CondB = 0x2, CondAE = 0x3, CondE = 0x4, CondNE = 0x5, CondBE = 0x6, CondA = 0x7
+};
+
+// Register assignment of the compiled code:
+//   RBX = data(), R12 = operand stack pointer, R13 = call stack pointer,
+//   R14 = instructions left, R15 = State*, EBP = compare result,
+//   EAX = cached top of stack, ECX/EDX/ESI/EDI = scratch.
+
+class Emitter {
+public:
+	Emitter(uint8_t* pos, uint8_t* end) : m_pos(pos), m_end(end) {}
+
+	uint8_t* pos() const { return m_pos; }
+	bool overflow() const { return m_overflow; }
+
+	void byte(uint8_t b) {
+		if (m_pos < m_end) *m_pos++ = b;
+		else m_overflow = true;
+	}
+
+	void dword(uint32_t v) { for (int i = 0; i < 4; i++) byte(uint8_t(v >> (i * 8))); }
+	void qword(uint64_t v) { for (int i = 0; i < 8; i++) byte(uint8_t(v >> (i * 8))); }
+
+	void rex(bool w, int reg, int index, int base, bool force = false) {
+		uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+		if (r != 0x40 || force) byte(r);
+	}
+
+	// [base + disp32]
+	void mem(int reg, int base, int32_t disp) {
+		byte(0x80 | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == RSP) byte(0x24);
+		dword(uint32_t(disp));
+	}
+
+	void movImm(int r, uint32_t imm) { rex(false, 0, 0, r); byte(0xB8 + (r & 7)); dword(imm); }
+	void movImm64(int r, uint64_t imm) { rex(true, 0, 0, r); byte(0xB8 + (r & 7)); qword(imm); }
+	void mov(int dst, int src) { rex(false, src, 0, dst); byte(0x89); byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+
+	void load(int r, int base, int32_t disp) { rex(false, r, 0, base); byte(0x8B); mem(r, base, disp); }
+	void load64(int r, int base, int32_t disp) { rex(true, r, 0, base); byte(0x8B); mem(r, base, disp); }
+	void store(int base, int32_t disp, int r) { rex(false, r, 0, base); byte(0x89); mem(r, base, disp); }
+	void store64(int base, int32_t disp, int r) { rex(true, r, 0, base); byte(0x89); mem(r, base, disp); }
+	void storeImm(int base, int32_t disp, uint32_t imm) { rex(false, 0, 0, base); byte(0xC7); mem(0, base, disp); dword(imm); }
+	void lea64(int r, int base, int32_t disp) { rex(true, r, 0, base); byte(0x8D); mem(r, base, disp); }
+
+	// mov r, [RBX + index * 4]
+	void loadData(int r, int index) {
+		rex(false, r, index, RBX);
+		byte(0x8B);
+		byte(((r & 7) << 3) | RSP);
+		byte(0x80 | ((index & 7) << 3) | RBX);
+	}
+
+	// op dst, src (32 bit). `op` is the "r/m32, r32" opcode.
+	void alu(uint8_t op, int dst, int src) { rex(false, src, 0, dst); byte(op); byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+	void aluImm(int digit, int r, uint32_t imm) { rex(false, 0, 0, r); byte(0x81); byte(0xC0 | (digit << 3) | (r & 7)); dword(imm); }
+	void aluImm64(int digit, int r, uint32_t imm) { rex(true, 0, 0, r); byte(0x81); byte(0xC0 | (digit << 3) | (r & 7)); dword(imm); }
+	void aluMemImm(int digit, int base, int32_t disp, uint32_t imm) { rex(false, 0, 0, base); byte(0x81); mem(digit, base, disp); dword(imm); }
+	void aluMemImm64(int digit, int base, int32_t disp, uint32_t imm) { rex(true, 0, 0, base); byte(0x81); mem(digit, base, disp); dword(imm); }
+	void cmp64Mem(int r, int base, int32_t disp) { rex(true, r, 0, base); byte(0x3B); mem(r, base, disp); }
+
+	void imul(int dst, int src) { rex(false, dst, 0, src); byte(0x0F); byte(0xAF); byte(0xC0 | ((dst & 7) << 3) | (src & 7)); }
+	void unary(int digit, int r) { rex(false, 0, 0, r); byte(0xF7); byte(0xC0 | (digit << 3) | (r & 7)); }
+	void shiftCL(int digit, int r) { rex(false, 0, 0, r); byte(0xD3); byte(0xC0 | (digit << 3) | (r & 7)); }
+	void cmov(Cond cc, int dst, int src) { rex(false, dst, 0, src); byte(0x0F); byte(0x40 + cc); byte(0xC0 | ((dst & 7) << 3) | (src & 7)); }
+
+	void push(int r) { rex(false, 0, 0, r); byte(0x50 + (r & 7)); }
+	void pop(int r) { rex(false, 0, 0, r); byte(0x58 + (r & 7)); }
+	void ret() { byte(0xC3); }
+
+	// jmp [table + index * 8]
+	void jmpTable(int table, int index) {
+		rex(false, 0, index, table);
+		byte(0xFF);
+		byte(0x20 | RSP);
+		byte(0xC0 | ((index & 7) << 3) | (table & 7));
+	}
+	void jmpReg(int r) { rex(false, 0, 0, r); byte(0xFF); byte(0xE0 | (r & 7)); }
+
+	/// Emits a jump and returns the address of its rel32 field.
+	uint8_t* jmp(const uint8_t* target = nullptr) { byte(0xE9); return rel32(target); }
+	uint8_t* jcc(Cond cc, const uint8_t* target = nullptr) { byte(0x0F); byte(0x80 + cc); return rel32(target); }
+
+	// 8 bit conditional jump, bound with bind8()
+	uint8_t* jcc8(Cond cc) { byte(0x70 + cc); uint8_t* at = m_pos; byte(0); return at; }
+	void bind8(uint8_t* at) { if (!m_overflow) *at = uint8_t(m_pos - (at + 1)); }
+
+	void bind(uint8_t* at, const uint8_t* target) {
+		if (at == nullptr || m_overflow) return;
+		int32_t rel = int32_t(target - (at + 4));
+		std::memcpy(at, &rel, 4);
+	}
+
+private:
+	uint8_t* rel32(const uint8_t* target) {
+		uint8_t* at = m_pos;
+		dword(0);
+		if (target) bind(at, target);
+		return at;
+	}
+
+	uint8_t *m_pos, *m_end;
+	bool m_overflow{ false };
+};
+
+constexpr int Alu_Add = 0x01, Alu_Or = 0x09, Alu_And = 0x21, Alu_Sub = 0x29, Alu_Xor = 0x31, Alu_Cmp = 0x39;
+constexpr int Digit_Add = 0, Digit_Sub = 5, Digit_Cmp = 7;
+
+// Operand words read by each opcode the JIT knows how to compile, or -1.
+int compilableOperands(Byte op) {
+	switch (op) {
+		case OpAdd: case OpSub: case OpMul: case OpDiv: case OpLsh: case OpRsh:
+		case OpAnd: case OpOr: case OpXor: case OpNot:
+		case OpRet: case OpNoop:
+			return 0;
+		case OpPush: case OpPushM: case OpPop: case OpInc: case OpDec:
+		case OpJmp: case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle:
+		case OpCall:
+			return 1;
+		case OpCmp: case OpCmpM:
+		case OpAddMI: case OpSubMI: case OpMulMI: case OpDivMI: case OpLshMI:
+		case OpRshMI: case OpAndMI: case OpOrMI: case OpXorMI:
+			return 2;
+		case OpCmpJ: case OpCmpMJ:
+			return 4;
+		default: return -1;
+	}
+}
+
+bool isTerminator(Byte op) {
+	return (op >= OpJmp && op <= OpJle) || op == OpCall || op == OpRet || op == OpCmpJ || op == OpCmpMJ;
+}
+
+// `next` is the address of the following instruction. Fused instructions
+// are split back into the plain ones they stand for, all with the same pc.
+struct Insn {
+	uint32_t pc, next;
+	Byte op, a, b;
+};
+
+}
+
+#define STATE(field) int32_t(offsetof(JitEngine::State, field))
+
+JitEngine::JitEngine(Console* console)
+	: m_console(console),
+	  m_blocks(ProgramSize, nullptr),
+	  m_table(ProgramSize, nullptr),
+	  m_uncompilable(ProgramSize, false)
+{
+	void* mem = mmap(nullptr, JitCodeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return;
+
+	m_code = static_cast<uint8_t*>(mem);
+	m_codeEnd = m_code + JitCodeSize;
+	m_writable = true;
+	emitRuntime();
+	flush();
+
+	// Hosts that refuse executable pages can't run the JIT.
+	if (!protect(false)) {
+		munmap(m_code, JitCodeSize);
+		m_code = m_codePos = m_codeEnd = m_blocksStart = nullptr;
+	}
+}
+
+JitEngine::~JitEngine() {
+	if (m_code) munmap(m_code, JitCodeSize);
+}
+
+void JitEngine::emitRuntime() {
+	Emitter e(m_code, m_codeEnd);
+
+	// void enter(State* state, const uint8_t* block)
+	m_enter = e.pos();
+	e.push(RBP); e.push(RBX); e.push(R12); e.push(R13); e.push(R14); e.push(R15);
+	e.rex(true, RDI, 0, R15); e.byte(0x89); e.byte(0xC0 | (RDI << 3) | (R15 & 7)); // mov r15, rdi
+	e.load64(RBX, R15, STATE(data));
+	e.load64(R12, R15, STATE(sp));
+	e.load64(R13, R15, STATE(csp));
+	e.load64(R14, R15, STATE(left));
+	e.load(RBP, R15, STATE(cmp));
+	e.jmpReg(RSI);
+
+	// Exit code in EAX, State::pc already stored.
+	m_exit = e.pos();
+	e.store(R15, STATE(exit), RAX);
+	e.store64(R15, STATE(sp), R12);
+	e.store64(R15, STATE(csp), R13);
+	e.store64(R15, STATE(left), R14);
+	e.store(R15, STATE(cmp), RBP);
+	e.pop(R15); e.pop(R14); e.pop(R13); e.pop(R12); e.pop(RBX); e.pop(RBP);
+	e.ret();
+
+	// Return to an address with no compiled block, target in EAX.
+	m_dynamicExit = e.pos();
+	e.store(R15, STATE(pc), RAX);
+	e.movImm(RAX, JitExitContinue);
+	e.jmp(m_exit);
+
+	m_blocksStart = e.pos();
+}
+
+bool JitEngine::protect(bool writable) {
+	if (m_writable == writable) return true;
+	if (mprotect(m_code, JitCodeSize, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0) return false;
+	m_writable = writable;
+	return true;
+}
+
+void JitEngine::flush() {
+	m_generation++;
+	m_codePos = m_blocksStart;
+	std::fill(m_blocks.begin(), m_blocks.end(), nullptr);
+	std::fill(m_table.begin(), m_table.end(), m_dynamicExit);
+	std::fill(m_uncompilable.begin(), m_uncompilable.end(), false);
+	m_flushPending = false;
+}
+
+void JitEngine::invalidate(uint32_t, uint32_t) {
+	m_flushPending = true;
+}
+
+const uint8_t* JitEngine::block(uint32_t pc) {
+	if (pc >= ProgramSize || m_uncompilable[pc]) return nullptr;
+	if (m_blocks[pc]) return m_blocks[pc];
+
+	const uint8_t* code = compile(pc);
+	if (code == nullptr && !m_uncompilable[pc]) {
+		// Out of code space, start over.
+		flush();
+		code = compile(pc);
+	}
+	return code;
+}
+
+const uint8_t* JitEngine::compile(uint32_t startPc) {
+	using Value = Console::Value;
+	static_assert(sizeof(Value) == 8 && offsetof(Value, type) == 4, "Unexpected Value layout");
+
+	Byte* prog = m_console->prog();
+
+	// Gather the block
+	std::vector<Insn> insns;
+	uint32_t pc = startPc, count = 0, cycles = 0;
+	int32_t depth = 0, maxDepth = 0;
+	while (count < JitMaxBlockLength && pc < ProgramSize) {
+		Byte op = prog[pc];
+		int operands = compilableOperands(op);
+		if (operands < 0 || pc + 1 + operands > ProgramSize) break;
+
+		uint32_t next = pc + 1 + operands;
+		Byte a = operands > 0 ? prog[pc + 1] : 0;
+		Byte b = operands > 1 ? prog[pc + 2] : 0;
+		Byte jump = operands > 2 ? prog[pc + 3] : 0;
+		Byte target = operands > 3 ? prog[pc + 4] : 0;
+		if (namesCycleCounter(op, a, b)) break;
+
+		bool dataOperand = op == OpPop || op == OpInc || op == OpDec || op == OpCmp || op == OpCmpM ||
+						   op == OpCmpJ || op == OpCmpMJ || (op >= OpAddMI && op <= OpXorMI);
+		if (dataOperand && a >= DataAddressable) break;
+		if ((op == OpCmpM || op == OpCmpMJ) && b >= DataAddressable) break;
+		if ((op >= OpJmp && op <= OpJle) || op == OpCall) {
+			if (a >= ProgramSize) break;
+		}
+		if (op == OpCmpJ || op == OpCmpMJ) {
+			if (jump < OpJeq || jump > OpJle || target >= ProgramSize) break;
+		}
+
+		// At most 4 instructions per opcode, kept on the stack.
+		std::array<Insn, 4> lowered;
+		uint32_t parts = 0;
+		if (op >= OpAddMI && op <= OpXorMI) {
+			// push b / pushm a / op / pop a
+			Byte alu = Byte(OpAdd + (op - OpAddMI));
+			lowered[parts++] = { pc, next, OpPush, b, 0 };
+			lowered[parts++] = { pc, next, OpPushM, a, 0 };
+			lowered[parts++] = { pc, next, alu, 0, 0 };
+			lowered[parts++] = { pc, next, OpPop, a, 0 };
+		} else if (op == OpCmpJ || op == OpCmpMJ) {
+			lowered[parts++] = { pc, next, Byte(op == OpCmpJ ? OpCmp : OpCmpM), a, b };
+			lowered[parts++] = { pc, next, jump, target, 0 };
+		} else {
+			lowered[parts++] = { pc, next, op, a, b };
+		}
+
+		for (uint32_t i = 0; i < parts; i++) {
+			const Insn& in = lowered[i];
+			switch (in.op) {
+				case OpPush: case OpPushM: depth++; break;
+				case OpPop: case OpAdd: case OpSub: case OpMul: case OpDiv:
+				case OpLsh: case OpRsh: case OpAnd: case OpOr: case OpXor:
+					depth--; break;
+				default: break;
+			}
+			maxDepth = std::max(maxDepth, depth);
+			insns.push_back(in);
+		}
+
+		count++;
+		cycles += cycleCost(op);
+		pc = next;
+		if (isTerminator(op)) break;
+	}
+
+	if (insns.empty()) {
+		m_uncompilable[startPc] = true;
+		return nullptr;
+	}
+	if (!protect(true)) return nullptr;
+
+	Emitter e(m_codePos, m_codeEnd);
+	uint8_t* entry = e.pos();
+
+	// Guards: enough budget for the whole block and enough stack room to
+	// push without dropping values (a full stack is left to the interpreter).
+	std::vector<uint8_t*> bails;
+	e.aluImm64(Digit_Cmp, R14, count);
+	bails.push_back(e.jcc(CondB));
+	if (maxDepth > 0) {
+		e.lea64(RAX, R12, maxDepth * int32_t(sizeof(Value)));
+		e.cmp64Mem(RAX, R15, STATE(stackEnd));
+		bails.push_back(e.jcc(CondA));
+	}
+	e.aluImm64(Digit_Sub, R14, count);
+	e.aluMemImm64(Digit_Add, R15, STATE(cycles), cycles);
+
+	// Compile time view of the top of the operand stack
+	enum Kind { KindConst, KindAddr, KindAcc, KindMem };
+	struct Item { Kind kind; Byte value; };
+	std::vector<Item> stack;
+	bool flagsValid = false;
+
+	auto pop = [&]() -> Item {
+		if (stack.empty()) return { KindMem, 0 };
+		Item it = stack.back();
+		stack.pop_back();
+		return it;
+	};
+
+	auto hasAcc = [&]() {
+		return std::any_of(stack.begin(), stack.end(), [](const Item& it) { return it.kind == KindAcc; });
+	};
+
+	// Writes the compile time stack to the real one. Uses no flags.
+	auto spill = [&]() {
+		if (stack.empty()) return;
+		for (size_t i = 0; i < stack.size(); i++) {
+			int32_t off = int32_t(i * sizeof(Value));
+			const Item& it = stack[i];
+			if (it.kind == KindAcc) e.store(R12, off, RAX);
+			else e.storeImm(R12, off, it.value);
+			e.storeImm(R12, off + 4, it.kind == KindAddr ? Value::MemoryAddr : Value::Literal);
+		}
+		e.lea64(R12, R12, int32_t(stack.size() * sizeof(Value)));
+		stack.clear();
+	};
+
+	// Materializes the value of an item in `r`, the same way `unpack` does.
+	auto load = [&](const Item& it, int r) {
+		switch (it.kind) {
+			case KindConst: e.movImm(r, it.value); break;
+			case KindAddr: e.load(r, RBX, int32_t(it.value * sizeof(Byte))); break;
+			case KindAcc: if (r != RAX) e.mov(r, RAX); break;
+			case KindMem: {
+				e.load(r, R12, -int32_t(sizeof(Value)));
+				e.aluMemImm(Digit_Cmp, R12, -4, Value::Literal);
+				uint8_t* literal = e.jcc8(CondE);
+				e.loadData(r, r);
+				e.bind8(literal);
+				e.lea64(R12, R12, -int32_t(sizeof(Value)));
+				flagsValid = false;
+			} break;
+		}
+	};
+
+	// Leaves the block for `target`: a direct jump if it's compiled already,
+	// otherwise an exit that run() patches once the target is compiled.
+	auto exitTo = [&](uint32_t target) {
+		if (target < ProgramSize && m_blocks[target]) {
+			e.jmp(m_blocks[target]);
+			return;
+		}
+		uint8_t* site = e.pos();
+		e.jmp(e.pos() + 5);
+		e.storeImm(R15, STATE(pc), target);
+		if (target < ProgramSize) {
+			e.movImm64(RAX, reinterpret_cast<uint64_t>(site));
+			e.store64(R15, STATE(patch), RAX);
+		}
+		e.movImm(RAX, JitExitContinue);
+		e.jmp(m_exit);
+	};
+
+	auto fold = [](Byte op, Byte a, Byte b, Byte& res) {
+		switch (op) {
+			case OpAdd: res = a + b; return true;
+			case OpSub: res = a - b; return true;
+			case OpMul: res = a * b; return true;
+			case OpAnd: res = a & b; return true;
+			case OpOr: res = a | b; return true;
+			case OpXor: res = a ^ b; return true;
+			default: return false;
+		}
+	};
+
+	bool terminated = false;
+	for (const Insn& in : insns) {
+		if (stack.size() >= JitMaxVirtualStack) spill();
+
+		switch (in.op) {
+			case OpNoop: break;
+			case OpPush: stack.push_back({ KindConst, in.a }); break;
+			case OpPushM: stack.push_back({ KindAddr, in.a }); break;
+			case OpPop: {
+				Item v = pop();
+				load(v, RCX);
+				e.store(RBX, int32_t(in.a * sizeof(Byte)), RCX);
+			} break;
+			case OpInc:
+			case OpDec:
+				e.aluMemImm(in.op == OpInc ? Digit_Add : Digit_Sub, RBX, int32_t(in.a * sizeof(Byte)), 1);
+				flagsValid = false;
+				break;
+			case OpAdd: case OpSub: case OpMul: case OpDiv:
+			case OpLsh: case OpRsh: case OpAnd: case OpOr: case OpXor: {
+				Item a = pop(), b = pop();
+				Byte res;
+				if (a.kind == KindConst && b.kind == KindConst && fold(in.op, a.value, b.value, res)) {
+					stack.push_back({ KindConst, res });
+					break;
+				}
+				if (hasAcc()) spill();
+				load(a, RCX);
+				load(b, RDX);
+				e.mov(RAX, RCX);
+				switch (in.op) {
+					case OpAdd: e.alu(Alu_Add, RAX, RDX); break;
+					case OpSub: e.alu(Alu_Sub, RAX, RDX); break;
+					case OpAnd: e.alu(Alu_And, RAX, RDX); break;
+					case OpOr: e.alu(Alu_Or, RAX, RDX); break;
+					case OpXor: e.alu(Alu_Xor, RAX, RDX); break;
+					case OpMul: e.imul(RAX, RDX); break;
+					// 32-bit shifts by CL only use its low 5 bits, that's ShiftMask.
+					case OpLsh: e.mov(RCX, RDX); e.shiftCL(4, RAX); break;
+					case OpRsh: e.mov(RCX, RDX); e.shiftCL(5, RAX); break;
+					case OpDiv:
+						// quotient(): a zero divisor gives 0, dividing 0 by 1 instead.
+						e.mov(RCX, RDX);
+						e.alu(Alu_Xor, RDX, RDX);
+						e.movImm(RSI, 1);
+						e.alu(Alu_Or, RCX, RCX);
+						e.cmov(CondE, RAX, RDX);
+						e.cmov(CondE, RCX, RSI);
+						e.unary(6, RCX);
+						break;
+					default: break;
+				}
+				stack.push_back({ KindAcc, 0 });
+				flagsValid = false;
+			} break;
+			case OpNot: {
+				Item a = pop();
+				if (a.kind == KindConst) {
+					stack.push_back({ KindConst, ~a.value });
+					break;
+				}
+				if (hasAcc()) spill();
+				load(a, RCX);
+				e.mov(RAX, RCX);
+				e.unary(2, RAX);
+				stack.push_back({ KindAcc, 0 });
+			} break;
+			case OpCmp:
+			case OpCmpM: {
+				e.load(RCX, RBX, int32_t(in.a * sizeof(Byte)));
+				if (in.op == OpCmpM) e.load(RDX, RBX, int32_t(in.b * sizeof(Byte)));
+				e.movImm(RSI, Console::CmpGreater);
+				e.movImm(RDI, Console::CmpLess);
+				e.alu(Alu_Xor, RBP, RBP);
+				if (in.op == OpCmpM) e.alu(Alu_Cmp, RCX, RDX);
+				else e.aluImm(Digit_Cmp, RCX, in.b);
+				e.cmov(CondA, RBP, RSI);
+				e.cmov(CondB, RBP, RDI);
+				flagsValid = true;
+			} break;
+			case OpJmp:
+				spill();
+				exitTo(in.a);
+				terminated = true;
+				break;
+			case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle: {
+				spill();
+				Cond cc;
+				if (flagsValid) {
+					const Cond flags[] = { CondE, CondNE, CondA, CondB, CondAE, CondBE };
+					cc = flags[in.op - OpJeq];
+				} else {
+					// Test the compare result in EBP
+					const Byte against[] = { Console::CmpEquals, Console::CmpEquals, Console::CmpGreater, Console::CmpLess, Console::CmpLess, Console::CmpGreater };
+					const Cond when[] = { CondE, CondNE, CondE, CondE, CondNE, CondNE };
+					e.aluImm(Digit_Cmp, RBP, against[in.op - OpJeq]);
+					cc = when[in.op - OpJeq];
+				}
+				uint8_t* taken = e.jcc(cc, in.a < ProgramSize ? m_blocks[in.a] : nullptr);
+				exitTo(in.next);
+				if (!m_blocks[in.a]) {
+					e.bind(taken, e.pos());
+					exitTo(in.a);
+				}
+				terminated = true;
+			} break;
+			case OpCall: {
+				spill();
+				e.load64(RCX, R15, STATE(callEnd));
+				e.rex(true, R13, 0, RCX); e.byte(0x39); e.byte(0xC0 | ((R13 & 7) << 3) | RCX); // cmp rcx, r13
+				uint8_t* full = e.jcc8(CondE);
+				e.storeImm(R13, 0, in.pc + 1);
+				e.lea64(R13, R13, int32_t(sizeof(Byte)));
+				e.bind8(full);
+				exitTo(in.a);
+				terminated = true;
+			} break;
+			case OpRet: {
+				spill();
+				e.lea64(R13, R13, -int32_t(sizeof(Byte)));
+				e.load(RAX, R13, 0);
+				e.aluImm(Digit_Add, RAX, 1);
+				e.aluImm(Digit_Cmp, RAX, ProgramSize);
+				e.jcc(CondAE, m_dynamicExit);
+				e.movImm64(RCX, reinterpret_cast<uint64_t>(m_table.data()));
+				e.jmpTable(RCX, RAX);
+				terminated = true;
+			} break;
+			default: break;
+		}
+	}
+
+	if (!terminated) {
+		spill();
+		exitTo(insns.back().next);
+	}
+
+	uint8_t* bail = e.pos();
+	for (uint8_t* at : bails) e.bind(at, bail);
+	e.storeImm(R15, STATE(pc), startPc);
+	e.movImm(RAX, JitExitBail);
+	e.jmp(m_exit);
+
+	if (e.overflow()) return nullptr;
+
+	m_codePos = e.pos();
+	m_blocks[startPc] = entry;
+	m_table[startPc] = entry;
+	return entry;
+}
+
+uint64_t JitEngine::run(uint64_t maxInstructions) {
+	using Value = Console::Value;
+
+	Console& c = *m_console;
+	if (m_flushPending) flush();
+
+	using Enter = void (*)(State*, const uint8_t*);
+	Enter enter = reinterpret_cast<Enter>(const_cast<uint8_t*>(m_enter));
+
+	State state{};
+	state.data = c.data();
+	state.stackEnd = c.m_stack.data() + StackSize;
+	state.callEnd = c.m_callStack.data() + CallStackSize;
+
+	uint64_t count = 0;
+	while (count < maxInstructions && !c.m_halted && !c.m_video.dirty()) {
+		if (c.m_waitTimer > 0) {
+			Byte n = Byte(std::min<uint64_t>(c.m_waitTimer, maxInstructions - count));
+			c.m_waitTimer -= n;
+			c.m_ticks += n;
+			c.m_cycles += n;
+			count += n;
+			continue;
+		}
+
+		const uint8_t* code = m_interpretNext ? nullptr : block(c.m_pc);
+		m_interpretNext = false;
+		if (code == nullptr || !protect(false)) {
+			c.tick();
+			count++;
+			continue;
+		}
+
+		state.sp = c.m_stack.data() + c.m_stack.size();
+		state.csp = c.m_callStack.data() + c.m_callStack.size();
+		state.left = maxInstructions - count;
+		state.cycles = 0;
+		state.cmp = c.m_cmpResult;
+		state.patch = nullptr;
+
+		enter(&state, code);
+
+		uint64_t executed = (maxInstructions - count) - state.left;
+		count += executed;
+		c.m_ticks += executed;
+		c.m_cycles += state.cycles;
+		c.m_pc = state.pc;
+		c.m_cmpResult = Console::CmpResult(state.cmp);
+		c.m_stack.resize(uint32_t(static_cast<Value*>(state.sp) - c.m_stack.data()));
+		c.m_callStack.resize(uint32_t(state.csp - c.m_callStack.data()));
+
+		if (state.exit == JitExitBail) {
+			m_interpretNext = true;
+		} else if (state.patch) {
+			// Chain the block we came from directly to its target (unless
+			// compiling the target flushed the block we came from).
+			uint32_t generation = m_generation;
+			const uint8_t* target = block(state.pc);
+			if (target && generation == m_generation && protect(true)) {
+				Emitter(state.patch, state.patch + 5).jmp(target);
+			}
+		}
+	}
+	return count;
+}
+
+#undef STATE
+
+#else
+
+JitEngine::JitEngine(Console* console)
+	: m_console(console)
+{}
+
+JitEngine::~JitEngine() = default;
+
+void JitEngine::invalidate(uint32_t, uint32_t) {}
+
+uint64_t JitEngine::run(uint64_t) {
+	return 0;
+}
+
+const uint8_t* JitEngine::block(uint32_t) { return nullptr; }
+const uint8_t* JitEngine::compile(uint32_t) { return nullptr; }
+void JitEngine::emitRuntime() {}
+void JitEngine::flush() {}
+bool JitEngine::protect(bool) { return false; }
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "console.h"
+
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define CONSOLE_JIT_X64 1
+#endif
+
+/**
+ * x86-64 JIT compiler.
+ *
+ * Basic blocks of bytecode are compiled to native code on first use.
+ * Within a block the operand stack is tracked at compile time, so idioms
+ * like `pushm &x / push 1 / xor / pop &x` become a couple of register
+ * moves; only what's left on the stack at the end of the block is written
+ * back. The compare result lives in EBP and, between a `cmp` and the jump
+ * right after it, in the host flags.
+ *
+ * Blocks end at jumps, calls and returns. Jumps to blocks that were not
+ * compiled yet exit to run(), which compiles the target and patches the
+ * exit into a direct jump, so hot loops never leave native code. Returns
+ * go through a per-address entry table.
+ *
+ * Everything else (halt, wait, drawing, system calls, operands out of
+ * range) is executed by Console::execute(). Program memory can only be
+ * changed by the host (the VM has no way to write it), and
+ * Console::invalidateProgram() throws away all the compiled code.
+ *
+ * The code buffer is never writable and executable at once: it is
+ * switched to read-execute before entering compiled code, and back to
+ * read-write only to compile a block or patch an exit.
+*/
+class JitEngine {
+public:
+	JitEngine(Console* console);
+	~JitEngine();
+
+	/// False if this host can't run the JIT (not x86-64, or no executable memory).
+	bool available() const { return m_code != nullptr; }
+
+	/// Same contract as Console::run().
+	uint64_t run(uint64_t maxInstructions);
+
+	void invalidate(uint32_t begin, uint32_t end);
+
+private:
+	struct State;
+
+	const uint8_t* block(uint32_t pc);
+	const uint8_t* compile(uint32_t pc);
+	void emitRuntime();
+	void flush();
+
+	/// Maps the code buffer read-write or read-execute, false if the host refused.
+	bool protect(bool writable);
+
+	Console *m_console;
+
+	uint8_t *m_code{ nullptr }, *m_codePos{ nullptr }, *m_codeEnd{ nullptr }, *m_blocksStart{ nullptr };
+
+	// Shared code: the entry trampoline, the common exit and the exit for
+	// returns to addresses that have no compiled block.
+	const uint8_t *m_enter{ nullptr }, *m_exit{ nullptr }, *m_dynamicExit{ nullptr };
+
+	// Native entry of the block starting at each address (or null), and the
+	// same thing as seen by compiled returns (m_dynamicExit when there is none).
+	std::vector<const uint8_t*> m_blocks, m_table;
+	std::vector<bool> m_uncompilable;
+
+	bool m_flushPending{ false }, m_interpretNext{ false }, m_writable{ false };
+	uint32_t m_generation{ 0 };
+};
+
+#endif // JIT_H
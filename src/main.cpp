@@ -1,113 +1,258 @@
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
 
 #include "console.h"
+#include "headless.h"
 #include "asm.h"
+#include "cart.h"
+#include "native.h"
+#include "rewind.h"
+#include "hotpatch.h"
+#include "bake.h"
+#include "verifier.h"
+#include "profiler.h"
+#include "demo_cart.h"
+
+#ifdef CONSOLE_WITH_SDL
+#include "sdl_frontend.h"
+#endif
+
+extern const NativeCart NativeCart_demo;
+
+// The demo is assembled while compiling, booting it is a copy into the console.
+constexpr auto DemoCart = CONSOLE_BAKE_CART(DemoSource, true);
+constexpr auto DemoCartUnoptimized = CONSOLE_BAKE_CART(DemoSource, false);
+
+/// Opens a binary cart, or a source (.asm) through the cart cache, so it's only assembled when it changed.
+static bool openCart(Cart& cart, bool optimize, const std::string& cartPath, bool cache) {
+	const std::string extension = ".asm";
+	if (cartPath.size() < extension.size() || cartPath.compare(cartPath.size() - extension.size(), extension.size(), extension) != 0) {
+		return cart.open(cartPath);
+	}
+
+	std::string source;
+	if (!readSourceFile(cartPath, source)) {
+		std::cerr << "ERROR: Could not open \"" << cartPath << "\"." << std::endl;
+		return false;
+	}
+	return openCachedCart(cart, source, optimize, cache ? defaultCartCacheDir() : std::string());
+}
+
+static bool loadCart(Console& con, bool optimize, const std::string& cartPath, bool cache) {
+	if (cartPath.empty()) {
+		if (con.engine() == EngineNative) loadNativeCart(con, NativeCart_demo);
+		else if (optimize) DemoCart.load(con);
+		else DemoCartUnoptimized.load(con);
+		return true;
+	}
+
+	Cart cart;
+	if (!openCart(cart, optimize, cartPath, cache)) return false;
+	cart.load(con);
+	return true;
+}
+
+#if CONSOLE_PROFILER
+/// Labels of whatever loadCart() or --watch put in the console, for the profiler to name call chains with.
+static std::map<std::string, uint32_t> cartLabels(bool optimize, const std::string& cartPath, bool cache, const std::string& watchPath) {
+	if (!cartPath.empty()) {
+		Cart cart;
+		return openCart(cart, optimize, cartPath, cache) ? cart.symbols(CartSymbolLabel) : std::map<std::string, uint32_t>();
+	}
+
+	std::string source = DemoSource;
+	if (!watchPath.empty() && !readSourceFile(watchPath, source)) return {};
+	Console scratch{};
+	ASM assembler(source, &scratch);
+	assembler.setOptimize(optimize);
+	assembler.compile();
+	return assembler.labels();
+}
+
+/// Writes the folded stacks to `path` and the opcode and PC tables to stdout.
+static bool writeProfile(const Profiler& profiler, const std::string& path) {
+	profiler.writeReport(std::cout);
+	std::ofstream out(path);
+	profiler.writeFolded(out);
+	if (!out.good()) {
+		std::cerr << "ERROR: Could not write \"" << path << "\"." << std::endl;
+		return false;
+	}
+	return true;
+}
+#endif
+
+static int runHeadless(Console* con, uint64_t frames, uint64_t instructions, const std::string& sinkName, bool realtime) {
+	std::unique_ptr<FrameSink> sink;
+	if (sinkName.rfind("raw:", 0) == 0) {
+		std::unique_ptr<RawFileSink> raw(new RawFileSink(sinkName.substr(4)));
+		if (!raw->good()) {
+			std::cerr << "ERROR: Could not open \"" << sinkName.substr(4) << "\"." << std::endl;
+			return 1;
+		}
+		sink = std::move(raw);
+	} else {
+		sink.reset(new NullSink());
+	}
+
+	Headless headless(con, sink.get());
+	Scheduler scheduler(con);
+	if (realtime) headless.setScheduler(&scheduler);
+	HeadlessStats stats = instructions > 0 ? headless.runInstructions(instructions) : headless.runFrames(frames);
+
+	std::cout << "frames: " << stats.frames
+			  << ", instructions: " << stats.instructions
+			  << ", time: " << stats.seconds << "s"
+			  << ", " << stats.fps() << " fps"
+			  << ", " << stats.mips() << " MIPS"
+			  << " (target " << HeadlessTargetMIPS << " MIPS)"
+			  << ", " << stats.budgetUsage() * 100.0 << "% of cycle budget" << std::endl;
+	return 0;
+}
 
 int main(int argc, char** argv) {
+#ifdef CONSOLE_WITH_SDL
+	bool headless = false;
+#endif
+	uint64_t frames = 600, instructions = 0;
+	std::string sinkName = "null";
+	EngineType engine = EngineThreaded;
+	uint64_t diff = 0;
+	bool optimize = true, realtime = false, cache = true;
+#ifdef CONSOLE_WITH_SDL
+	size_t rewindMemory = RewindDefaultMemory;
+#endif
+	std::string cartPath, watchPath, profilePath, tracePath;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+#ifdef CONSOLE_WITH_SDL
+		if (arg == "--headless") headless = true;
+#else
+		// Without SDL every run is headless.
+		if (arg == "--headless") continue;
+#endif
+		else if (arg == "--frames" && i + 1 < argc) frames = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--instructions" && i + 1 < argc) instructions = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--sink" && i + 1 < argc) sinkName = argv[++i];
+		else if (arg == "--no-peephole") optimize = false;
+		else if (arg == "--realtime") realtime = true;
+		else if (arg == "--diff" && i + 1 < argc) diff = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--cart" && i + 1 < argc) cartPath = argv[++i];
+		else if (arg == "--watch" && i + 1 < argc) watchPath = argv[++i];
+		else if (arg == "--no-cart-cache") cache = false;
+#ifdef CONSOLE_WITH_SDL
+		else if (arg == "--rewind" && i + 1 < argc) rewindMemory = size_t(std::strtoull(argv[++i], nullptr, 10)) << 20;
+#endif
+#if CONSOLE_PROFILER
+		else if (arg == "--profile" && i + 1 < argc) profilePath = argv[++i];
+#endif
+#if CONSOLE_TRACE
+		else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+#endif
+		else if (arg == "--engine" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == "interp") engine = EngineInterpreter;
+			else if (name == "threaded") engine = EngineThreaded;
+			else if (name == "jit") engine = EngineJIT;
+			else if (name == "native") engine = EngineNative;
+			else {
+				std::cerr << "ERROR: Unknown engine \"" << name << "\"." << std::endl;
+				return 1;
+			}
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--cart FILE | --watch SOURCE] [--engine interp|threaded|jit|native] [--no-peephole] [--no-cart-cache] [--diff N] [--rewind MB] [--profile FOLDED] [--trace FILE] [--headless [--frames N [--realtime] | --instructions N] [--sink null|raw:FILE]]" << std::endl;
+			return 1;
+		}
+	}
+
 	Console con{};
+	con.setEngine(engine);
 
-	ASM comp(R"(
-			 let x, 11
-			 let dirx, 0
-			 let y, 37
-			 let diry, 1
-			 let fra, 0
-			 let spr, [
-				0, 0, 7, 7, 7, 7, 0, 0,
-				0, 7, 7, 7, 7, 7, 7, 0,
-				7, 7, 7, 7, 7, 7, 5, 7,
-				7, 7, 7, 7, 7, 7, 5, 7,
-				7, 7, 7, 7, 7, 5, 5, 7,
-				7, 7, 7, 7, 5, 5, 5, 7,
-				0, 7, 5, 5, 5, 5, 7, 0,
-				0, 0, 7, 7, 7, 7, 0, 0,
-
-				0, 0, 1, 1, 1, 1, 0, 0,
-				0, 1, 1, 1, 1, 1, 1, 0,
-				1, 1, 1, 1, 1, 1, 5, 1,
-				1, 1, 1, 1, 1, 1, 5, 1,
-				1, 1, 1, 1, 1, 5, 5, 1,
-				1, 1, 1, 1, 5, 5, 5, 1,
-				0, 1, 5, 5, 5, 5, 1, 0,
-				0, 0, 1, 1, 1, 1, 0, 0
-			 ]
-
-		_start:
-			 call _incx
-
-			 cmp &x, 88
-			 jge _swapx
-
-			 call _incy
-			 cmp &y, 88
-			 jge _swapy
-
-			 sys 0xF0
-
-			 pushm &fra		; Frame #
-			 pushm &x		; X
-			 pushm &y		; Y
-			 puts &spr
-
-			 jmp _start
-
-		_decx:
-			 cmp &dirx, 0
-			 jne _incx
-			 dec &x
-			 ret
-
-		_incx:
-			 cmp &dirx, 1
-			 jne _decx
-			 inc &x
-			 ret
-
-		_decy:
-			 cmp &diry, 0
-			 jne _incy
-			 dec &y
-			 ret
-
-		_incy:
-			 cmp &diry, 1
-			 jne _decy
-			 inc &y
-			 ret
-
-		_swapx:
-			 pushm &dirx
-			 push 1
-			 xor
-			 pop &dirx
-
-			 pushm &fra
-			 push 1
-			 xor
-			 pop &fra
-
-			 jmp _start
-
-		_swapy:
-			 pushm &diry
-			 push 1
-			 xor
-			 pop &diry
-
-			 pushm &fra
-			 push 1
-			 xor
-			 pop &fra
-
-			 jmp _start
-
-	)", &con);
-	ByteList code = comp.compile();
-
-	std::memcpy(con.prog(), code.data(), sizeof(Byte) * code.size());
-
-	con.init();
-	return 0;
+	// A watched source is assembled straight into the console and patched into it on every save.
+	std::unique_ptr<HotPatch> patcher;
+	if (!watchPath.empty()) {
+		if (engine == EngineNative) {
+			std::cerr << "ERROR: Native carts can't be patched, pick another engine to watch a source." << std::endl;
+			return 1;
+		}
+		std::string source;
+		if (!readSourceFile(watchPath, source)) {
+			std::cerr << "ERROR: Could not open \"" << watchPath << "\"." << std::endl;
+			return 1;
+		}
+		patcher.reset(new HotPatch(&con, optimize));
+		if (!patcher->patch(source)) return 1;
+	} else if (!loadCart(con, optimize, cartPath, cache)) return 1;
+
+	const Verifier& verifier = con.verifier();
+	if (!verifier.verified()) {
+		std::cerr << "WARNING: " << verifier.error() << " at " << verifier.errorPc() << ", the cart runs with every access checked." << std::endl;
+	}
+
+	if (diff > 0) {
+		// Differential mode: the selected engine against the reference interpreter.
+		// It runs a copy of the loaded cart, so native carts are compared too.
+		Console ref{};
+		ref.setEngine(EngineInterpreter);
+		std::copy(con.data(), con.data() + DataAddressable, ref.data());
+		ref.heap() = con.heap();
+		ref.writeProgram(0, con.prog(), ProgramSize);
+		bool same = runDifferential(ref, con, diff);
+		std::cout << (same ? "OK" : "FAILED") << ": " << diff << " ticks" << std::endl;
+		return same ? 0 : 1;
+	}
+
+#if CONSOLE_PROFILER
+	// Profiled, the program is interpreted whatever the engine.
+	Profiler profiler;
+	if (!profilePath.empty()) {
+		profiler.setLabels(cartLabels(optimize, cartPath, cache, watchPath));
+		con.setProfiler(&profiler);
+	}
+#endif
+
+#if CONSOLE_TRACE
+	TraceRing ring;
+	std::unique_ptr<TraceWriter> traceWriter;
+	if (!tracePath.empty()) {
+		traceWriter.reset(new TraceWriter(&ring, tracePath));
+		if (!traceWriter->good()) {
+			std::cerr << "ERROR: Could not open \"" << tracePath << "\"." << std::endl;
+			return 1;
+		}
+		con.setTrace(&ring);
+	}
+#endif
+
+	int result = 0;
+#ifdef CONSOLE_WITH_SDL
+	if (!headless) {
+		SDLFrontend frontend(&con, rewindMemory);
+		if (patcher) frontend.watch(watchPath, patcher.get());
+		result = frontend.run() ? 0 : 1;
+	} else
+#endif
+	result = runHeadless(&con, frames, instructions, sinkName, realtime);
+
+#if CONSOLE_PROFILER
+	if (!profilePath.empty() && !writeProfile(profiler, profilePath)) result = 1;
+#endif
+#if CONSOLE_TRACE
+	if (traceWriter) {
+		con.setTrace(nullptr);
+		if (!traceWriter->stop()) {
+			std::cerr << "ERROR: Could not write \"" << tracePath << "\"." << std::endl;
+			result = 1;
+		}
+		std::cout << "trace: " << traceWriter->written() << " records, " << ring.dropped() << " dropped" << std::endl;
+	}
+#endif
+	return result;
 }
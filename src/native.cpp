@@ -0,0 +1,47 @@
+#include "native.h"
+
+#include <algorithm>
+
+void loadNativeCart(Console& console, const NativeCart& cart) {
+	std::copy(cart.data, cart.data + cart.dataSize, console.data());
+	console.heap().reset();
+	if (cart.dataSize > 0) console.heap().reserve(0, std::min<uint32_t>(cart.dataSize, DataSize));
+	console.writeProgram(0, cart.code, cart.codeSize);
+	console.setNativeCart(&cart);
+	console.setEngine(EngineNative);
+}
+
+void NativeEngine::invalidate(uint32_t, uint32_t) {
+	// The generated code was compiled from the old program.
+	m_valid = false;
+}
+
+uint64_t NativeEngine::run(uint64_t maxInstructions) {
+	Console& c = *m_console;
+
+	uint64_t count = 0;
+	while (count < maxInstructions && !c.m_halted && !c.m_video.dirty()) {
+		if (c.m_waitTimer > 0) {
+			Byte n = Byte(std::min<uint64_t>(c.m_waitTimer, maxInstructions - count));
+			c.m_waitTimer -= n;
+			c.m_ticks += n;
+			c.m_cycles += n;
+			count += n;
+			continue;
+		}
+
+		if (m_interpretNext || c.m_pc >= ProgramSize) {
+			m_interpretNext = false;
+			c.tick();
+			count++;
+			continue;
+		}
+
+		NativeMachine m(m_console);
+		uint64_t executed = m_cart->run(m, maxInstructions - count);
+		count += executed;
+		c.m_ticks += executed;
+		m_interpretNext = m.interpret();
+	}
+	return count;
+}
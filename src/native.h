@@ -0,0 +1,114 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "console.h"
+
+/**
+ * Native carts are carts recompiled ahead of time to C++ by
+ * console_recompile (see recompiler.h). The generated code runs against
+ * the console through NativeMachine and hands anything it couldn't
+ * compile back to the interpreter.
+*/
+class NativeMachine;
+
+/// Executes ticks from the console PC, same contract as Console::run().
+using NativeCartRun = uint64_t (*)(NativeMachine& m, uint64_t maxInstructions);
+
+struct NativeCart {
+	const char* name;
+	const Byte* code;
+	uint32_t codeSize;
+	const Byte* data;
+	uint32_t dataSize;
+	NativeCartRun run;
+};
+
+/// Copies the cart's code and data into the console and selects EngineNative.
+void loadNativeCart(Console& console, const NativeCart& cart);
+
+/**
+ * The view of the console the generated code works with. Everything is
+ * inline, so it compiles down to the same accesses the interpreter does.
+*/
+class NativeMachine {
+public:
+	using Value = Console::Value;
+
+	static constexpr uint32_t CmpEquals = Console::CmpEquals;
+	static constexpr uint32_t CmpGreater = Console::CmpGreater;
+	static constexpr uint32_t CmpLess = Console::CmpLess;
+
+	NativeMachine(Console* console) : m_console(console) {}
+
+	Byte* data() { return m_console->data(); }
+	Video& video() { return m_console->m_video; }
+
+	Byte pc() const { return m_console->m_pc; }
+	uint32_t cmp() const { return m_console->m_cmpResult; }
+
+	static uint32_t compare(Byte a, Byte b) {
+		return a == b ? CmpEquals : a > b ? CmpGreater : CmpLess;
+	}
+
+	bool stackRoom(uint32_t n) const { return StackSize - m_console->m_stack.size() >= n; }
+	bool empty() const { return m_console->m_stack.empty(); }
+
+	void push(Byte value) { m_console->m_stack.push(Value(value, Value::Literal)); }
+	void pushAddress(Byte addr) { m_console->m_stack.push(Value(addr, Value::MemoryAddr)); }
+	Byte pop() {
+		const Value& v = m_console->m_stack.top();
+		Byte value = v.type == Value::Literal ? v.val : data()[v.val];
+		m_console->m_stack.pop();
+		return value;
+	}
+
+	void call(Byte returnPc) { m_console->m_callStack.push(returnPc); }
+	Byte ret() {
+		Byte pc = m_console->m_callStack.top() + 1;
+		m_console->m_callStack.pop();
+		return pc;
+	}
+
+	void halt() { m_console->m_halted = true; }
+	void wait(Byte n) { m_console->m_waitTimer = n * 512; }
+
+	/// Stores the PC, compare result and cycles used when leaving the generated code.
+	void leave(Byte pc, uint32_t cmp, uint64_t cycles) {
+		m_console->m_pc = pc;
+		m_console->m_cmpResult = Console::CmpResult(cmp);
+		m_console->m_cycles += cycles;
+	}
+
+	/// Like leave(), but the next instruction must run on the interpreter.
+	void bail(Byte pc, uint32_t cmp, uint64_t cycles) {
+		leave(pc, cmp, cycles);
+		m_interpret = true;
+	}
+
+	bool interpret() const { return m_interpret; }
+
+private:
+	Console *m_console;
+	bool m_interpret{ false };
+};
+
+/// Runs a native cart, falling back to Console::tick() where the generated code bails.
+class NativeEngine {
+public:
+	NativeEngine(Console* console) : m_console(console) {}
+
+	void setCart(const NativeCart* cart) { m_cart = cart; m_valid = cart != nullptr; }
+
+	/// False if there is no cart or the program changed since it was loaded.
+	bool valid() const { return m_valid; }
+
+	uint64_t run(uint64_t maxInstructions);
+	void invalidate(uint32_t begin, uint32_t end);
+
+private:
+	Console *m_console;
+	const NativeCart *m_cart{ nullptr };
+	bool m_valid{ false }, m_interpretNext{ false };
+};
+
+#endif // NATIVE_H
@@ -0,0 +1,133 @@
+#include "palette.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CONSOLE_PALETTE_X64 1
+#include <immintrin.h>
+#endif
+
+// Only GCC and Clang can compile single functions for AVX2.
+#if defined(CONSOLE_PALETTE_X64) && defined(__GNUC__)
+#define CONSOLE_PALETTE_AVX2 1
+#endif
+
+static void expandScalar(const Pixel* src, uint32_t* dst, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		dst[i] = PaletteARGB[src[i] % PaletteSize];
+	}
+}
+
+#ifdef CONSOLE_PALETTE_X64
+// SSE2 has no variable shuffle, so each index is compared against every
+// palette entry and the matching color kept, 4 pixels at a time.
+static inline __m128i lookupSSE2(__m128i index, const __m128i* colors) {
+	index = _mm_and_si128(index, _mm_set1_epi32(PaletteSize - 1));
+	__m128i out = _mm_setzero_si128();
+	for (uint32_t k = 0; k < PaletteSize; k++) {
+		__m128i match = _mm_cmpeq_epi32(index, _mm_set1_epi32(int(k)));
+		out = _mm_or_si128(out, _mm_and_si128(match, colors[k]));
+	}
+	return out;
+}
+
+static void expandSSE2(const Pixel* src, uint32_t* dst, uint32_t count) {
+	__m128i colors[PaletteSize];
+	for (uint32_t k = 0; k < PaletteSize; k++) colors[k] = _mm_set1_epi32(int(PaletteARGB[k]));
+
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i index;
+		if constexpr (sizeof(Pixel) == 1) {
+			uint32_t bytes;
+			std::memcpy(&bytes, src + i, sizeof(bytes));
+			const __m128i zero = _mm_setzero_si128();
+			index = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(bytes)), zero), zero);
+		} else {
+			index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), lookupSSE2(index, colors));
+	}
+	expandScalar(src + i, dst + i, count - i);
+}
+#endif
+
+#ifdef CONSOLE_PALETTE_AVX2
+// vpermd only looks at the low 3 bits of each index, which is the modulo for free.
+__attribute__((target("avx2")))
+static void expandAVX2(const Pixel* src, uint32_t* dst, uint32_t count) {
+	const __m256i lut = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(PaletteARGB.data()));
+
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i index;
+		if constexpr (sizeof(Pixel) == 1) {
+			index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+		} else {
+			index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permutevar8x32_epi32(lut, index));
+	}
+	expandScalar(src + i, dst + i, count - i);
+}
+#endif
+
+using RowKernel = void (*)(const Pixel*, uint32_t*, uint32_t);
+
+static RowKernel rowKernel(PaletteKernel kernel) {
+	switch (kernel) {
+#ifdef CONSOLE_PALETTE_X64
+		case PaletteKernelSSE2: return expandSSE2;
+#endif
+#ifdef CONSOLE_PALETTE_AVX2
+		case PaletteKernelAVX2: return expandAVX2;
+#endif
+		default: return expandScalar;
+	}
+}
+
+bool paletteKernelSupported(PaletteKernel kernel) {
+	switch (kernel) {
+		case PaletteKernelScalar: return true;
+#ifdef CONSOLE_PALETTE_X64
+		case PaletteKernelSSE2: return true;
+#endif
+#ifdef CONSOLE_PALETTE_AVX2
+		case PaletteKernelAVX2: return __builtin_cpu_supports("avx2");
+#endif
+		default: return false;
+	}
+}
+
+// The SSE2 kernel runs 8 compares per 4 pixels and measures about half the
+// speed of the scalar lookup, so it's only there to be benchmarked.
+PaletteKernel bestPaletteKernel() {
+#ifdef CONSOLE_PALETTE_AVX2
+	if (paletteKernelSupported(PaletteKernelAVX2)) return PaletteKernelAVX2;
+#endif
+	return PaletteKernelScalar;
+}
+
+const char* paletteKernelName(PaletteKernel kernel) {
+	switch (kernel) {
+		case PaletteKernelScalar: return "scalar";
+		case PaletteKernelSSE2: return "sse2";
+		case PaletteKernelAVX2: return "avx2";
+		default: return "unknown";
+	}
+}
+
+void expandPalette(PaletteKernel kernel, const Pixel* src, uint32_t srcStride, void* dst, int pitch, uint32_t width, uint32_t height) {
+	RowKernel expand = rowKernel(kernel);
+	uint8_t* row = static_cast<uint8_t*>(dst);
+	for (uint32_t y = 0; y < height; y++) {
+		expand(src, reinterpret_cast<uint32_t*>(row), width);
+		src += srcStride;
+		row += pitch;
+	}
+}
+
+void expandPalette(const Pixel* src, uint32_t srcStride, void* dst, int pitch, uint32_t width, uint32_t height) {
+	static const PaletteKernel kernel = bestPaletteKernel();
+	expandPalette(kernel, src, srcStride, dst, pitch, width, height);
+}
@@ -0,0 +1,50 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include "video.h"
+
+#include <array>
+#include <cstdint>
+
+constexpr uint32_t PaletteSize = sizeof(PALETTE) / sizeof(PALETTE[0]);
+
+/// PALETTE packed as 0xAARRGGBB, the layout of SDL_PIXELFORMAT_ARGB8888.
+constexpr std::array<uint32_t, PaletteSize> packPalette() {
+	std::array<uint32_t, PaletteSize> lut{};
+	for (uint32_t i = 0; i < PaletteSize; i++) {
+		lut[i] = 0xFF000000u | (uint32_t(PALETTE[i][0]) << 16) | (uint32_t(PALETTE[i][1]) << 8) | uint32_t(PALETTE[i][2]);
+	}
+	return lut;
+}
+
+constexpr std::array<uint32_t, PaletteSize> PaletteARGB = packPalette();
+
+static_assert(PaletteSize == 8, "The SIMD kernels look colors up with 3 bit indices");
+
+enum PaletteKernel {
+	PaletteKernelScalar = 0,
+	PaletteKernelSSE2,
+	PaletteKernelAVX2,
+	PaletteKernelCount
+};
+
+/**
+ * Expands a `width` x `height` block of palette indices to 32-bit
+ * PaletteARGB pixels. Source rows are `srcStride` pixels apart, destination
+ * rows `pitch` bytes apart (the pitch of a locked texture, say). Indices
+ * are taken modulo PaletteSize.
+*/
+void expandPalette(const Pixel* src, uint32_t srcStride, void* dst, int pitch, uint32_t width, uint32_t height);
+
+/// Same as above, with a specific kernel. It must be supported.
+void expandPalette(PaletteKernel kernel, const Pixel* src, uint32_t srcStride, void* dst, int pitch, uint32_t width, uint32_t height);
+
+/// Whether this CPU can run `kernel`.
+bool paletteKernelSupported(PaletteKernel kernel);
+
+/// The fastest supported kernel (avx2, else scalar), used by the first expandPalette().
+PaletteKernel bestPaletteKernel();
+
+const char* paletteKernelName(PaletteKernel kernel);
+
+#endif // PALETTE_H
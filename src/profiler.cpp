@@ -0,0 +1,152 @@
+#include "profiler.h"
+#include "asm.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace {
+	std::string hex(uint32_t address) {
+		std::ostringstream out;
+		out << "0x" << std::hex << std::setw(4) << std::setfill('0') << address;
+		return out.str();
+	}
+}
+
+Profiler::Profiler() : m_pcs(ProgramSize, 0) {}
+
+void Profiler::reset() {
+	m_ops.fill({});
+	std::fill(m_pcs.begin(), m_pcs.end(), 0);
+	m_instructions = m_cycles = m_idle = 0;
+	m_chains.clear();
+	m_returns.clear();
+	m_current = nullptr;
+}
+
+void Profiler::setLabels(const std::map<std::string, uint32_t>& labels) {
+	m_labels.clear();
+	// Of the labels sharing an address, the first by name is kept.
+	for (auto&& label : labels) m_labels.emplace(label.second, label.first);
+}
+
+Profiler::ChainCycles& Profiler::chain(Console& console) {
+	const Byte* returns = console.m_callStack.data();
+	const uint32_t depth = console.m_callStack.size();
+	if (m_current && m_returns.size() == depth && std::equal(returns, returns + depth, m_returns.begin())) {
+		return *m_current;
+	}
+
+	// A call pushes the address of its operand, the call target.
+	m_returns.assign(returns, returns + depth);
+	std::vector<Byte> targets(depth);
+	for (uint32_t i = 0; i < depth; i++) targets[i] = returns[i] < ProgramSize ? console.prog()[returns[i]] : returns[i];
+	m_current = &m_chains[targets];
+	return *m_current;
+}
+
+uint64_t Profiler::run(Console& console, uint64_t maxInstructions) {
+	uint64_t count = 0;
+	while (count < maxInstructions && !console.m_halted && !console.m_video.dirty()) {
+		ChainCycles& cycles = chain(console);
+		const uint64_t before = console.m_cycles;
+		count++;
+
+		if (console.m_waitTimer > 0) {
+			console.tick();
+			m_idle += console.m_cycles - before;
+			m_cycles += console.m_cycles - before;
+			cycles[IdlePc] += console.m_cycles - before;
+			continue;
+		}
+
+		const Byte pc = console.m_pc;
+		const Byte op = pc < ProgramSize ? console.prog()[pc] : Byte(OpHalt);
+		auto start = Clock::now();
+		console.tick();
+		const uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		const uint64_t spent = console.m_cycles - before;
+
+		OpStats& stats = m_ops[std::min<Byte>(op, OpCmpMJ + 1)];
+		stats.count++;
+		stats.cycles += spent;
+		stats.nanos += nanos;
+		if (pc < ProgramSize) {
+			m_pcs[pc]++;
+			cycles[pc] += spent;
+		}
+		m_instructions++;
+		m_cycles += spent;
+	}
+	return count;
+}
+
+std::string Profiler::name(uint32_t address) const {
+	auto it = m_labels.find(address);
+	return it != m_labels.end() ? it->second : hex(address);
+}
+
+std::string Profiler::leaf(uint32_t entry, uint32_t pc) const {
+	auto it = m_labels.upper_bound(pc);
+	if (it == m_labels.begin()) return std::string();
+	--it;
+	return it->first > entry ? it->second : std::string();
+}
+
+void Profiler::writeFolded(std::ostream& out) const {
+	// Instructions under the same label fold into one line.
+	std::map<std::string, uint64_t> lines;
+	for (auto&& entry : m_chains) {
+		std::string stack = name(0);
+		for (Byte target : entry.first) stack += ";" + name(target);
+		const uint32_t function = entry.first.empty() ? 0 : entry.first.back();
+
+		for (auto&& pc : entry.second) {
+			std::string inner = pc.first == IdlePc ? std::string("[wait]") : leaf(function, pc.first);
+			lines[inner.empty() ? stack : stack + ";" + inner] += pc.second;
+		}
+	}
+	for (auto&& line : lines) {
+		if (line.second > 0) out << line.first << " " << line.second << "\n";
+	}
+}
+
+void Profiler::writeReport(std::ostream& out, size_t top) const {
+	auto share = [](uint64_t part, uint64_t whole) { return whole > 0 ? 100.0 * double(part) / double(whole) : 0.0; };
+
+	std::vector<Byte> ops;
+	for (Byte op = 0; op < m_ops.size(); op++) {
+		if (m_ops[op].count > 0) ops.push_back(op);
+	}
+	std::sort(ops.begin(), ops.end(), [&](Byte a, Byte b) { return m_ops[a].cycles > m_ops[b].cycles; });
+
+	out << m_instructions << " instructions, " << m_cycles << " cycles (" << std::fixed << std::setprecision(1)
+		<< share(m_idle, m_cycles) << "% waiting)\n";
+	out << std::left << std::setw(10) << "opcode" << std::right << std::setw(14) << "count" << std::setw(14) << "cycles"
+		<< std::setw(8) << "%" << std::setw(10) << "ns/op" << "\n";
+	for (Byte op : ops) {
+		const OpStats& stats = m_ops[op];
+		out << std::left << std::setw(10) << std::string(opCodeName(op)) << std::right << std::setw(14) << stats.count
+			<< std::setw(14) << stats.cycles << std::setw(8) << share(stats.cycles, m_cycles)
+			<< std::setw(10) << double(stats.nanos) / double(stats.count) << "\n";
+	}
+
+	std::vector<uint32_t> pcs;
+	for (uint32_t pc = 0; pc < ProgramSize; pc++) {
+		if (m_pcs[pc] > 0) pcs.push_back(pc);
+	}
+	std::sort(pcs.begin(), pcs.end(), [&](uint32_t a, uint32_t b) { return m_pcs[a] > m_pcs[b]; });
+	pcs.resize(std::min(pcs.size(), top));
+
+	out << std::left << std::setw(10) << "pc" << std::setw(24) << "label" << std::right << std::setw(14) << "count"
+		<< std::setw(8) << "%" << "\n";
+	for (uint32_t pc : pcs) {
+		std::string label;
+		auto it = m_labels.upper_bound(pc);
+		if (it != m_labels.begin()) {
+			--it;
+			label = it->second + (it->first == pc ? "" : "+" + std::to_string(pc - it->first));
+		}
+		out << std::left << std::setw(10) << hex(pc) << std::setw(24) << label << std::right << std::setw(14)
+			<< m_pcs[pc] << std::setw(8) << share(m_pcs[pc], m_instructions) << "\n";
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "console.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Opt-in VM profiler.
+ *
+ * While one is set on a console (see Console::setProfiler), run() hands
+ * the instruction loop over to Profiler::run(), which interprets like
+ * the reference interpreter and records, for each instruction, its
+ * opcode (executions, cycles and host time), its PC and the call chain
+ * it ran under. Ticks spent waiting are idle cycles, charged to the
+ * chain of the wait.
+ *
+ * Without a profiler set, run() pays for a single pointer test per call,
+ * and none at all when built with CONSOLE_PROFILER=0.
+ *
+ * The call chains are made of call targets, read back from the return
+ * addresses in the call stack, and print as the labels at those
+ * addresses (see setLabels()), innermost being the label nearest below
+ * the PC. writeFolded() writes them in the folded-stack format of
+ * flamegraph.pl and compatible tools, weighted by cycles.
+*/
+class Profiler {
+public:
+	struct OpStats {
+		uint64_t count{ 0 }, cycles{ 0 }, nanos{ 0 };
+	};
+
+	Profiler();
+	~Profiler() = default;
+
+	/// Profiled Console::run(): ticks until a frame is ready, the console halts or `maxInstructions` ticks were executed.
+	uint64_t run(Console& console, uint64_t maxInstructions);
+
+	/// Forgets everything recorded so far. The labels are kept.
+	void reset();
+
+	/// Program address -> name, as ASM::labels() or Cart::symbols(CartSymbolLabel) give them.
+	void setLabels(const std::map<std::string, uint32_t>& labels);
+
+	/// What the instructions of opcode `op` took. Bytes that aren't opcodes share the slot past OpCmpMJ.
+	const OpStats& op(Byte op) const { return m_ops[std::min<Byte>(op, OpCmpMJ + 1)]; }
+
+	/// Executions of each program address, ProgramSize of them.
+	const std::vector<uint64_t>& pcHistogram() const { return m_pcs; }
+
+	uint64_t instructions() const { return m_instructions; }
+	uint64_t cycles() const { return m_cycles; }
+	uint64_t idleCycles() const { return m_idle; }
+
+	/// One "frame;frame;frame cycles" line per call chain and innermost label, for flamegraph tools.
+	void writeFolded(std::ostream& out) const;
+
+	/// Opcodes by cycles and the `top` hottest PCs, as a table.
+	void writeReport(std::ostream& out, size_t top = 16) const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/// Cycles by PC under one call chain, IdlePc for the ticks spent waiting.
+	using ChainCycles = std::unordered_map<uint32_t, uint64_t>;
+	static constexpr uint32_t IdlePc = ProgramSize;
+
+	/// The entry of the chain the console is in now, looked up again only when its call stack changed.
+	ChainCycles& chain(Console& console);
+
+	/// Name of the label at `address`, or its address in hex.
+	std::string name(uint32_t address) const;
+
+	/// Name of the label nearest below `pc`, if it's inside the function starting at `entry`.
+	std::string leaf(uint32_t entry, uint32_t pc) const;
+
+	std::array<OpStats, OpCmpMJ + 2> m_ops;
+	std::vector<uint64_t> m_pcs;
+	uint64_t m_instructions{ 0 }, m_cycles{ 0 }, m_idle{ 0 };
+
+	// Keyed by call targets, outermost first
+	std::map<std::vector<Byte>, ChainCycles> m_chains;
+	std::vector<Byte> m_returns;		// Call stack m_current was looked up for
+	ChainCycles* m_current{ nullptr };
+
+	std::map<uint32_t, std::string> m_labels;
+};
+
+#endif // PROFILER_H
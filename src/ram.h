@@ -2,71 +2,30 @@
 #define RAM_H
 
 #include <array>
-#include <vector>
 #include <cstdint>
 #include <cassert>
-#include <algorithm>
 
 using Byte = uint32_t;
 
-struct DataBlock {
-	uint16_t address, size;
-	Byte* data;
-};
-
-template <uint16_t SizeKB>
+/// `SizeKB` * 1024 cells of type `Cell`.
+template <uint16_t SizeKB, typename Cell = Byte>
 class RAM {
 public:
-	RAM()
-		: m_dataPtr(0u)
-	{ m_data.fill(0u); }
+	RAM() { m_data.fill(0u); }
 
 	~RAM() = default;
 
-	Byte* map(uint16_t addr) { return &m_data[addr]; }
-
-	uint16_t alloc(uint16_t size) {
-		if (size == 0) return -1;
-
-		DataBlock block;
-		auto pos = std::find_if(m_unused.begin(), m_unused.end(), [=](const DataBlock& d){
-			return d.size >= size;
-		});
-		if (!m_unused.empty() && pos != m_unused.end()) {
-			block = m_unused.back();
-			m_unused.pop_back();
-		} else {
-			block = DataBlock();
-			block.size = size;
-			block.address = m_dataPtr;
-			block.data = map(block.address);
-			m_dataPtr += size;
-			m_inuse.push_back(block);
-		}
-		return block.address;
-	}
+	static constexpr uint32_t Size = SizeKB * 1024;
 
-	void free(uint16_t addr) {
-		auto pos = std::find_if(m_inuse.begin(), m_inuse.end(), [=](const DataBlock& d) {
-			return d.address == addr;
-		});
-		if (pos != m_inuse.end()) {
-			DataBlock block = m_inuse.back();
-			block.data = nullptr;
-			m_inuse.pop_back();
-			m_unused.push_back(block);
-		}
-	}
+	Cell* map(uint16_t addr) { return &m_data[addr]; }
 
-	Byte& operator [](uint16_t addr) { return m_data[addr]; }
-	const Byte& operator [](uint16_t addr) const { return m_data[addr]; }
+	Cell& operator [](uint16_t addr) { return m_data[addr]; }
+	const Cell& operator [](uint16_t addr) const { return m_data[addr]; }
 
-	std::array<Byte, SizeKB * 1024> data() const { return m_data; }
+	const std::array<Cell, Size>& data() const { return m_data; }
 
 private:
-	std::array<Byte, SizeKB * 1024> m_data;
-	std::vector<DataBlock> m_unused, m_inuse;
-	uint16_t m_dataPtr;
+	std::array<Cell, Size> m_data;
 };
 
 #endif // RAM_H
@@ -0,0 +1,415 @@
+#include "recompiler.h"
+
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+bool isDataOperand(Byte op) {
+	return op == OpPop || op == OpInc || op == OpDec || op == OpPutPM || op == OpCmp || op == OpCmpM ||
+		   op == OpCmpJ || op == OpCmpMJ || (op >= OpAddMI && op <= OpXorMI);
+}
+
+bool isJump(Byte op) {
+	return op >= OpJmp && op <= OpJle;
+}
+
+// Instructions that end a basic block.
+bool endsBlock(Byte op) {
+	switch (op) {
+		case OpJmp: case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle:
+		case OpCmpJ: case OpCmpMJ:
+		case OpCall: case OpRet:
+		case OpHalt: case OpWait:
+		case OpPutP: case OpPutPM: case OpPutS: case OpSys:
+			return true;
+		default: return false;
+	}
+}
+
+std::string label(uint32_t pc) {
+	return "L_" + std::to_string(pc);
+}
+
+}
+
+Recompiler::Recompiler(const std::vector<Byte>& code, const std::vector<Byte>& data)
+	: m_code(code), m_data(data)
+{
+	discover();
+}
+
+bool Recompiler::decode(uint32_t pc, Instruction& in) const {
+	if (pc >= m_code.size()) return false;
+
+	in.pc = pc;
+	in.op = m_code[pc];
+	in.length = 1 + operandCount(in.op);
+	in.a = in.length > 1 && pc + 1 < m_code.size() ? m_code[pc + 1] : 0;
+	in.b = in.length > 2 && pc + 2 < m_code.size() ? m_code[pc + 2] : 0;
+	in.c = in.length > 3 && pc + 3 < m_code.size() ? m_code[pc + 3] : 0;
+	in.d = in.length > 4 && pc + 4 < m_code.size() ? m_code[pc + 4] : 0;
+
+	in.native = in.op <= OpCmpMJ && pc + in.length <= m_code.size();
+	if (isDataOperand(in.op) && in.a >= DataAddressable) in.native = false;
+	if ((in.op == OpCmpM || in.op == OpCmpMJ) && in.b >= DataAddressable) in.native = false;
+	if ((in.op == OpCmpJ || in.op == OpCmpMJ) && (!isJump(in.c) || in.c == OpJmp || in.d >= ProgramSize)) in.native = false;
+	if ((isJump(in.op) || in.op == OpCall) && in.a >= ProgramSize) in.native = false;
+	if (in.op == OpSys && in.a != SysClearScreen) in.native = false;
+	if (namesCycleCounter(in.op, in.a, in.b)) in.native = false;
+	return true;
+}
+
+void Recompiler::discover() {
+	std::vector<uint32_t> work = { 0 };
+	m_leaders.insert(0);
+
+	auto follow = [&](uint32_t pc, bool leader) {
+		if (leader) m_leaders.insert(pc);
+		work.push_back(pc);
+	};
+
+	while (!work.empty()) {
+		uint32_t pc = work.back();
+		work.pop_back();
+		if (m_instructions.count(pc)) continue;
+
+		Instruction in;
+		if (!decode(pc, in)) {
+			// Outside of the code, left to the interpreter.
+			m_leaders.insert(pc);
+			continue;
+		}
+		m_instructions[pc] = in;
+
+		uint32_t next = pc + in.length;
+		if (!in.native) {
+			m_leaders.insert(pc);
+			follow(next, true);
+			continue;
+		}
+
+		switch (in.op) {
+			case OpJmp: follow(in.a, true); break;
+			case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle:
+				follow(in.a, true);
+				follow(next, true);
+				break;
+			case OpCmpJ: case OpCmpMJ:
+				follow(in.d, true);
+				follow(next, true);
+				break;
+			case OpCall:
+				follow(in.a, true);
+				follow(next, true);
+				m_returnSites.insert(next);
+				break;
+			case OpRet: break;
+			default: follow(next, endsBlock(in.op)); break;
+		}
+	}
+}
+
+void Recompiler::emitBlock(std::ostream& out, uint32_t leader) {
+	out << label(leader) << ": {\n";
+
+	auto first = m_instructions.find(leader);
+	if (first == m_instructions.end() || !first->second.native) {
+		out << "\tBAIL(" << leader << ");\n}\n";
+		return;
+	}
+
+	// Gather the block and check how much it grows the stack.
+	std::vector<Instruction> body;
+	uint32_t pc = leader;
+	bool ended = false;
+	int depth = 0, maxDepth = 0;
+	while (true) {
+		auto it = m_instructions.find(pc);
+		if (it == m_instructions.end() || !it->second.native || (pc != leader && m_leaders.count(pc))) break;
+
+		const Instruction& in = it->second;
+		switch (in.op) {
+			case OpPush: case OpPushM: depth++; break;
+			case OpPop: case OpAdd: case OpSub: case OpMul: case OpDiv:
+			case OpLsh: case OpRsh: case OpAnd: case OpOr: case OpXor:
+				depth--; break;
+			default: break;
+		}
+		maxDepth = std::max(maxDepth, depth);
+
+		body.push_back(in);
+		pc += in.length;
+		if (endsBlock(in.op)) {
+			ended = true;
+			break;
+		}
+	}
+
+	out << "\tif (left < " << body.size() << "u";
+	if (maxDepth > 0) out << " || !m.stackRoom(" << maxDepth << "u)";
+	out << ") BAIL(" << leader << ");\n";
+	uint32_t cycles = 0;
+	for (const Instruction& in : body) cycles += cycleCost(in.op);
+	out << "\tleft -= " << body.size() << "u;\n";
+	out << "\tcycles += " << cycles << "u;\n";
+
+	// Compile time view of the top of the operand stack
+	enum Kind { KindConst, KindAddr, KindTemp, KindMem };
+	struct Item { Kind kind; Byte value; std::string name; };
+	std::vector<Item> stack;
+	uint32_t temps = 0;
+
+	auto pop = [&]() -> Item {
+		if (stack.empty()) return { KindMem, 0, "" };
+		Item it = stack.back();
+		stack.pop_back();
+		return it;
+	};
+
+	auto temp = [&](const std::string& expr) {
+		std::string name = "t" + std::to_string(temps++);
+		out << "\tByte " << name << " = " << expr << ";\n";
+		return name;
+	};
+
+	// Expression for the value of an item, read now (like `unpack`).
+	auto value = [&](const Item& it) -> std::string {
+		switch (it.kind) {
+			case KindConst: return std::to_string(it.value) + "u";
+			case KindAddr: return "data[" + std::to_string(it.value) + "]";
+			case KindTemp: return it.name;
+			default: return temp("m.pop()");
+		}
+	};
+
+	// Pops the optional operand of puts/sys, 0 if the stack is empty.
+	auto optional = [&]() -> std::string {
+		if (!stack.empty()) return value(pop());
+		return temp("m.empty() ? 0u : m.pop()");
+	};
+
+	auto spill = [&]() {
+		for (const Item& it : stack) {
+			if (it.kind == KindAddr) out << "\tm.pushAddress(" << it.value << "u);\n";
+			else out << "\tm.push(" << value(it) << ");\n";
+		}
+		stack.clear();
+	};
+
+	auto leaveOrContinue = [&](uint32_t next) {
+		out << "\tif (video.dirty()) LEAVE(" << next << ");\n";
+		out << "\tgoto " << label(next) << ";\n";
+	};
+
+	const char* binops[] = { "+", "-", "*", "/" };
+	const char* conds[] = {
+		"cmp == NativeMachine::CmpEquals",
+		"cmp != NativeMachine::CmpEquals",
+		"cmp == NativeMachine::CmpGreater",
+		"cmp == NativeMachine::CmpLess",
+		"cmp != NativeMachine::CmpLess",
+		"cmp != NativeMachine::CmpGreater"
+	};
+	for (const Instruction& in : body) {
+		uint32_t next = in.pc + in.length;
+		switch (in.op) {
+			case OpNoop: break;
+			case OpPush: stack.push_back({ KindConst, in.a, "" }); break;
+			case OpPushM: stack.push_back({ KindAddr, in.a, "" }); break;
+			case OpPop: {
+				std::string v = value(pop());
+				out << "\tdata[" << in.a << "] = " << v << ";\n";
+			} break;
+			case OpInc: out << "\tdata[" << in.a << "]++;\n"; break;
+			case OpDec: out << "\tdata[" << in.a << "]--;\n"; break;
+			case OpAdd: case OpSub: case OpMul: case OpDiv:
+			case OpAnd: case OpOr: case OpXor:
+			case OpLsh: case OpRsh: {
+				Item a = pop(), b = pop();
+				std::string op;
+				switch (in.op) {
+					case OpAnd: op = "&"; break;
+					case OpOr: op = "|"; break;
+					case OpXor: op = "^"; break;
+					case OpLsh: op = "<<"; break;
+					case OpRsh: op = ">>"; break;
+					default: op = binops[in.op - OpAdd]; break;
+				}
+
+				bool foldable = in.op != OpDiv && in.op != OpLsh && in.op != OpRsh;
+				if (foldable && a.kind == KindConst && b.kind == KindConst) {
+					Byte res = 0;
+					switch (in.op) {
+						case OpAdd: res = a.value + b.value; break;
+						case OpSub: res = a.value - b.value; break;
+						case OpMul: res = a.value * b.value; break;
+						case OpAnd: res = a.value & b.value; break;
+						case OpOr: res = a.value | b.value; break;
+						case OpXor: res = a.value ^ b.value; break;
+						default: break;
+					}
+					stack.push_back({ KindConst, res, "" });
+					break;
+				}
+
+				std::string va = value(a), vb = value(b);
+				if (in.op == OpLsh || in.op == OpRsh) vb = "(" + vb + " & " + std::to_string(ShiftMask) + "u)";
+				if (in.op == OpDiv) stack.push_back({ KindTemp, 0, temp("quotient(" + va + ", " + vb + ")") });
+				else stack.push_back({ KindTemp, 0, temp(va + " " + op + " " + vb) });
+			} break;
+			case OpNot: {
+				Item a = pop();
+				if (a.kind == KindConst) stack.push_back({ KindConst, ~a.value, "" });
+				else stack.push_back({ KindTemp, 0, temp("~" + value(a)) });
+			} break;
+			case OpCmp:
+				out << "\tcmp = NativeMachine::compare(data[" << in.a << "], " << in.b << "u);\n";
+				break;
+			case OpCmpM:
+				out << "\tcmp = NativeMachine::compare(data[" << in.a << "], data[" << in.b << "]);\n";
+				break;
+			case OpJmp:
+				spill();
+				out << "\tgoto " << label(in.a) << ";\n";
+				break;
+			case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle: {
+				spill();
+				out << "\tif (" << conds[in.op - OpJeq] << ") goto " << label(in.a) << ";\n";
+				out << "\tgoto " << label(next) << ";\n";
+			} break;
+			case OpAddMI: case OpSubMI: case OpMulMI: case OpDivMI: case OpLshMI:
+			case OpRshMI: case OpAndMI: case OpOrMI: case OpXorMI: {
+				const char* ops[] = { "+", "-", "*", "/", "<<", ">>", "&", "|", "^" };
+				std::string lit = std::to_string(in.op == OpLshMI || in.op == OpRshMI ? in.b & ShiftMask : in.b) + "u";
+				if (in.op == OpDivMI && in.b == 0) out << "\tdata[" << in.a << "] = " << quotient(0, 0) << "u;\n";
+				else out << "\tdata[" << in.a << "] = data[" << in.a << "] " << ops[in.op - OpAddMI] << " " << lit << ";\n";
+			} break;
+			case OpCmpJ:
+			case OpCmpMJ: {
+				std::string b = in.op == OpCmpJ ? std::to_string(in.b) + "u" : "data[" + std::to_string(in.b) + "]";
+				out << "\tcmp = NativeMachine::compare(data[" << in.a << "], " << b << ");\n";
+				spill();
+				out << "\tif (" << conds[in.c - OpJeq] << ") goto " << label(in.d) << ";\n";
+				out << "\tgoto " << label(next) << ";\n";
+			} break;
+			case OpCall:
+				spill();
+				out << "\tm.call(" << in.pc + 1 << "u);\n";
+				out << "\tgoto " << label(in.a) << ";\n";
+				break;
+			case OpRet:
+				spill();
+				if (m_returnSites.empty()) {
+					out << "\tLEAVE(m.ret());\n";
+					break;
+				}
+				out << "\tswitch (Byte to = m.ret()) {\n";
+				for (uint32_t site : m_returnSites) {
+					out << "\t\tcase " << site << ": goto " << label(site) << ";\n";
+				}
+				out << "\t\tdefault: LEAVE(to);\n\t}\n";
+				break;
+			case OpHalt:
+				spill();
+				out << "\tm.halt();\n\tLEAVE(" << next << ");\n";
+				break;
+			case OpWait: {
+				std::string n = value(pop());
+				spill();
+				out << "\tm.wait(" << n << ");\n\tLEAVE(" << next << ");\n";
+			} break;
+			case OpPutP:
+			case OpPutPM: {
+				std::string y = value(pop());
+				std::string x = value(pop());
+				spill();
+				std::string color = in.op == OpPutP ? std::to_string(in.a) + "u" : "data[" + std::to_string(in.a) + "]";
+				out << "\tvideo.put(" << x << ", " << y << ", " << color << ");\n";
+				leaveOrContinue(next);
+			} break;
+			case OpPutS: {
+				std::string y = value(pop());
+				std::string x = value(pop());
+				std::string frame = optional();
+				spill();
+				out << "\tif (spriteFits(" << in.a << "u, " << frame << ")) video.sprite(" << x << ", " << y << ", &data[" << in.a << "u + 64u * " << frame << "]);\n";
+				leaveOrContinue(next);
+			} break;
+			case OpSys: {
+				std::string color = optional();
+				spill();
+				out << "\tvideo.clear(" << color << ");\n";
+				leaveOrContinue(next);
+			} break;
+			default: break;
+		}
+	}
+
+	if (!ended) {
+		spill();
+		out << "\tgoto " << label(pc) << ";\n";
+	}
+	out << "}\n";
+}
+
+std::string Recompiler::generate(const std::string& name, const std::string& origin) {
+	std::ostringstream out;
+
+	auto words = [&](const std::vector<Byte>& list) {
+		for (size_t i = 0; i < list.size(); i++) {
+			if (i % 16 == 0) out << "\t";
+			out << list[i] << (i + 1 < list.size() ? "," : "");
+			out << ((i % 16 == 15 || i + 1 == list.size()) ? "\n" : " ");
+		}
+	};
+
+	out << "// Generated by console_recompile";
+	if (!origin.empty()) out << " from " << origin;
+	out << ". Do not edit.\n";
+	out << "#include \"native.h\"\n\n";
+	out << "namespace {\n\n";
+
+	out << "const Byte Code[] = {\n";
+	words(m_code.empty() ? std::vector<Byte>{ 0 } : m_code);
+	out << "};\n\n";
+
+	out << "const Byte Data[] = {\n";
+	words(m_data.empty() ? std::vector<Byte>{ 0 } : m_data);
+	out << "};\n\n";
+
+	out << "#define LEAVE(pc) do { m.leave(Byte(pc), cmp, cycles); return maxInstructions - left; } while (0)\n";
+	out << "#define BAIL(pc) do { m.bail(Byte(pc), cmp, cycles); return maxInstructions - left; } while (0)\n\n";
+
+	out << "uint64_t run(NativeMachine& m, uint64_t maxInstructions) {\n";
+	out << "\tuint64_t left = maxInstructions, cycles = 0;\n";
+	out << "\tuint32_t cmp = m.cmp();\n";
+	out << "\tByte* data = m.data();\n";
+	out << "\tVideo& video = m.video();\n";
+	out << "\t(void) data;\n";
+	out << "\t(void) video;\n\n";
+
+	out << "\tswitch (m.pc()) {\n";
+	for (uint32_t leader : m_leaders) {
+		out << "\t\tcase " << leader << ": goto " << label(leader) << ";\n";
+	}
+	out << "\t\tdefault: BAIL(m.pc());\n";
+	out << "\t}\n\n";
+
+	for (uint32_t leader : m_leaders) {
+		emitBlock(out, leader);
+	}
+
+	out << "}\n\n";
+	out << "#undef LEAVE\n";
+	out << "#undef BAIL\n\n";
+	out << "}\n\n";
+
+	out << "extern const NativeCart NativeCart_" << name << " = {\n";
+	out << "\t\"" << name << "\",\n";
+	out << "\tCode, " << m_code.size() << ",\n";
+	out << "\tData, " << m_data.size() << ",\n";
+	out << "\trun\n";
+	out << "};\n";
+	return out.str();
+}
@@ -0,0 +1,48 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include "console.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Ahead-of-time recompiler from assembled code to C++ (see native.h).
+ *
+ * Control flow is followed from address 0: every jump target, call
+ * target, return site and instruction after a jump becomes a basic block,
+ * and each block a `goto` label of a single run function. Inside a block
+ * the operand stack is tracked statically, so stack traffic turns into
+ * C++ locals; only what's left at the end of the block is pushed. Returns
+ * are resolved with a switch over the known return sites.
+ *
+ * Instructions it can't compile, and returns to unknown addresses, are
+ * left to the interpreter.
+*/
+class Recompiler {
+public:
+	Recompiler(const std::vector<Byte>& code, const std::vector<Byte>& data);
+	~Recompiler() = default;
+
+	/// Generates a translation unit defining `const NativeCart NativeCart_<name>`.
+	std::string generate(const std::string& name, const std::string& origin = "");
+
+private:
+	struct Instruction {
+		uint32_t pc, length;
+		Byte op, a, b, c, d;
+		bool native;
+	};
+
+	void discover();
+	bool decode(uint32_t pc, Instruction& in) const;
+	void emitBlock(std::ostream& out, uint32_t leader);
+
+	std::vector<Byte> m_code, m_data;
+	std::map<uint32_t, Instruction> m_instructions;
+	std::set<uint32_t> m_leaders, m_returnSites;
+};
+
+#endif // RECOMPILER_H
@@ -0,0 +1,190 @@
+#include "rewind.h"
+#include "savestate.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+	uint32_t word(const std::vector<uint8_t>& data, size_t index) {
+		uint32_t value;
+		std::memcpy(&value, data.data() + index * sizeof(uint32_t), sizeof(value));
+		return value;
+	}
+
+	void append(std::vector<uint8_t>& out, const void* data, size_t size) {
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		out.insert(out.end(), bytes, bytes + size);
+	}
+
+	/**
+	 * Packs a save state as runs of (zero word count, literal word count,
+	 * literal words). Most of a snapshot is empty memory, and a literal run
+	 * only ends at two zero words in a row.
+	*/
+	void pack(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+		assert(in.size() % sizeof(uint32_t) == 0);
+		out.clear();
+
+		const size_t count = in.size() / sizeof(uint32_t);
+		size_t i = 0;
+		while (i < count) {
+			size_t zeros = i;
+			while (i < count && word(in, i) == 0) i++;
+			zeros = i - zeros;
+
+			size_t begin = i;
+			while (i < count && !(word(in, i) == 0 && (i + 1 == count || word(in, i + 1) == 0))) i++;
+
+			uint32_t run[2] = { uint32_t(zeros), uint32_t(i - begin) };
+			append(out, run, sizeof(run));
+			append(out, in.data() + begin * sizeof(uint32_t), (i - begin) * sizeof(uint32_t));
+		}
+	}
+
+	void unpack(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+		out.clear();
+		size_t pos = 0;
+		while (pos < in.size()) {
+			uint32_t run[2];
+			std::memcpy(run, in.data() + pos, sizeof(run));
+			pos += sizeof(run);
+
+			out.resize(out.size() + run[0] * sizeof(uint32_t), 0);
+			append(out, in.data() + pos, run[1] * sizeof(uint32_t));
+			pos += run[1] * sizeof(uint32_t);
+		}
+	}
+}
+
+Rewind::Rewind(Console* console, size_t memoryCap)
+	: m_console(console), m_memoryCap(memoryCap)
+{}
+
+void Rewind::clear() {
+	m_keyframes.clear();
+	m_frameTicks.clear();
+	m_firstFrame = m_position = 0;
+	m_bytes = 0;
+	m_anchorFrame = m_baseFrame = UINT64_MAX;
+}
+
+void Rewind::record() {
+	const uint64_t frame = m_position++;
+	const uint64_t ticks = m_console->ticks();
+
+	if (frame < m_firstFrame + m_frameTicks.size()) {
+		// Replaying recorded frames after a seek.
+		if (m_frameTicks[frame - m_firstFrame] == ticks) return;
+		truncate(frame);
+	}
+
+	m_frameTicks.push_back(ticks);
+	m_bytes += sizeof(uint64_t);
+	if (frame % RewindKeyframeInterval == 0 || m_keyframes.empty()) addKeyframe(frame);
+	evict();
+}
+
+void Rewind::addKeyframe(uint64_t frame) {
+	uint32_t deltas = 0;
+	for (auto it = m_keyframes.rbegin(); it != m_keyframes.rend() && !it->anchor; ++it) deltas++;
+
+	Keyframe key{ frame, m_anchorFrame == UINT64_MAX || deltas + 1 >= RewindAnchorInterval, {} };
+	if (key.anchor) {
+		SaveState::save(*m_console, m_anchor);
+		m_anchorFrame = frame;
+		pack(m_anchor, m_state);
+	} else {
+		SaveState::saveDelta(*m_console, m_anchor, m_base);
+		m_baseFrame = UINT64_MAX;
+		pack(m_base, m_state);
+	}
+
+	key.packed.assign(m_state.begin(), m_state.end());
+	m_bytes += key.packed.size();
+	m_keyframes.push_back(std::move(key));
+}
+
+void Rewind::truncate(uint64_t frames) {
+	while (!m_keyframes.empty() && m_keyframes.back().frame >= frames) {
+		m_bytes -= m_keyframes.back().packed.size();
+		m_keyframes.pop_back();
+	}
+	while (m_firstFrame + m_frameTicks.size() > frames) {
+		m_frameTicks.pop_back();
+		m_bytes -= sizeof(uint64_t);
+	}
+
+	// If the anchor went, deltas from here on go against a new one.
+	if (m_anchorFrame != UINT64_MAX && m_anchorFrame >= frames) m_anchorFrame = UINT64_MAX;
+	if (m_baseFrame != UINT64_MAX && m_baseFrame >= frames) m_baseFrame = UINT64_MAX;
+}
+
+void Rewind::evict() {
+	while (m_bytes > m_memoryCap && m_keyframes.size() > 1) {
+		// Keep the newest anchor at least, the oldest one goes with its deltas.
+		auto next = std::find_if(m_keyframes.begin() + 1, m_keyframes.end(), [](const Keyframe& k) { return k.anchor; });
+		if (next == m_keyframes.end()) break;
+
+		for (auto it = m_keyframes.begin(); it != next; ++it) m_bytes -= it->packed.size();
+		if (m_baseFrame == m_keyframes.front().frame) m_baseFrame = UINT64_MAX;
+		m_keyframes.erase(m_keyframes.begin(), next);
+
+		while (m_firstFrame < m_keyframes.front().frame) {
+			m_frameTicks.pop_front();
+			m_bytes -= sizeof(uint64_t);
+			m_firstFrame++;
+		}
+	}
+}
+
+std::deque<Rewind::Keyframe>::const_iterator Rewind::keyframeFor(uint64_t frame) const {
+	auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), frame, [](uint64_t f, const Keyframe& k) {
+		return f < k.frame;
+	});
+	return it == m_keyframes.begin() ? m_keyframes.end() : std::prev(it);
+}
+
+bool Rewind::seek(uint64_t frame) {
+	if (frame < m_firstFrame || frame >= m_firstFrame + m_frameTicks.size()) return false;
+	auto key = keyframeFor(frame);
+	if (key == m_keyframes.end()) return false;
+
+	auto anchor = key;
+	while (!anchor->anchor) --anchor;
+	if (m_baseFrame != anchor->frame) {
+		unpack(anchor->packed, m_base);
+		m_baseFrame = anchor->frame;
+	}
+
+	bool loaded;
+	if (key == anchor) {
+		loaded = SaveState::load(*m_console, m_base);
+	} else {
+		unpack(key->packed, m_state);
+		loaded = SaveState::load(*m_console, m_state, &m_base);
+	}
+	if (!loaded) return false;
+
+	// Re-execute up to where the frame ended, dropping the frames drawn on the way.
+	Console& c = *m_console;
+	const uint64_t target = m_frameTicks[frame - m_firstFrame];
+	while (c.ticks() < target && !c.halted()) {
+		if (c.run(target - c.ticks()) == 0) break;
+		c.video().markAsNotDirty();
+	}
+	c.video().markAsNotDirty();
+
+	m_position = frame + 1;
+	return true;
+}
+
+RewindStats Rewind::stats() const {
+	RewindStats stats;
+	stats.keyframes = m_keyframes.size();
+	stats.anchors = std::count_if(m_keyframes.begin(), m_keyframes.end(), [](const Keyframe& k) { return k.anchor; });
+	stats.oldestFrame = m_firstFrame;
+	stats.frames = m_firstFrame + m_frameTicks.size();
+	stats.bytes = m_bytes;
+	return stats;
+}
@@ -0,0 +1,91 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "console.h"
+
+#include <deque>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t RewindDefaultMemory = 32u << 20;
+
+/// Frames between keyframes, and keyframes between full (anchor) snapshots.
+constexpr uint32_t RewindKeyframeInterval = 15;
+constexpr uint32_t RewindAnchorInterval = 16;
+
+struct RewindStats {
+	uint64_t keyframes{ 0 }, anchors{ 0 };
+	uint64_t oldestFrame{ 0 }, frames{ 0 };	// Frames that can be sought to: [oldestFrame, frames)
+	size_t bytes{ 0 };						// Memory held, counted against the cap
+};
+
+/**
+ * Records a session so it can be scrubbed back and forth.
+ *
+ * The console has no inputs, so a session is fully determined by its
+ * starting state and where the host cut it into frames. The recorder logs
+ * the tick count at the end of every frame and keeps a keyframe (a
+ * SaveState) every RewindKeyframeInterval frames: a full snapshot every
+ * RewindAnchorInterval keyframes, deltas against it in between, all packed
+ * by zero runs. Seeking restores the nearest keyframe before the target
+ * and re-executes ticks up to the end of the target frame, so at most
+ * RewindKeyframeInterval - 1 frames are replayed.
+ *
+ * When the recording goes over its memory cap, the oldest anchor goes with
+ * its deltas.
+ *
+ * Replay is exact: even OptsCycleCounter only changes at the instructions
+ * that name it (see namesCycleCounter()).
+*/
+class Rewind {
+public:
+	Rewind(Console* console, size_t memoryCap = RewindDefaultMemory);
+	~Rewind() = default;
+
+	/**
+	 * Records the end of a frame. Call it at the frame boundary, after the
+	 * frontend cleared the frame flag. Past a seek, frames that end where
+	 * they did before just move the position forward; the first one that
+	 * doesn't drops the recording past it.
+	*/
+	void record();
+
+	/// Restores the console to the end of `frame`. False if it's not recorded.
+	bool seek(uint64_t frame);
+
+	/// Frames recorded before the current position (the next record() is this frame).
+	uint64_t position() const { return m_position; }
+
+	/// Forgets the recording, next record() starts over from frame 0.
+	void clear();
+
+	RewindStats stats() const;
+
+private:
+	struct Keyframe {
+		uint64_t frame;
+		bool anchor;
+		std::vector<uint8_t> packed;
+	};
+
+	void addKeyframe(uint64_t frame);
+	void truncate(uint64_t frames);
+	void evict();
+
+	/// The keyframe to start replaying `frame` from.
+	std::deque<Keyframe>::const_iterator keyframeFor(uint64_t frame) const;
+
+	Console *m_console;
+	size_t m_memoryCap, m_bytes{ 0 };
+
+	std::deque<Keyframe> m_keyframes;
+	std::deque<uint64_t> m_frameTicks;	// Console::ticks() at the end of each frame from m_firstFrame on
+	uint64_t m_firstFrame{ 0 }, m_position{ 0 };
+
+	// Scratch space, kept around so recording and seeking don't allocate.
+	std::vector<uint8_t> m_anchor, m_state, m_base;
+	uint64_t m_anchorFrame{ UINT64_MAX }, m_baseFrame{ UINT64_MAX };
+};
+
+#endif // REWIND_H
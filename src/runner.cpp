@@ -0,0 +1,128 @@
+#include "runner.h"
+#include "headless.h"
+#include "cart.h"
+#include "hash.h"
+#include "native.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+	bool endsWith(const std::string& str, const std::string& suffix) {
+		return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	bool openCart(Cart& cart, const std::string& path, bool optimize) {
+		if (!endsWith(path, ".asm")) return cart.open(path);
+
+		std::ifstream in(path);
+		if (!in.good()) return false;
+		std::stringstream source;
+		source << in.rdbuf();
+
+		std::vector<uint8_t> image;
+		return buildCart(source.str(), optimize, image) && cart.open(std::move(image));
+	}
+}
+
+uint64_t frameHash(const Pixel* vram, int width, int height) {
+	uint64_t hash = FnvOffsetBasis;
+	for (int i = 0; i < width * height; i++) hash = fnv1aWord(hash, uint8_t(vram[i]));
+	return hash;
+}
+
+WorkPool::WorkPool(uint32_t threads) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	for (uint32_t i = 0; i < threads; i++) m_queues.emplace_back(new Queue());
+}
+
+bool WorkPool::pop(uint32_t worker, size_t& item) {
+	Queue& queue = *m_queues[worker];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.items.empty()) return false;
+	item = queue.items.back();
+	queue.items.pop_back();
+	return true;
+}
+
+bool WorkPool::steal(uint32_t worker, size_t& item) {
+	// Victims in turn from the next worker on, so thieves spread out.
+	for (uint32_t i = 1; i < m_queues.size(); i++) {
+		Queue& queue = *m_queues[(worker + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.items.empty()) continue;
+		item = queue.items.front();
+		queue.items.pop_front();
+		m_steals.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void WorkPool::run(size_t count, const std::function<void(size_t, uint32_t)>& task) {
+	const uint32_t workers = threads();
+	for (uint32_t w = 0; w < workers; w++) {
+		size_t begin = count * w / workers, end = count * (w + 1) / workers;
+		for (size_t i = end; i > begin; i--) m_queues[w]->items.push_back(i - 1);
+	}
+
+	auto work = [&](uint32_t worker) {
+		size_t item;
+		while (pop(worker, item) || steal(worker, item)) task(item, worker);
+	};
+
+	// The calling thread is worker 0.
+	std::vector<std::thread> threads;
+	for (uint32_t w = 1; w < workers; w++) threads.emplace_back(work, w);
+	work(0);
+	for (auto&& thread : threads) thread.join();
+}
+
+CartRun runCart(const std::string& path, const RunnerOptions& options) {
+	auto start = std::chrono::steady_clock::now();
+	CartRun result;
+	result.path = path;
+
+	std::unique_ptr<Console> console(new Console());
+	console->setEngine(options.engine);
+
+	Cart cart;
+	if (options.engine == EngineNative) {
+		const NativeCart* native = options.nativeCart ? options.nativeCart(path) : nullptr;
+		if (native) loadNativeCart(*console, *native);
+		result.loaded = native != nullptr;
+	} else if (openCart(cart, path, options.optimize)) {
+		cart.load(*console);
+		result.loaded = true;
+	}
+
+	if (result.loaded) {
+		CallbackSink hasher([&](uint64_t, const Pixel* vram, int width, int height) {
+			result.frameHashes.push_back(frameHash(vram, width, height));
+		});
+		Headless headless(console.get(), options.frameHashes ? &hasher : nullptr);
+		HeadlessStats stats = headless.runFrames(options.frames);
+		result.frames = stats.frames;
+		result.instructions = stats.instructions;
+		result.cycles = stats.cycles;
+		result.runSeconds = stats.seconds;
+		result.ramHash = fnv1a(console->ram().data().data(), sizeof(console->ram().data()));
+		result.vramHash = fnv1a(console->vram(), VideoSize * sizeof(Pixel));
+	}
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+std::vector<CartRun> runCarts(const std::vector<std::string>& paths, const RunnerOptions& options, WorkPool& pool) {
+	// Every task writes its own slot, the workers share nothing else.
+	std::vector<CartRun> results(paths.size());
+	pool.run(paths.size(), [&](size_t i, uint32_t worker) {
+		results[i] = runCart(paths[i], options);
+		results[i].worker = worker;
+	});
+	return results;
+}
@@ -0,0 +1,92 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include "console.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Fixed set of worker threads with a work-stealing queue each.
+ *
+ * run() deals the items out in contiguous runs, one per worker. A worker
+ * takes items from the back of its own queue and, once it's empty, steals
+ * from the front of the others', so workers that drew quick items help
+ * out with the slow ones instead of idling. No items are added while
+ * running, so a worker that finds every queue empty is done.
+*/
+class WorkPool {
+public:
+	/// `threads` workers, 0 for one per hardware thread.
+	WorkPool(uint32_t threads = 0);
+	~WorkPool() = default;
+
+	WorkPool(const WorkPool&) = delete;
+	WorkPool& operator =(const WorkPool&) = delete;
+
+	uint32_t threads() const { return uint32_t(m_queues.size()); }
+
+	/// Calls task(item, worker) for every item in [0, count) and returns once all of them are done.
+	void run(size_t count, const std::function<void(size_t, uint32_t)>& task);
+
+	/// Items taken from another worker's queue, since the pool was created.
+	uint64_t steals() const { return m_steals.load(std::memory_order_relaxed); }
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> items;
+	};
+
+	bool pop(uint32_t worker, size_t& item);
+	bool steal(uint32_t worker, size_t& item);
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::atomic<uint64_t> m_steals{ 0 };
+};
+
+struct NativeCart;
+
+struct RunnerOptions {
+	EngineType engine{ EngineThreaded };
+	bool optimize{ true };
+	uint64_t frames{ 600 };		// Frames to run each cart for (see Headless)
+	bool frameHashes{ false };	// Keep a frameHash() of every frame
+
+	// With EngineNative, the native cart built from the cart at a path, or
+	// null. Carts it has none for fail to load instead of running elsewhere.
+	const NativeCart* (*nativeCart)(const std::string& path){ nullptr };
+};
+
+/// How a cart ended up after running in its own console.
+struct CartRun {
+	std::string path;
+	bool loaded{ false };
+	uint64_t frames{ 0 }, instructions{ 0 }, cycles{ 0 };
+	uint64_t ramHash{ 0 }, vramHash{ 0 };	// FNV-1a of all of RAM and VRAM at the end
+	double seconds{ 0.0 };					// Wall time, loading included
+	double runSeconds{ 0.0 };				// Wall time of the frames alone
+	uint32_t worker{ 0 };
+	std::vector<uint64_t> frameHashes;		// If RunnerOptions::frameHashes
+};
+
+/// FNV-1a of a frame's palette indices, a byte per pixel whatever CONSOLE_VRAM_BPP is.
+uint64_t frameHash(const Pixel* vram, int width, int height);
+
+/**
+ * Loads the cart at `path` (a source if it ends in .asm, a binary cart
+ * otherwise) into a console of its own and runs it headless. Nothing is
+ * shared with other calls, so any number can run at once.
+*/
+CartRun runCart(const std::string& path, const RunnerOptions& options);
+
+/// Runs every cart in `paths` on the pool's workers, results in the same order.
+std::vector<CartRun> runCarts(const std::vector<std::string>& paths, const RunnerOptions& options, WorkPool& pool);
+
+#endif // RUNNER_H
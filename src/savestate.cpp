@@ -0,0 +1,232 @@
+#include "savestate.h"
+#include "hash.h"
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+	constexpr uint32_t ProgramPages = ProgramSize * sizeof(Byte) / SaveStatePageSize;
+
+	uint8_t* memoryPage(Console& console, uint32_t index) {
+		if (index < SaveStateRamPages) {
+			return reinterpret_cast<uint8_t*>(console.ram().map(0)) + index * SaveStatePageSize;
+		}
+		return reinterpret_cast<uint8_t*>(console.vram()) + (index - SaveStateRamPages) * SaveStatePageSize;
+	}
+
+	/// FNV-1a over 64-bit words of the memory of a full snapshot.
+	uint64_t hashMemory(const uint8_t* pages) {
+		uint64_t hash = FnvOffsetBasis;
+		for (uint32_t i = 0; i < SaveStatePages * SaveStatePageSize; i += sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, pages + i, sizeof(word));
+			hash = fnv1aWord(hash, word);
+		}
+		return hash;
+	}
+
+	template <typename T>
+	T read(const uint8_t* at) {
+		T value;
+		std::memcpy(&value, at, sizeof(T));
+		return value;
+	}
+
+	/// A checked save state: where its parts are, not copies of them.
+	struct StateView {
+		SaveStateHeader header;
+		SaveStateCpu cpu;
+		const uint8_t *stack, *callStack, *heap, *indices, *pages;
+	};
+
+	bool parse(const std::vector<uint8_t>& state, StateView& view) {
+		if (state.size() < sizeof(SaveStateHeader) + sizeof(SaveStateCpu)) return false;
+
+		SaveStateHeader& header = view.header;
+		SaveStateCpu& cpu = view.cpu;
+		header = read<SaveStateHeader>(state.data());
+		cpu = read<SaveStateCpu>(state.data() + sizeof(SaveStateHeader));
+		if (header.magic != SaveStateMagic || header.version != SaveStateVersion || header.layout != CONSOLE_VRAM_BPP) return false;
+		if (cpu.stackSize > StackSize || cpu.callStackSize > CallStackSize || cpu.heapBlocks > DataSize) return false;
+
+		size_t pos = sizeof(SaveStateHeader) + sizeof(SaveStateCpu);
+		view.stack = state.data() + pos;
+		pos += cpu.stackSize * 2 * sizeof(Byte);
+		view.callStack = state.data() + pos;
+		pos += cpu.callStackSize * sizeof(Byte);
+		view.heap = state.data() + pos;
+		pos += cpu.heapBlocks * 2 * sizeof(Byte);
+		if (header.memoryOffset != pos) return false;
+
+		const bool delta = header.flags & SaveStateDelta;
+		if (delta) {
+			if (header.pageCount > SaveStatePages) return false;
+			view.indices = state.data() + pos;
+			pos += header.pageCount * sizeof(uint32_t);
+		} else {
+			if (header.pageCount != SaveStatePages) return false;
+			view.indices = nullptr;
+		}
+		view.pages = state.data() + pos;
+		pos += size_t(header.pageCount) * SaveStatePageSize;
+		if (pos != state.size()) return false;
+
+		for (uint32_t i = 0; delta && i < header.pageCount; i++) {
+			if (read<uint32_t>(view.indices + i * sizeof(uint32_t)) >= SaveStatePages) return false;
+		}
+		for (uint32_t i = 0; i < cpu.stackSize; i++) {
+			if (read<Byte>(view.stack + (i * 2 + 1) * sizeof(Byte)) > 2) return false;
+		}
+		return cpu.cmpResult <= 2;
+	}
+}
+
+uint8_t* SaveState::writeState(Console& c, std::vector<uint8_t>& out, uint16_t flags, uint32_t pageCount) {
+	const auto& heap = c.m_heap.blocks();
+
+	SaveStateHeader header;
+	header.flags = flags;
+	header.pageCount = pageCount;
+	header.memoryOffset = uint32_t(sizeof(SaveStateHeader) + sizeof(SaveStateCpu)
+		+ (c.m_stack.size() * 2 + c.m_callStack.size() + heap.size() * 2) * sizeof(Byte));
+
+	SaveStateCpu cpu;
+	cpu.pc = c.m_pc;
+	cpu.waitTimer = c.m_waitTimer;
+	cpu.cmpResult = c.m_cmpResult;
+	cpu.halted = c.m_halted;
+	cpu.frameDone = c.m_video.dirty();
+	cpu.stackSize = c.m_stack.size();
+	cpu.callStackSize = c.m_callStack.size();
+	cpu.heapBlocks = Byte(heap.size());
+	cpu.ticks = c.m_ticks;
+	cpu.cycles = c.m_cycles;
+
+	size_t pageBytes = size_t(pageCount) * SaveStatePageSize;
+	if (flags & SaveStateDelta) pageBytes += pageCount * sizeof(uint32_t);
+	out.resize(header.memoryOffset + pageBytes);
+
+	uint8_t* at = out.data();
+	std::memcpy(at, &header, sizeof(header)); at += sizeof(header);
+	std::memcpy(at, &cpu, sizeof(cpu)); at += sizeof(cpu);
+	for (uint32_t i = 0; i < c.m_stack.size(); i++) {
+		Byte value[2] = { c.m_stack.data()[i].val, Byte(c.m_stack.data()[i].type) };
+		std::memcpy(at, value, sizeof(value)); at += sizeof(value);
+	}
+	std::memcpy(at, c.m_callStack.data(), c.m_callStack.size() * sizeof(Byte));
+	at += c.m_callStack.size() * sizeof(Byte);
+	for (auto&& block : heap) {
+		Byte value[2] = { block.first, block.second };
+		std::memcpy(at, value, sizeof(value)); at += sizeof(value);
+	}
+	return at;
+}
+
+void SaveState::save(Console& console, std::vector<uint8_t>& out) {
+	uint8_t* pages = writeState(console, out, 0, SaveStatePages);
+	for (uint32_t i = 0; i < SaveStatePages; i++) {
+		std::memcpy(pages + i * SaveStatePageSize, memoryPage(console, i), SaveStatePageSize);
+	}
+
+	uint64_t id = hashMemory(pages);
+	std::memcpy(out.data() + offsetof(SaveStateHeader, id), &id, sizeof(id));
+}
+
+bool SaveState::saveDelta(Console& console, const std::vector<uint8_t>& base, std::vector<uint8_t>& out) {
+	StateView view;
+	if (!parse(base, view) || (view.header.flags & SaveStateDelta)) {
+		out.clear();
+		return false;
+	}
+
+	std::array<uint32_t, SaveStatePages> changed;
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < SaveStatePages; i++) {
+		if (std::memcmp(memoryPage(console, i), view.pages + i * SaveStatePageSize, SaveStatePageSize) != 0) {
+			changed[count++] = i;
+		}
+	}
+
+	uint8_t* at = writeState(console, out, SaveStateDelta, count);
+	std::memcpy(at, changed.data(), count * sizeof(uint32_t));
+	at += count * sizeof(uint32_t);
+	for (uint32_t i = 0; i < count; i++) {
+		std::memcpy(at + i * SaveStatePageSize, memoryPage(console, changed[i]), SaveStatePageSize);
+	}
+	std::memcpy(out.data() + offsetof(SaveStateHeader, id), &view.header.id, sizeof(uint64_t));
+	return true;
+}
+
+bool SaveState::isDelta(const std::vector<uint8_t>& state) {
+	return state.size() >= sizeof(SaveStateHeader)
+		&& (read<SaveStateHeader>(state.data()).flags & SaveStateDelta);
+}
+
+bool SaveState::load(Console& c, const std::vector<uint8_t>& state, const std::vector<uint8_t>* base) {
+	StateView view, baseView;
+	if (!parse(state, view)) return false;
+
+	const bool delta = view.header.flags & SaveStateDelta;
+	if (delta) {
+		if (base == nullptr || !parse(*base, baseView) || (baseView.header.flags & SaveStateDelta)) return false;
+		if (baseView.header.id != view.header.id) return false;
+	}
+
+	// The heap goes through a fresh allocator first, which rejects overlapping blocks.
+	Allocator heap(DataSize);
+	for (uint32_t i = 0; i < view.cpu.heapBlocks; i++) {
+		Byte addr = read<Byte>(view.heap + i * 2 * sizeof(Byte));
+		Byte size = read<Byte>(view.heap + (i * 2 + 1) * sizeof(Byte));
+		if (!heap.reserve(addr, size)) return false;
+	}
+
+	// Nothing can fail from here on. Pages come from the delta, or else the full snapshot.
+	const StateView& full = delta ? baseView : view;
+	std::array<const uint8_t*, SaveStatePages> pages;
+	for (uint32_t i = 0; i < SaveStatePages; i++) {
+		pages[i] = full.pages + i * SaveStatePageSize;
+	}
+	for (uint32_t i = 0; delta && i < view.header.pageCount; i++) {
+		pages[read<uint32_t>(view.indices + i * sizeof(uint32_t))] = view.pages + i * SaveStatePageSize;
+	}
+
+	uint32_t progBegin = ProgramPages, progEnd = 0;
+	for (uint32_t i = 0; i < SaveStatePages; i++) {
+		uint8_t* dst = memoryPage(c, i);
+		if (i < ProgramPages) {
+			// Only code that actually changed is dropped by the engines.
+			if (std::memcmp(dst, pages[i], SaveStatePageSize) == 0) continue;
+			progBegin = std::min(progBegin, i);
+			progEnd = std::max(progEnd, i + 1);
+		}
+		std::memcpy(dst, pages[i], SaveStatePageSize);
+	}
+	if (progBegin < progEnd) {
+		const uint32_t wordsPerPage = SaveStatePageSize / sizeof(Byte);
+		c.invalidateProgram(uint16_t(progBegin * wordsPerPage), uint16_t(progEnd * wordsPerPage));
+	}
+
+	const SaveStateCpu& cpu = view.cpu;
+	c.m_pc = cpu.pc;
+	c.m_waitTimer = cpu.waitTimer;
+	c.m_cmpResult = Console::CmpResult(cpu.cmpResult);
+	c.m_halted = cpu.halted != 0;
+	c.m_ticks = cpu.ticks;
+	c.m_cycles = cpu.cycles;
+
+	c.m_stack.resize(cpu.stackSize);
+	for (uint32_t i = 0; i < cpu.stackSize; i++) {
+		c.m_stack.data()[i] = Console::Value(read<Byte>(view.stack + i * 2 * sizeof(Byte)),
+											 int(read<Byte>(view.stack + (i * 2 + 1) * sizeof(Byte))));
+	}
+	c.m_callStack.resize(cpu.callStackSize);
+	std::memcpy(c.m_callStack.data(), view.callStack, cpu.callStackSize * sizeof(Byte));
+	c.m_heap = heap;
+
+	if (cpu.frameDone) c.m_video.flip();
+	else c.m_video.markAsNotDirty();
+	c.m_video.damageAll();
+	return true;
+}
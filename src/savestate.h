@@ -0,0 +1,92 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "console.h"
+
+#include <vector>
+#include <cstdint>
+
+constexpr uint32_t SaveStateMagic = 0x53534346; // "FCSS"
+constexpr uint16_t SaveStateVersion = 1;
+
+/// Save states store memory in pages of this many bytes, deltas only the pages that changed.
+constexpr uint32_t SaveStatePageSize = 256;
+
+constexpr uint32_t SaveStateRamPages = RAM<RamSizeKB>::Size * sizeof(Byte) / SaveStatePageSize;
+#if CONSOLE_VRAM_BPP == 32
+constexpr uint32_t SaveStateVramPages = 0; // VRAM is part of the RAM
+#else
+constexpr uint32_t SaveStateVramPages = VideoSize * sizeof(Pixel) / SaveStatePageSize;
+#endif
+constexpr uint32_t SaveStatePages = SaveStateRamPages + SaveStateVramPages;
+
+static_assert(RAM<RamSizeKB>::Size * sizeof(Byte) % SaveStatePageSize == 0, "RAM must be made of whole pages");
+static_assert(VideoSize * sizeof(Pixel) % SaveStatePageSize == 0, "VRAM must be made of whole pages");
+
+enum SaveStateFlags {
+	SaveStateDelta = 1 << 0		// Only the pages that differ from the base snapshot
+};
+
+/**
+ * Save state layout, in host byte order:
+ * - SaveStateHeader
+ * - SaveStateCpu
+ * - the stack (value, Value::Type word pairs), the call stack and the
+ *   heap's used blocks (address, size word pairs)
+ * - memory at `memoryOffset`: every page of RAM and then VRAM for full
+ *   snapshots. Deltas store a list of `pageCount` page indices first,
+ *   followed by those pages.
+*/
+struct SaveStateHeader {
+	uint32_t magic{ SaveStateMagic };
+	uint16_t version{ SaveStateVersion };
+	uint16_t flags{ 0 };
+	uint32_t layout{ CONSOLE_VRAM_BPP };	// States only load into the memory layout they were taken with
+	uint32_t pageCount{ 0 };
+	uint32_t memoryOffset{ 0 };
+	uint32_t reserved{ 0 };
+	uint64_t id{ 0 };						// Hash of a full snapshot's memory, deltas hold the id of their base
+};
+
+struct SaveStateCpu {
+	Byte pc, waitTimer, cmpResult, halted;
+	Byte frameDone;							// Video::dirty()
+	Byte stackSize, callStackSize, heapBlocks;
+	uint64_t ticks, cycles;
+};
+
+/**
+ * Serializes the whole machine: CPU registers, both stacks, the data heap,
+ * RAM and VRAM. Memory is read in place through the console's views and
+ * written straight into the output buffer, whose storage is reused, so a
+ * delta against a recent full snapshot is cheap enough to take every
+ * frame.
+ *
+ * Engines, the native cart and the host video settings (viewport, damage)
+ * aren't part of the state. Allocator counters restart on load.
+*/
+class SaveState {
+public:
+	/// Writes a full snapshot of `console` to `out`.
+	static void save(Console& console, std::vector<uint8_t>& out);
+
+	/// Writes the state of `console` with only the pages that differ from
+	/// `base`, a full snapshot. False (and `out` empty) if `base` isn't one.
+	static bool saveDelta(Console& console, const std::vector<uint8_t>& base, std::vector<uint8_t>& out);
+
+	/**
+	 * Loads a full snapshot, or a delta along with the full snapshot it was
+	 * taken against. The state is checked before anything is written, so on
+	 * failure (malformed, another memory layout, wrong base) the console is
+	 * left as it was.
+	*/
+	static bool load(Console& console, const std::vector<uint8_t>& state, const std::vector<uint8_t>* base = nullptr);
+
+	static bool isDelta(const std::vector<uint8_t>& state);
+
+private:
+	/// Writes everything but the memory pages to `out`, sized for `pageCount` of them. Returns where the pages go.
+	static uint8_t* writeState(Console& c, std::vector<uint8_t>& out, uint16_t flags, uint32_t pageCount);
+};
+
+#endif // SAVESTATE_H
@@ -0,0 +1,80 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr auto FramePeriod = std::chrono::nanoseconds(1000000000 / ConsoleFrameRate);
+
+}
+
+Scheduler::Scheduler(Console* console)
+	: m_console(console), m_deadline(Clock::now())
+{}
+
+FrameReport Scheduler::runFrame() {
+	Console& c = *m_console;
+
+	FrameReport report{};
+	report.index = m_frameIndex++;
+
+	uint64_t budget = FrameCycleBudget - std::min(m_debt, FrameCycleBudget - 1);
+	uint64_t startCycles = c.cycles(), startTicks = c.ticks();
+	uint64_t used = 0;
+	while (used < budget && !c.halted() && !c.video().dirty()) {
+		// Guess how many ticks fit in what's left of the budget from the
+		// instruction mix seen so far, and run half of that, so a bad guess
+		// overshoots by little. Never more than one tick per remaining cycle.
+		uint64_t left = budget - used;
+		uint64_t ticks = std::max<uint64_t>(1, std::min<uint64_t>(left, uint64_t(double(left) * m_ticksPerCycle * 0.5)));
+		if (c.run(ticks) == 0) break;
+
+		used = c.cycles() - startCycles;
+		report.ticks = c.ticks() - startTicks;
+		if (used > 0) m_ticksPerCycle = double(report.ticks) / double(used);
+	}
+
+	report.cycles = used;
+	report.drawn = c.video().dirty() && report.ticks > 0;
+	m_debt = used > budget ? used - budget : 0;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stats.frames++;
+	m_stats.cycles += used;
+	if (used > budget) m_stats.overruns++;
+	m_cv.notify_all();
+	return report;
+}
+
+void Scheduler::waitForNextFrame() {
+	m_deadline += FramePeriod;
+
+	// Don't try to catch up after falling behind (a slow host, a debugger...).
+	Clock::time_point now = Clock::now();
+	if (m_deadline + FramePeriod < now) m_deadline = now;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv.wait_until(lock, m_deadline, [this]() { return m_stopped; });
+}
+
+uint64_t Scheduler::waitForFrame(uint64_t frames, std::chrono::milliseconds timeout) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv.wait_for(lock, timeout, [&]() { return m_stopped || m_stats.frames > frames; });
+	return m_stats.frames;
+}
+
+SchedulerStats Scheduler::stats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+void Scheduler::stop() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stopped = true;
+	m_cv.notify_all();
+}
+
+bool Scheduler::stopped() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stopped;
+}
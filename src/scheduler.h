@@ -0,0 +1,77 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "console.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+constexpr uint32_t ConsoleFrameRate = 60;
+
+/// Cycles the console may use per frame (see OpCycles), and per second.
+constexpr uint64_t FrameCycleBudget = 65536;
+constexpr uint64_t ConsoleClockRate = FrameCycleBudget * ConsoleFrameRate;
+
+struct FrameReport {
+	uint64_t index{ 0 }, cycles{ 0 }, ticks{ 0 };
+	bool drawn{ false };	// The cart finished drawing (the frame didn't end on the budget)
+
+	/// Share of the frame's cycle budget used, may be over 1 for the frame that overran it.
+	double usage() const { return double(cycles) / double(FrameCycleBudget); }
+};
+
+/// Totals since the scheduler was created.
+struct SchedulerStats {
+	uint64_t frames{ 0 }, cycles{ 0 }, overruns{ 0 };
+
+	double usage() const { return frames > 0 ? double(cycles) / double(frames * FrameCycleBudget) : 0.0; }
+};
+
+/**
+ * Paces a console at ConsoleFrameRate frames per second.
+ *
+ * Each frame gets FrameCycleBudget cycles. A frame ends when the cart draws,
+ * when it halts or when the budget runs out (a waiting cart spends its
+ * budget 1 cycle per tick, so it ends up there too); the thread then
+ * sleeps until the next frame is due instead of spinning. Cycles used past
+ * the budget are taken from the next frame.
+ *
+ * runFrame() and waitForNextFrame() are meant for the thread that owns the
+ * console. waitForFrame(), stats() and stop() may be called from any thread.
+*/
+class Scheduler {
+public:
+	Scheduler(Console* console);
+	~Scheduler() = default;
+
+	FrameReport runFrame();
+
+	/// Sleeps until the next frame is due, or stop() is called.
+	void waitForNextFrame();
+
+	/// Blocks until more than `frames` frames ran, `timeout` passed or stop()
+	/// is called. Returns the number of frames run so far.
+	uint64_t waitForFrame(uint64_t frames, std::chrono::milliseconds timeout);
+
+	SchedulerStats stats();
+
+	void stop();
+	bool stopped();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	Console *m_console;
+
+	Clock::time_point m_deadline;
+	uint64_t m_debt{ 0 }, m_frameIndex{ 0 };
+	double m_ticksPerCycle{ 0.5 };
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	SchedulerStats m_stats;
+	bool m_stopped{ false };
+};
+
+#endif // SCHEDULER_H
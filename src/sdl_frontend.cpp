@@ -0,0 +1,251 @@
+#include "sdl_frontend.h"
+#include "palette.h"
+#include "savestate.h"
+
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <string>
+
+SDLFrontend::SDLFrontend(Console* console, size_t rewindMemory)
+	: m_console(console), m_scheduler(console),
+	  m_frames({ std::vector<Pixel>(VideoSize), VideoDamage(ConsoleScreenWidth, ConsoleScreenHeight) }),
+	  m_rewind(console, rewindMemory), m_rewinding(rewindMemory > 0),
+	  m_pixels(VideoSize, 0)
+{}
+
+void SDLFrontend::upload(const Frame& frame) {
+	const VideoDamage& damage = frame.damage;
+	const int pitch = ConsoleScreenWidth * sizeof(uint32_t);
+
+	// Convert each band of consecutive damaged rows into m_pixels, which
+	// mirrors the texture, and upload it with one update.
+	int y = damage.top();
+	while (y < damage.bottom()) {
+		if (damage.row(y).empty()) {
+			y++;
+			continue;
+		}
+
+		int top = y, left = ConsoleScreenWidth, right = 0;
+		for (; y < damage.bottom() && !damage.row(y).empty(); y++) {
+			left = std::min(left, damage.row(y).begin);
+			right = std::max(right, damage.row(y).end);
+		}
+
+		uint32_t offset = left + top * ConsoleScreenWidth;
+		expandPalette(frame.vram.data() + offset, ConsoleScreenWidth, m_pixels.data() + offset, pitch, right - left, y - top);
+		m_convertedPixels += (right - left) * (y - top);
+
+		SDL_Rect rect = { left, top, right - left, y - top };
+		SDL_UpdateTexture(m_buffer, &rect, m_pixels.data() + offset, pitch);
+	}
+}
+
+void SDLFrontend::flip() {
+	// Frames without changes are never published, so when nothing new
+	// arrived there's nothing to convert or present.
+	bool fresh = m_frames.acquire();
+	if (fresh) {
+		upload(m_frames.front());
+		m_redraw = true;
+	}
+	if (!m_redraw) return;
+	if (!fresh) m_frames.duplicate();
+
+	SDL_RenderClear(m_renderer);
+	SDL_Rect dst = { 0, 0, ConsoleScreenWidth * PixelSize, ConsoleScreenHeight * PixelSize };
+	SDL_RenderCopy(m_renderer, m_buffer, nullptr, &dst);
+	SDL_RenderPresent(m_renderer);
+	m_redraw = false;
+}
+
+void SDLFrontend::publish() {
+	Video& video = m_console->video();
+	if (!video.dirty()) return;
+	video.markAsNotDirty();
+
+	// The tile layer reads data memory, which has no damage tracking, so
+	// the whole screen changes while it's on (and when it's turned off).
+	TileLayer layer;
+	bool layered = m_console->tileLayer(layer);
+	bool redraw = layered || m_layered;
+	m_layered = layered;
+	if (!redraw && video.damage().empty()) return;
+
+	// If the presenter hasn't picked up the last frame, it may get dropped
+	// and this one has to carry its changes too.
+	Frame& frame = m_frames.back();
+	frame.damage = video.damage();
+	if (redraw) frame.damage.addAll();
+	if (m_frames.pending()) frame.damage.merge(m_lastDamage);
+
+	const Pixel* pixels = m_console->composeFrame();
+	std::copy(pixels, pixels + VideoSize, frame.vram.begin());
+	m_lastDamage = frame.damage;
+	m_frames.publish();
+	video.resetDamage();
+}
+
+void SDLFrontend::saveState() {
+	SaveState::save(*m_console, m_state);
+	std::ofstream fs(SaveStateFile, std::ios::binary);
+	fs.write(reinterpret_cast<const char*>(m_state.data()), m_state.size());
+	if (fs.good()) std::cout << "Saved state to " << SaveStateFile << std::endl;
+	else std::cerr << "ERROR: Could not write \"" << SaveStateFile << "\"." << std::endl;
+}
+
+void SDLFrontend::loadState() {
+	std::ifstream fs(SaveStateFile, std::ios::binary);
+	m_state.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+	if (SaveState::load(*m_console, m_state)) {
+		// The recording can't replay into a different session.
+		m_rewind.clear();
+		std::cout << "Loaded state from " << SaveStateFile << std::endl;
+	} else std::cerr << "ERROR: \"" << SaveStateFile << "\" is not a save state of this console." << std::endl;
+}
+
+void SDLFrontend::seek(int64_t frames) {
+	RewindStats stats = m_rewind.stats();
+	if (stats.frames == 0) return;
+
+	int64_t target = int64_t(m_rewind.position()) - 1 + frames;
+	target = std::max<int64_t>(int64_t(stats.oldestFrame), std::min<int64_t>(target, int64_t(stats.frames) - 1));
+	m_rewind.seek(uint64_t(target));
+}
+
+void SDLFrontend::watch(const std::string& path, HotPatch* patcher) {
+	m_patcher = patcher;
+	m_watcher.reset(new SourceWatcher(path));
+}
+
+void SDLFrontend::hotPatch() {
+	std::string source;
+	SourceWatcher::Clock::time_point seen;
+	if (!m_watcher->poll(source, seen) || !m_patcher->patch(source)) return;
+
+	// The recording can't replay into different code.
+	m_rewind.clear();
+
+	const HotPatchStats& stats = m_patcher->stats();
+	double latency = std::chrono::duration<double, std::milli>(SourceWatcher::Clock::now() - seen).count();
+	std::cout << "Patched " << stats.words << " words in " << stats.milliseconds << " ms, " << latency << " ms after the save ("
+			  << stats.movedLabels << " labels moved, " << stats.relocated << " addresses relocated)" << std::endl;
+}
+
+void SDLFrontend::showStats() {
+	SchedulerStats stats = m_scheduler.stats();
+	uint64_t frames = stats.frames - m_shownStats.frames;
+	if (frames < ConsoleFrameRate) return;
+
+	SchedulerStats last{ frames, stats.cycles - m_shownStats.cycles, stats.overruns - m_shownStats.overruns };
+	uint64_t dropped = m_frames.dropped(), duplicated = m_frames.duplicated();
+
+	std::string title = "Console - " + std::to_string(int(last.usage() * 100.0 + 0.5)) + "% of cycle budget";
+	if (last.overruns > 0) title += ", " + std::to_string(last.overruns) + " frames over";
+	if (dropped > m_shownDropped) title += ", " + std::to_string(dropped - m_shownDropped) + " dropped";
+	if (duplicated > m_shownDuplicated) title += ", " + std::to_string(duplicated - m_shownDuplicated) + " duplicated";
+	SDL_SetWindowTitle(m_window, title.c_str());
+
+	m_shownStats = stats;
+	m_shownDropped = dropped;
+	m_shownDuplicated = duplicated;
+}
+
+bool SDLFrontend::run() {
+	if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+		return false;
+	}
+
+	m_window = SDL_CreateWindow(
+		"Console",
+		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		ConsoleScreenWidth * PixelSize, ConsoleScreenHeight * PixelSize,
+		SDL_WINDOW_SHOWN
+	);
+
+	if (m_window == nullptr) {
+		SDL_Quit();
+		return false;
+	}
+
+	m_renderer = SDL_CreateRenderer(
+		m_window,
+		-1,
+		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC
+	);
+
+	if (m_renderer == nullptr) {
+		SDL_Quit();
+		return false;
+	}
+
+	m_buffer = SDL_CreateTexture(
+		m_renderer,
+		SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_STATIC,
+		ConsoleScreenWidth, ConsoleScreenHeight
+	);
+
+	// The CPU thread owns the console: it is the only one to run it, touch
+	// the video state or read memory. Frames reach this thread through m_frames.
+	std::thread cpu([this]() {
+		while (!m_console->halted() && !m_scheduler.stopped()) {
+			m_scheduler.runFrame();
+			publish();
+			if (m_rewinding) m_rewind.record();
+			if (m_saveRequested.exchange(false)) saveState();
+			if (m_loadRequested.exchange(false)) loadState();
+			if (int64_t frames = m_seekRequest.exchange(0)) seek(frames);
+			m_scheduler.waitForNextFrame();
+			if (m_watcher) hotPatch();
+		}
+		m_scheduler.stop();
+	});
+
+	SDL_Event evt{};
+	uint64_t frames = 0;
+	while (!m_console->halted()) {
+		while (SDL_PollEvent(&evt)) {
+			switch (evt.type) {
+				case SDL_QUIT: m_console->halt(); m_scheduler.stop(); break;
+				case SDL_WINDOWEVENT: m_redraw = true; break;
+				case SDL_KEYDOWN: {
+					if (evt.key.keysym.sym == SDLK_F10) {
+						m_saveRequested = true;
+					} else if (evt.key.keysym.sym == SDLK_F9) {
+						m_loadRequested = true;
+					} else if (evt.key.keysym.sym == SDLK_LEFT && m_rewinding) {
+						m_seekRequest -= ConsoleFrameRate;
+					} else if (evt.key.keysym.sym == SDLK_RIGHT && m_rewinding) {
+						m_seekRequest += ConsoleFrameRate;
+					}
+				} break;
+				default: break;
+			}
+		}
+
+		// Sleep until the CPU thread ran a frame, waking up now and then for events.
+		frames = m_scheduler.waitForFrame(frames, std::chrono::milliseconds(10));
+		flip();
+		showStats();
+	}
+
+	m_scheduler.stop();
+	cpu.join();
+
+	std::cout << "Frames: " << m_frames.published() << " published, " << m_frames.presented() << " presented, "
+			  << m_frames.dropped() << " dropped, " << m_frames.duplicated() << " duplicated" << std::endl;
+	if (m_frames.presented() > 0) {
+		std::cout << "Converted " << (100.0 * m_convertedPixels) / (double(m_frames.presented()) * VideoSize)
+				  << "% of the screen per presented frame" << std::endl;
+	}
+
+	SDL_DestroyTexture(m_buffer);
+	SDL_DestroyRenderer(m_renderer);
+	SDL_DestroyWindow(m_window);
+	SDL_Quit();
+	return true;
+}
@@ -0,0 +1,89 @@
+#ifndef SDL_FRONTEND_H
+#define SDL_FRONTEND_H
+
+#if !__has_include("SDL2.h")
+#include "SDL2/SDL.h"
+#else
+#include "SDL2.h"
+#endif
+
+#include "console.h"
+#include "scheduler.h"
+#include "triplebuffer.h"
+#include "rewind.h"
+#include "hotpatch.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr const char* SaveStateFile = "state.dat";
+
+/**
+ * Windowed frontend. Runs the console on a CPU thread paced by a
+ * Scheduler, which hands finished frames over through a TripleBuffer, and
+ * presents them through an SDL renderer. Only the parts of the screen that
+ * changed are converted and uploaded. The window title shows how much
+ * of the frame cycle budget the cart uses and the frames dropped or
+ * duplicated in the handoff. F10 saves the machine state to SaveStateFile
+ * and F9 loads it back. The session is recorded, and the left and right
+ * arrows scrub it back and forth a second at a time. When watching a cart
+ * source, every save of it is patched into the running console.
+*/
+class SDLFrontend {
+public:
+	/// `rewindMemory` caps the session recording (see Rewind), 0 turns it off.
+	SDLFrontend(Console* console, size_t rewindMemory = RewindDefaultMemory);
+	~SDLFrontend() = default;
+
+	/// Patches the cart source at `path` into the console through `patcher` whenever it changes.
+	void watch(const std::string& path, HotPatch* patcher);
+
+	/// Opens the window and runs until the console halts or the window is closed.
+	bool run();
+
+private:
+	/// A finished frame, with the area changed since the last one the presenter acquired.
+	struct Frame {
+		std::vector<Pixel> vram;
+		VideoDamage damage;
+	};
+
+	void flip();
+	void upload(const Frame& frame);
+	void showStats();
+
+	// CPU thread
+	void publish();
+	void saveState();
+	void loadState();
+	void seek(int64_t frames);
+	void hotPatch();
+
+	Console *m_console;
+	Scheduler m_scheduler;
+	TripleBuffer<Frame> m_frames;
+	VideoDamage m_lastDamage;
+	bool m_layered{ false };
+	std::atomic<bool> m_saveRequested{ false }, m_loadRequested{ false };
+	std::vector<uint8_t> m_state;
+	Rewind m_rewind;
+	bool m_rewinding;
+	std::atomic<int64_t> m_seekRequest{ 0 };
+	HotPatch *m_patcher{ nullptr };
+	std::unique_ptr<SourceWatcher> m_watcher;
+
+	std::vector<uint32_t> m_pixels;
+	uint64_t m_convertedPixels{ 0 };
+	bool m_redraw{ true };
+
+	SchedulerStats m_shownStats;
+	uint64_t m_shownDropped{ 0 }, m_shownDuplicated{ 0 };
+
+	SDL_Window *m_window{ nullptr };
+	SDL_Renderer *m_renderer{ nullptr };
+	SDL_Texture *m_buffer{ nullptr };
+};
+
+#endif // SDL_FRONTEND_H
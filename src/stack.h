@@ -0,0 +1,42 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <array>
+#include <cstdint>
+#include <cassert>
+
+/**
+ * Fixed capacity stack with the std::stack interface. The storage lives
+ * inline, so the execution engines can work on data() directly.
+ * Pushing onto a full stack drops the value.
+*/
+template <typename T, uint32_t Capacity>
+class FixedStack {
+public:
+	void push(const T& value) {
+		if (m_size < Capacity) m_items[m_size++] = value;
+	}
+
+	void pop() { assert(m_size > 0 && "Stack underflow"); m_size--; }
+
+	T& top() { return m_items[m_size - 1]; }
+	const T& top() const { return m_items[m_size - 1]; }
+
+	bool empty() const { return m_size == 0; }
+	uint32_t size() const { return m_size; }
+	static constexpr uint32_t capacity() { return Capacity; }
+
+	void clear() { m_size = 0; }
+
+	T* data() { return m_items.data(); }
+	const T* data() const { return m_items.data(); }
+
+	/// Sets the number of items after they were written through data().
+	void resize(uint32_t size) { assert(size <= Capacity); m_size = size; }
+
+private:
+	std::array<T, Capacity> m_items;
+	uint32_t m_size{ 0 };
+};
+
+#endif // STACK_H
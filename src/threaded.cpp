@@ -0,0 +1,377 @@
+#include "threaded.h"
+
+#include <algorithm>
+
+namespace {
+
+// Handler slots, in the same order as the label table in dispatch().
+enum Handler {
+	HHalt = 0, HPush, HPushM, HPop, HWait,
+	HAdd, HSub, HMul, HDiv, HLsh, HRsh, HAnd, HOr, HXor, HNot, HInc, HDec,
+	HCmp, HCmpM,
+	HJmp, HJeq, HJne, HJgt, HJlt, HJge, HJle,
+	HCall, HRet,
+	HPutP, HPutPM, HPutS,
+	HSysClear,
+	HAddMI, HSubMI, HMulMI, HDivMI, HLshMI, HRshMI, HAndMI, HOrMI, HXorMI,
+	HCmpJeq, HCmpJne, HCmpJgt, HCmpJlt, HCmpJge, HCmpJle,
+	HCmpMJeq, HCmpMJne, HCmpMJgt, HCmpMJlt, HCmpMJge, HCmpMJle,
+	HNoop1, HNoop2,
+	HFallback,
+	HandlerCount
+};
+
+}
+
+ThreadedEngine::ThreadedEngine(Console* console)
+	: m_console(console), m_code(ProgramSize + 1),
+	  m_dirtyBegin(0), m_dirtyEnd(ProgramSize + 1)
+{}
+
+void ThreadedEngine::invalidate(uint32_t begin, uint32_t end) {
+	// An entry also depends on the operand words that follow it.
+	begin = begin > MaxOperandCount ? begin - MaxOperandCount : 0;
+	end = std::min(end, uint32_t(ProgramSize));
+	if (m_dirtyBegin >= m_dirtyEnd) {
+		m_dirtyBegin = begin;
+		m_dirtyEnd = end;
+	} else {
+		m_dirtyBegin = std::min(m_dirtyBegin, begin);
+		m_dirtyEnd = std::max(m_dirtyEnd, end);
+	}
+}
+
+void ThreadedEngine::decode(const void* const* handlers) {
+	Byte* prog = m_console->prog();
+	Byte* data = m_console->data();
+
+	for (uint32_t pc = m_dirtyBegin; pc < m_dirtyEnd; pc++) {
+		Insn& in = m_code[pc];
+		in.a.lit = 0;
+		in.b.lit = 0;
+		in.c.lit = 0;
+		in.cycles = 0;
+		in.handler = handlers[HFallback];
+
+		if (pc >= ProgramSize) continue;
+
+		Byte op = prog[pc];
+		if (pc + 1 + operandCount(op) > ProgramSize) continue;
+
+		Byte a = operandCount(op) > 0 ? prog[pc + 1] : 0;
+		Byte b = operandCount(op) > 1 ? prog[pc + 2] : 0;
+		Byte jump = operandCount(op) > 2 ? prog[pc + 3] : 0;
+		Byte target = operandCount(op) > 3 ? prog[pc + 4] : 0;
+		if (namesCycleCounter(op, a, b)) continue;
+
+		switch (op) {
+			case OpHalt: in.handler = handlers[HHalt]; break;
+			case OpPush: in.handler = handlers[HPush]; in.a.lit = a; break;
+			case OpPushM: in.handler = handlers[HPushM]; in.a.lit = a; break;
+			case OpWait: in.handler = handlers[HWait]; break;
+			case OpAdd: in.handler = handlers[HAdd]; break;
+			case OpSub: in.handler = handlers[HSub]; break;
+			case OpMul: in.handler = handlers[HMul]; break;
+			case OpDiv: in.handler = handlers[HDiv]; break;
+			case OpLsh: in.handler = handlers[HLsh]; break;
+			case OpRsh: in.handler = handlers[HRsh]; break;
+			case OpAnd: in.handler = handlers[HAnd]; break;
+			case OpOr: in.handler = handlers[HOr]; break;
+			case OpXor: in.handler = handlers[HXor]; break;
+			case OpNot: in.handler = handlers[HNot]; break;
+			case OpPop:
+			case OpInc:
+			case OpDec:
+			case OpPutPM:
+				if (a >= DataAddressable) break;
+				in.a.mem = data + a;
+				in.handler = handlers[op == OpPop ? HPop : op == OpInc ? HInc : op == OpDec ? HDec : HPutPM];
+				break;
+			case OpCmp:
+				if (a >= DataAddressable) break;
+				in.a.mem = data + a;
+				in.b.lit = b;
+				in.handler = handlers[HCmp];
+				break;
+			case OpCmpM:
+				if (a >= DataAddressable || b >= DataAddressable) break;
+				in.a.mem = data + a;
+				in.b.mem = data + b;
+				in.handler = handlers[HCmpM];
+				break;
+			case OpJmp: case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle:
+			case OpCall:
+				if (a >= ProgramSize) break;
+				in.a.target = &m_code[a];
+				in.handler = handlers[HJmp + (op - OpJmp)];
+				break;
+			case OpRet: in.handler = handlers[HRet]; break;
+			case OpPutP: in.handler = handlers[HPutP]; in.a.lit = a; break;
+			case OpPutS: in.handler = handlers[HPutS]; in.a.lit = a; break;
+			case OpSys:
+				// Sprite tables, flips and the heap go through Console::execute().
+				if (a == SysClearScreen) in.handler = handlers[HSysClear];
+				else if (a == SysDrawSprites || a == SysFlip || a == SysAlloc || a == SysFree) in.handler = handlers[HFallback];
+				else in.handler = handlers[HNoop2];
+				break;
+			case OpAddMI: case OpSubMI: case OpMulMI: case OpDivMI: case OpLshMI:
+			case OpRshMI: case OpAndMI: case OpOrMI: case OpXorMI:
+				if (a >= DataAddressable) break;
+				in.a.mem = data + a;
+				in.b.lit = op == OpLshMI || op == OpRshMI ? b & ShiftMask : b;
+				in.handler = handlers[HAddMI + (op - OpAddMI)];
+				break;
+			case OpCmpJ:
+			case OpCmpMJ:
+				if (a >= DataAddressable || jump < OpJeq || jump > OpJle || target >= ProgramSize) break;
+				if (op == OpCmpMJ && b >= DataAddressable) break;
+				in.a.mem = data + a;
+				if (op == OpCmpJ) in.b.lit = b;
+				else in.b.mem = data + b;
+				in.c.target = &m_code[target];
+				in.handler = handlers[(op == OpCmpJ ? HCmpJeq : HCmpMJeq) + (jump - OpJeq)];
+				break;
+			default: in.handler = handlers[HNoop1]; break;
+		}
+		if (in.handler != handlers[HFallback]) in.cycles = cycleCost(op);
+	}
+
+	m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+uint64_t ThreadedEngine::run(uint64_t maxInstructions) {
+	Console& c = *m_console;
+
+	uint64_t count = 0;
+	while (count < maxInstructions && !c.m_halted && !c.m_video.dirty()) {
+		if (c.m_waitTimer > 0) {
+			// Waiting ticks do nothing, burn them all at once.
+			Byte n = Byte(std::min<uint64_t>(c.m_waitTimer, maxInstructions - count));
+			c.m_waitTimer -= n;
+			c.m_ticks += n;
+			c.m_cycles += n;
+			count += n;
+		} else if (c.m_pc >= ProgramSize) {
+			c.tick();
+			count++;
+		} else {
+			count += dispatch(maxInstructions - count);
+		}
+	}
+	return count;
+}
+
+uint64_t ThreadedEngine::dispatch(uint64_t maxInstructions) {
+#if defined(__GNUC__)
+	static const void* const handlers[HandlerCount] = {
+		&&op_halt, &&op_push, &&op_pushm, &&op_pop, &&op_wait,
+		&&op_add, &&op_sub, &&op_mul, &&op_div, &&op_lsh, &&op_rsh,
+		&&op_and, &&op_or, &&op_xor, &&op_not, &&op_inc, &&op_dec,
+		&&op_cmp, &&op_cmpm,
+		&&op_jmp, &&op_jeq, &&op_jne, &&op_jgt, &&op_jlt, &&op_jge, &&op_jle,
+		&&op_call, &&op_ret,
+		&&op_putp, &&op_putpm, &&op_puts,
+		&&op_sysclear,
+		&&op_addmi, &&op_submi, &&op_mulmi, &&op_divmi, &&op_lshmi,
+		&&op_rshmi, &&op_andmi, &&op_ormi, &&op_xormi,
+		&&op_cmpjeq, &&op_cmpjne, &&op_cmpjgt, &&op_cmpjlt, &&op_cmpjge, &&op_cmpjle,
+		&&op_cmpmjeq, &&op_cmpmjne, &&op_cmpmjgt, &&op_cmpmjlt, &&op_cmpmjge, &&op_cmpmjle,
+		&&op_noop1, &&op_noop2,
+		&&op_fallback
+	};
+
+	using Value = Console::Value;
+
+	if (m_dirtyBegin < m_dirtyEnd) decode(handlers);
+
+	Console& c = *m_console;
+	Video& video = c.m_video;
+	Byte* data = c.data();
+	Insn* base = m_code.data();
+
+	// The stacks are kept in registers while dispatching, and written back
+	// before leaving or calling into the reference interpreter. Only
+	// verified programs get here (see Console::run()), so pushes, pops and
+	// calls never leave them.
+	Value* const stackBase = c.m_stack.data();
+	Value* sp = stackBase + c.m_stack.size();
+	Byte* const callBase = c.m_callStack.data();
+	Byte* csp = callBase + c.m_callStack.size();
+
+	Insn* ip = base + c.m_pc;
+	Console::CmpResult cmp = c.m_cmpResult;
+	uint64_t left = maxInstructions;
+	uint64_t cycles = 0;
+
+#define VAL(v) ((v).type == Value::Literal ? (v).val : data[(v).val])
+#define PUSH(v) (*sp++ = (v))
+#define POP(x) Byte x = VAL(sp[-1]); --sp
+#define NEXT(n) do { ip += (n); if (--left == 0) goto out; DISPATCH(); } while (0)
+#define DISPATCH() do { cycles += ip->cycles; goto *ip->handler; } while (0)
+#define EXIT(n) do { ip += (n); --left; goto out; } while (0)
+#define DRAWN(n) do { if (video.dirty()) EXIT(n); NEXT(n); } while (0)
+#define BINOP(label, op) label: { POP(a); POP(b); PUSH(Value(a op b, Value::Literal)); NEXT(1); }
+#define BRANCH(label, cond) label: { if (cond) { ip = ip->a.target; NEXT(0); } NEXT(2); }
+#define MEMIMM(label, op) label: { Byte* m = ip->a.mem; *m = *m op ip->b.lit; NEXT(3); }
+#define CMPBRANCH(label, y, cond) label: { Byte a = *ip->a.mem; Byte b = (y); COMPARE(a, b); if (cond) { ip = ip->c.target; NEXT(0); } NEXT(5); }
+#define COMPARE(x, y) cmp = (x) == (y) ? Console::CmpEquals : (x) > (y) ? Console::CmpGreater : Console::CmpLess
+#define SYNC_STACKS() do { c.m_stack.resize(uint32_t(sp - stackBase)); c.m_callStack.resize(uint32_t(csp - callBase)); } while (0)
+
+	DISPATCH();
+
+op_halt: c.m_halted = true; EXIT(1);
+op_push: PUSH(Value(ip->a.lit, Value::Literal)); NEXT(2);
+op_pushm: PUSH(Value(ip->a.lit, Value::MemoryAddr)); NEXT(2);
+op_pop: {
+	Byte value = VAL(sp[-1]);
+	*ip->a.mem = value;
+	--sp;
+	NEXT(2);
+}
+op_wait: {
+	POP(n);
+	c.m_waitTimer = n * 512;
+	if (c.m_waitTimer > 0) EXIT(1);
+	NEXT(1);
+}
+
+BINOP(op_add, +)
+BINOP(op_sub, -)
+BINOP(op_mul, *)
+op_div: { POP(a); POP(b); PUSH(Value(quotient(a, b), Value::Literal)); NEXT(1); }
+BINOP(op_and, &)
+BINOP(op_or, |)
+BINOP(op_xor, ^)
+
+op_lsh: { POP(a); POP(n); PUSH(Value(a << (n & ShiftMask), Value::Literal)); NEXT(1); }
+op_rsh: { POP(a); POP(n); PUSH(Value(a >> (n & ShiftMask), Value::Literal)); NEXT(1); }
+op_not: { POP(a); PUSH(Value(~a, Value::Literal)); NEXT(1); }
+op_inc: (*ip->a.mem)++; NEXT(2);
+op_dec: (*ip->a.mem)--; NEXT(2);
+
+op_cmp: { Byte mem = *ip->a.mem; Byte lit = ip->b.lit; COMPARE(mem, lit); NEXT(3); }
+op_cmpm: { Byte a = *ip->a.mem; Byte b = *ip->b.mem; COMPARE(a, b); NEXT(3); }
+
+op_jmp: ip = ip->a.target; NEXT(0);
+BRANCH(op_jeq, cmp == Console::CmpEquals)
+BRANCH(op_jne, cmp != Console::CmpEquals)
+BRANCH(op_jgt, cmp == Console::CmpGreater)
+BRANCH(op_jlt, cmp == Console::CmpLess)
+BRANCH(op_jge, cmp == Console::CmpGreater || cmp == Console::CmpEquals)
+BRANCH(op_jle, cmp == Console::CmpLess || cmp == Console::CmpEquals)
+
+op_call:
+	*csp++ = Byte(ip - base) + 1;
+	ip = ip->a.target;
+	NEXT(0);
+op_ret: {
+	// Same as the interpreter: return to the saved PC and skip the call operand.
+	Byte pc = *--csp + 1;
+	if (pc >= ProgramSize) {
+		c.m_pc = pc;
+		--left;
+		goto out_synced;
+	}
+	ip = base + pc;
+	NEXT(0);
+}
+
+op_putp: { POP(y); POP(x); video.put(x, y, ip->a.lit); DRAWN(2); }
+op_putpm: { POP(y); POP(x); video.put(x, y, *ip->a.mem); DRAWN(2); }
+op_puts: {
+	POP(y); POP(x);
+	Byte frame = 0;
+	if (sp != stackBase) {
+		POP(f);
+		frame = f;
+	}
+	if (spriteFits(ip->a.lit, frame)) video.sprite(x, y, &data[ip->a.lit + 64 * frame]);
+	DRAWN(2);
+}
+op_sysclear: {
+	Byte color = 0;
+	if (sp != stackBase) {
+		POP(f);
+		color = f;
+	}
+	video.clear(color);
+	DRAWN(2);
+}
+
+MEMIMM(op_addmi, +)
+MEMIMM(op_submi, -)
+MEMIMM(op_mulmi, *)
+op_divmi: { Byte* m = ip->a.mem; *m = quotient(*m, ip->b.lit); NEXT(3); }
+MEMIMM(op_lshmi, <<)
+MEMIMM(op_rshmi, >>)
+MEMIMM(op_andmi, &)
+MEMIMM(op_ormi, |)
+MEMIMM(op_xormi, ^)
+
+CMPBRANCH(op_cmpjeq, ip->b.lit, cmp == Console::CmpEquals)
+CMPBRANCH(op_cmpjne, ip->b.lit, cmp != Console::CmpEquals)
+CMPBRANCH(op_cmpjgt, ip->b.lit, cmp == Console::CmpGreater)
+CMPBRANCH(op_cmpjlt, ip->b.lit, cmp == Console::CmpLess)
+CMPBRANCH(op_cmpjge, ip->b.lit, cmp == Console::CmpGreater || cmp == Console::CmpEquals)
+CMPBRANCH(op_cmpjle, ip->b.lit, cmp == Console::CmpLess || cmp == Console::CmpEquals)
+CMPBRANCH(op_cmpmjeq, *ip->b.mem, cmp == Console::CmpEquals)
+CMPBRANCH(op_cmpmjne, *ip->b.mem, cmp != Console::CmpEquals)
+CMPBRANCH(op_cmpmjgt, *ip->b.mem, cmp == Console::CmpGreater)
+CMPBRANCH(op_cmpmjlt, *ip->b.mem, cmp == Console::CmpLess)
+CMPBRANCH(op_cmpmjge, *ip->b.mem, cmp == Console::CmpGreater || cmp == Console::CmpEquals)
+CMPBRANCH(op_cmpmjle, *ip->b.mem, cmp == Console::CmpLess || cmp == Console::CmpEquals)
+
+op_noop1: NEXT(1);
+op_noop2: NEXT(2);
+
+op_fallback:
+	c.m_pc = Byte(ip - base);
+	c.m_cmpResult = cmp;
+	SYNC_STACKS();
+	// The cycle counter must be current if the instruction reads it.
+	c.m_cycles += cycles + cycleCost(c.prog()[c.m_pc]);
+	cycles = 0;
+	c.execute();
+	cmp = c.m_cmpResult;
+	sp = stackBase + c.m_stack.size();
+	csp = callBase + c.m_callStack.size();
+	--left;
+	if (left == 0 || c.m_halted || c.m_waitTimer > 0 || video.dirty() || c.m_pc >= ProgramSize) {
+		goto out_synced;
+	}
+	ip = base + c.m_pc;
+	DISPATCH();
+
+out:
+	c.m_pc = Byte(ip - base);
+out_synced:
+	c.m_cmpResult = cmp;
+	SYNC_STACKS();
+	c.m_ticks += maxInstructions - left;
+	c.m_cycles += cycles;
+	return maxInstructions - left;
+
+#undef VAL
+#undef PUSH
+#undef POP
+#undef NEXT
+#undef DISPATCH
+#undef EXIT
+#undef DRAWN
+#undef BINOP
+#undef BRANCH
+#undef MEMIMM
+#undef CMPBRANCH
+#undef COMPARE
+#undef SYNC_STACKS
+#else
+	// No labels-as-values: run the reference interpreter instead.
+	Console& c = *m_console;
+	uint64_t count = 0;
+	while (count < maxInstructions && !c.m_halted && !c.m_video.dirty() && c.m_waitTimer == 0) {
+		c.tick();
+		count++;
+	}
+	return count;
+#endif
+}
@@ -0,0 +1,56 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "console.h"
+
+#include <vector>
+
+/**
+ * Direct-threaded execution engine.
+ *
+ * prog() is decoded into one Insn per program address: the handler is
+ * bound, literal operands are stored as values, memory operands as
+ * pointers into data() and jump targets as pointers into the stream.
+ * Dispatch jumps straight from one handler to the next (computed goto),
+ * with no opcode switch and no operand type checks. Entries are decoded
+ * again after Console::invalidateProgram().
+ *
+ * Anything the stream can't express (operands out of range, a PC outside
+ * of program memory) falls back to Console::execute(), so the results
+ * are always the same as the reference interpreter's. It only runs
+ * programs the verifier admitted (see verifier.h), so the stacks are
+ * used without any checks.
+*/
+class ThreadedEngine {
+public:
+	ThreadedEngine(Console* console);
+	~ThreadedEngine() = default;
+
+	/// Same contract as Console::run().
+	uint64_t run(uint64_t maxInstructions);
+
+	/// Marks program addresses [begin, end) as changed.
+	void invalidate(uint32_t begin, uint32_t end);
+
+private:
+	struct Insn {
+		const void* handler;
+		uint32_t cycles; // cost of the instruction, 0 for the fallback (Console::tick() counts those)
+		union Operand {
+			Byte lit;
+			Byte* mem;
+			Insn* target;
+		} a, b, c;
+	};
+
+	uint64_t dispatch(uint64_t maxInstructions);
+	void decode(const void* const* handlers);
+
+	Console *m_console;
+
+	// One entry per program address, plus a sentinel past the end.
+	std::vector<Insn> m_code;
+	uint32_t m_dirtyBegin, m_dirtyEnd;
+};
+
+#endif // THREADED_H
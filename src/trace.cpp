@@ -0,0 +1,63 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+	/// Records moved to the file at a time.
+	constexpr size_t TraceChunk = 4096;
+	constexpr auto TraceIdleSleep = std::chrono::milliseconds(1);
+}
+
+TraceRing::TraceRing(uint32_t capacity) {
+	uint64_t size = 1;
+	while (size < capacity) size <<= 1;
+	m_records.resize(size);
+	m_mask = size - 1;
+}
+
+size_t TraceRing::pop(TraceRecord* out, size_t max) {
+	uint64_t tail = m_tail.load(std::memory_order_relaxed);
+	size_t count = size_t(std::min<uint64_t>(m_head.load(std::memory_order_acquire) - tail, max));
+	for (size_t i = 0; i < count; i++) out[i] = m_records[(tail + i) & m_mask];
+	m_tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+TraceWriter::TraceWriter(TraceRing* ring, const std::string& path)
+	: m_ring(ring), m_out(path, std::ios::binary) {
+	TraceFileHeader header;
+	m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_good = m_out.good();
+	if (m_good) m_thread = std::thread(&TraceWriter::drain, this);
+}
+
+TraceWriter::~TraceWriter() {
+	stop();
+}
+
+bool TraceWriter::stop() {
+	if (m_thread.joinable()) {
+		m_stop = true;
+		m_thread.join();
+	}
+	return m_good;
+}
+
+void TraceWriter::drain() {
+	std::vector<TraceRecord> chunk(TraceChunk);
+	for (;;) {
+		// Checked before popping, so the records pushed until stop() are all written.
+		bool last = m_stop.load(std::memory_order_acquire);
+		size_t count = m_ring->pop(chunk.data(), chunk.size());
+		if (count > 0) {
+			m_out.write(reinterpret_cast<const char*>(chunk.data()), std::streamsize(count * sizeof(TraceRecord)));
+			m_written.fetch_add(count, std::memory_order_relaxed);
+			continue;
+		}
+		if (last) break;
+		std::this_thread::sleep_for(TraceIdleSleep);
+	}
+	m_out.flush();
+	m_good = m_out.good();
+}
@@ -0,0 +1,130 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Execution trace (console builds with CONSOLE_TRACE=1 only).
+ *
+ * A console with a TraceRing set (see Console::setTrace) interprets its
+ * program and pushes a TraceRecord for every instruction it executes,
+ * taken before the instruction runs. Ticks spent waiting aren't recorded,
+ * they show as gaps in the cycle counts. Pushing is a copy and a release
+ * store, nothing the console does waits on the reader, so tracing doesn't
+ * shift the timing the way printing from tick() would. A full ring drops
+ * records (see dropped()) rather than stall the console, and flags the
+ * record after the gap.
+ *
+ * A TraceWriter drains a ring to a file from a thread of its own, and
+ * console_trace decodes the file.
+ *
+ * Builds without CONSOLE_TRACE compile the hook out, Console::tick() and
+ * run() are then exactly what they were without it.
+*/
+
+/// Fixed size, so the file is the header followed by a plain array of them.
+struct TraceRecord {
+	uint64_t cycle;					// Console::cycles() before the instruction
+	uint16_t pc;
+	uint16_t stackDepth, callDepth;
+	uint8_t op;						// Clamped to 0xFF, OpHalt past program memory
+	uint8_t flags;					// TraceFlags
+	uint32_t operands[4];			// operandCount(op) of them, the rest 0
+};
+static_assert(sizeof(TraceRecord) == 32, "Trace records are 32 bytes");
+
+enum TraceFlags {
+	TraceAfterDrop = 1 << 0		// Records were dropped right before this one
+};
+
+constexpr uint32_t TraceMagic = 0x43525443;	// "CTRC"
+constexpr uint32_t TraceVersion = 1;
+
+struct TraceFileHeader {
+	uint32_t magic{ TraceMagic };
+	uint32_t version{ TraceVersion };
+	uint32_t recordSize{ sizeof(TraceRecord) };
+	uint32_t reserved{ 0 };
+};
+
+/// Records a ring holds by default, 2MB of them.
+constexpr uint32_t TraceDefaultCapacity = 1 << 16;
+
+/**
+ * Lock-free ring of trace records, for one producer (the thread running
+ * the console) and one consumer (the TraceWriter).
+*/
+class TraceRing {
+public:
+	/// `capacity` is rounded up to a power of two.
+	TraceRing(uint32_t capacity = TraceDefaultCapacity);
+
+	TraceRing(const TraceRing&) = delete;
+	TraceRing& operator =(const TraceRing&) = delete;
+
+	/// Producer: appends `record`, or drops it if the ring is full. The next record pushed after a drop is flagged TraceAfterDrop.
+	bool push(const TraceRecord& record) {
+		uint64_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			m_gap = true;
+			return false;
+		}
+		TraceRecord& slot = m_records[head & m_mask];
+		slot = record;
+		if (m_gap) slot.flags |= TraceAfterDrop;
+		m_gap = false;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer: moves up to `max` of the oldest records to `out`, returns how many.
+	size_t pop(TraceRecord* out, size_t max);
+
+	uint64_t pushed() const { return m_head.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<TraceRecord> m_records;
+	uint64_t m_mask;
+	bool m_gap{ false };	// Producer only
+
+	// Each side writes its own cache line
+	alignas(64) std::atomic<uint64_t> m_head{ 0 };
+	alignas(64) std::atomic<uint64_t> m_tail{ 0 };
+	std::atomic<uint64_t> m_dropped{ 0 };
+};
+
+/// Drains a TraceRing to a file on a thread of its own, until stop().
+class TraceWriter {
+public:
+	TraceWriter(TraceRing* ring, const std::string& path);
+	~TraceWriter();
+
+	TraceWriter(const TraceWriter&) = delete;
+	TraceWriter& operator =(const TraceWriter&) = delete;
+
+	bool good() const { return m_good; }
+
+	/// Writes what's left in the ring and stops the thread. False if the file couldn't be written.
+	bool stop();
+
+	uint64_t written() const { return m_written.load(std::memory_order_relaxed); }
+
+private:
+	void drain();
+
+	TraceRing* m_ring;
+	std::ofstream m_out;
+	bool m_good{ false };
+	std::atomic<bool> m_stop{ false };
+	std::atomic<uint64_t> m_written{ 0 };
+	std::thread m_thread;
+};
+
+#endif // TRACE_H
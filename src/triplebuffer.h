@@ -0,0 +1,80 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Lock-free triple buffer handing finished frames from the CPU thread
+ * (the only producer) to the presenter (the only consumer).
+ *
+ * The producer draws into back() and publish()es it, the consumer
+ * acquire()s the latest published frame and reads front(). The third
+ * buffer sits between them, swapped in and out with a single atomic
+ * exchange, so neither side ever waits for the other: a frame published
+ * before the last one was picked up replaces it (dropped), and the
+ * presenter keeps showing the old frame until a new one arrives (if it
+ * presents that frame again, it reports it with duplicate()).
+*/
+template <typename Frame>
+class TripleBuffer {
+public:
+	TripleBuffer(const Frame& initial = Frame()) {
+		m_buffers.fill(initial);
+	}
+
+	/// Producer: the buffer to write the next frame to.
+	Frame& back() { return m_buffers[m_back]; }
+
+	/// Producer: whether the last published frame hasn't been acquired yet.
+	/// If it's still pending by the next publish(), it will be dropped.
+	bool pending() const { return m_middle.load(std::memory_order_acquire) & Fresh; }
+
+	/// Producer: makes back() the latest frame, back() becomes another buffer.
+	void publish() {
+		uint8_t previous = m_middle.exchange(uint8_t(m_back | Fresh), std::memory_order_acq_rel);
+		m_back = previous & IndexMask;
+		m_published.fetch_add(1, std::memory_order_relaxed);
+		if (previous & Fresh) m_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Consumer: moves the latest published frame to front(). Returns false
+	 * (and front() keeps the frame it had) if nothing was published since
+	 * the last call.
+	*/
+	bool acquire() {
+		if (!(m_middle.load(std::memory_order_acquire) & Fresh)) return false;
+		uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+		m_front = previous & IndexMask;
+		m_presented.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/// Consumer: the latest acquired frame.
+	const Frame& front() const { return m_buffers[m_front]; }
+
+	/// Consumer: counts a presentation of front() that shows no new frame.
+	void duplicate() { m_duplicated.fetch_add(1, std::memory_order_relaxed); }
+
+	/// Frames published, frames picked up by acquire(), frames replaced
+	/// before they were picked up, and frames presented again (duplicate()).
+	uint64_t published() const { return m_published.load(std::memory_order_relaxed); }
+	uint64_t presented() const { return m_presented.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+	uint64_t duplicated() const { return m_duplicated.load(std::memory_order_relaxed); }
+
+private:
+	static constexpr uint8_t IndexMask = 0x3, Fresh = 0x4;
+
+	std::array<Frame, 3> m_buffers;
+
+	// Index of the middle buffer, with Fresh set if the consumer hasn't seen it.
+	std::atomic<uint8_t> m_middle{ 1 };
+	uint8_t m_back{ 0 }, m_front{ 2 };
+
+	std::atomic<uint64_t> m_published{ 0 }, m_presented{ 0 }, m_dropped{ 0 }, m_duplicated{ 0 };
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,187 @@
+#include "verifier.h"
+
+#include <algorithm>
+
+namespace {
+	bool inData(Byte addr) { return addr < DataAddressable; }
+}
+
+bool Verifier::fail(const char* error, uint32_t pc) {
+	m_error = error;
+	m_errorPc = pc;
+	return false;
+}
+
+uint32_t Verifier::context(uint32_t entry) {
+	if (m_contextAt[entry] < 0) {
+		m_contextAt[entry] = int32_t(m_contexts.size());
+		Context cx;
+		cx.entry = entry;
+		cx.body.resize(ProgramSize);
+		m_contexts.push_back(std::move(cx));
+	}
+	return uint32_t(m_contextAt[entry]);
+}
+
+bool Verifier::verify(const Byte* prog) {
+	m_prog = prog;
+	m_verified = false;
+	m_error = nullptr;
+	m_errorPc = 0;
+	m_depth.assign(ProgramSize, -1);
+	m_contextAt.assign(ProgramSize, -1);
+	m_contexts.clear();
+
+	m_depth[0] = 0;
+	context(0);
+	if (!walk(0, 0)) return false;
+	if (m_contexts[0].calls > CallStackSize) return fail("Calls nest deeper than the call stack", 0);
+
+	m_verified = true;
+	return true;
+}
+
+bool Verifier::walk(uint32_t index, uint32_t nesting) {
+	m_contexts[index].active = true;
+	const uint32_t entry = m_contexts[index].entry;
+	const int32_t entryDepth = m_depth[entry];
+
+	std::vector<uint32_t> work{ entry };
+	m_contexts[index].body[entry] = true;
+
+	// Marks `to` reachable with depth `depth`, every path to it must agree.
+	auto reach = [&](uint32_t from, uint32_t to, int32_t depth) {
+		if (to >= ProgramSize) return true; // Halts
+		if (m_depth[to] < 0) m_depth[to] = depth;
+		else if (m_depth[to] != depth) return fail("Stack depth differs between paths", from);
+		if (!m_contexts[index].body[to]) {
+			m_contexts[index].body[to] = true;
+			work.push_back(to);
+		}
+		return true;
+	};
+
+	while (!work.empty()) {
+		const uint32_t pc = work.back();
+		work.pop_back();
+
+		const int32_t depth = m_depth[pc];
+		const Byte op = m_prog[pc];
+		const uint32_t size = 1 + operandCount(op);
+		if (pc + size > ProgramSize) return fail("Instruction runs past program memory", pc);
+
+		const Byte a = size > 1 ? m_prog[pc + 1] : 0;
+		const Byte b = size > 2 ? m_prog[pc + 2] : 0;
+
+		int32_t pops = 0, pushes = 0;
+		bool memA = false, memB = false, fallsThrough = true;
+		switch (op) {
+			case OpHalt: fallsThrough = false; break;
+			case OpPush: pushes = 1; break;
+			case OpPushM: memA = true; pushes = 1; break;
+			case OpPop: memA = true; pops = 1; break;
+			case OpWait: pops = 1; break;
+			case OpAdd: case OpSub: case OpMul: case OpDiv:
+			case OpLsh: case OpRsh: case OpAnd: case OpOr: case OpXor:
+				pops = 2; pushes = 1; break;
+			case OpNot: pops = 1; pushes = 1; break;
+			case OpInc: case OpDec: case OpCmp: memA = true; break;
+			case OpCmpM: memA = memB = true; break;
+			case OpJmp:
+				fallsThrough = false;
+				if (!reach(pc, a, depth)) return false;
+				break;
+			case OpJeq: case OpJne: case OpJgt: case OpJlt: case OpJge: case OpJle:
+				if (!reach(pc, a, depth)) return false;
+				break;
+			case OpCall: {
+				if (a >= ProgramSize) return fail("Call out of program memory", pc);
+				if (m_depth[a] < 0) m_depth[a] = depth;
+				else if (m_depth[a] != depth) return fail("Subroutine called with different stack depths", pc);
+
+				const uint32_t sub = context(a);
+				if (m_contexts[sub].active) return fail("Recursive call", pc);
+				if (nesting >= CallStackSize) return fail("Calls nest deeper than the call stack", pc);
+				if (!m_contexts[sub].done && !walk(sub, nesting + 1)) return false;
+
+				const Context& callee = m_contexts[sub];
+				m_contexts[index].calls = std::max(m_contexts[index].calls, callee.calls + 1);
+				if (m_contexts[index].calls > CallStackSize) return fail("Calls nest deeper than the call stack", pc);
+
+				// A subroutine that never returns leaves nothing after the call to verify.
+				fallsThrough = false;
+				if (callee.returns && !reach(pc, pc + size, depth + callee.delta)) return false;
+			}	break;
+			case OpRet: {
+				fallsThrough = false;
+				if (index == 0) return fail("Return outside of a subroutine", pc);
+				Context& cx = m_contexts[index];
+				if (cx.returns && cx.delta != depth - entryDepth) return fail("Subroutine returns with different stack depths", pc);
+				cx.returns = true;
+				cx.delta = depth - entryDepth;
+			}	break;
+			case OpPutP: pops = 2; break;
+			case OpPutPM: memA = true; pops = 2; break;
+			case OpPutS:
+				// The frame is only popped if there's one on the stack.
+				pops = depth > 2 ? 3 : 2;
+				if (a > DataAddressable - SpriteSize * SpriteSize) return fail("Sprite out of data memory", pc);
+				break;
+			case OpSys:
+				switch (a) {
+					case SysClearScreen: pops = depth > 0 ? 1 : 0; break;
+					case SysDrawSprites: pops = 2; break;
+					case SysAlloc: pops = 1; pushes = 1; break;
+					case SysFree: pops = 1; break;
+					default: break;
+				}
+				break;
+			case OpAddMI: case OpSubMI: case OpMulMI: case OpDivMI: case OpLshMI:
+			case OpRshMI: case OpAndMI: case OpOrMI: case OpXorMI:
+				memA = true;
+				break;
+			case OpCmpJ:
+			case OpCmpMJ: {
+				memA = true;
+				memB = op == OpCmpMJ;
+				// Anything but a jump opcode is never taken.
+				const Byte jump = m_prog[pc + 3];
+				if (jump >= OpJeq && jump <= OpJle && !reach(pc, m_prog[pc + 4], depth)) return false;
+			}	break;
+			default: break; // Unknown opcodes do nothing
+		}
+
+		if ((memA && !inData(a)) || (memB && !inData(b))) return fail("Memory operand out of data memory", pc);
+		if (depth < pops) return fail("Stack underflow", pc);
+		if (depth - pops + pushes > int32_t(StackSize)) return fail("Stack overflow", pc);
+		if (fallsThrough && !reach(pc, pc + size, depth - pops + pushes)) return false;
+	}
+
+	m_contexts[index].active = false;
+	m_contexts[index].done = true;
+	return true;
+}
+
+bool Verifier::admits(const Console& console) const {
+	if (!m_verified) return false;
+
+	const Byte pc = console.m_pc;
+	if (pc >= ProgramSize) return true; // Halts before executing anything
+	if (m_depth[pc] != int32_t(console.m_stack.size())) return false;
+
+	for (uint32_t i = 0; i < console.m_stack.size(); i++) {
+		const Console::Value& v = console.m_stack.data()[i];
+		if (v.type != Console::Value::Literal && !inData(v.val)) return false;
+	}
+
+	// Each return address must follow a call made from the subroutine
+	// below it, and the PC must be in the innermost one.
+	uint32_t index = 0;
+	for (uint32_t i = 0; i < console.m_callStack.size(); i++) {
+		const Byte site = console.m_callStack.data()[i] - 1;
+		if (site >= ProgramSize - 1 || !m_contexts[index].body[site] || m_prog[site] != OpCall) return false;
+		index = uint32_t(m_contextAt[m_prog[site + 1]]);
+		if (i + 1 + m_contexts[index].calls > CallStackSize) return false;
+	}
+	return m_contexts[index].body[pc];
+}
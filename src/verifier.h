@@ -0,0 +1,76 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "console.h"
+
+#include <vector>
+
+/**
+ * Load-time bytecode verifier.
+ *
+ * Follows the control flow of prog() from PC 0 with empty stacks, one
+ * subroutine (call target) at a time, and proves what the unchecked
+ * execution paths take for granted:
+ *
+ *  - every reachable instruction fits in program memory,
+ *  - memory operands (and the words puts reads for frame 0) are inside
+ *    data memory,
+ *  - the operand stack has a single depth at each instruction, never
+ *    underflows and never outgrows StackSize,
+ *  - `ret` only runs inside a subroutine, every `ret` of a subroutine
+ *    leaves the stack at the same depth, calls don't recurse and never
+ *    nest deeper than CallStackSize.
+ *
+ * The puts frame comes from the stack at run time, so it is the one
+ * thing left to check while running (see spriteFits()).
+ *
+ * A console in the middle of a run (after a hot patch or a loaded save
+ * state) is only trusted if admits() finds its PC, stacks and return
+ * addresses where the proof expects them.
+*/
+class Verifier {
+public:
+	Verifier() = default;
+	~Verifier() = default;
+
+	/// Verifies ProgramSize words of program. False if they can't be proven safe, see error().
+	bool verify(const Byte* prog);
+
+	/// Whether `console` can continue unchecked: its program is verified and its state is one the proof covers.
+	bool admits(const Console& console) const;
+
+	bool verified() const { return m_verified; }
+
+	/// Why the last verify() failed, and the address of the instruction.
+	const char* error() const { return m_error; }
+	uint32_t errorPc() const { return m_errorPc; }
+
+private:
+	/// The code reachable from PC 0 or from a call target, up to its returns.
+	struct Context {
+		uint32_t entry{ 0 };
+		int32_t delta{ 0 };		// Stack depth change from the entry to its returns
+		uint32_t calls{ 0 };	// Deepest nesting of calls it makes
+		bool returns{ false }, active{ false }, done{ false };
+		std::vector<bool> body;	// Instructions in it, by address
+	};
+
+	/// Walks the context m_contexts[index], `nesting` calls deep. False on the first failure.
+	bool walk(uint32_t index, uint32_t nesting);
+
+	/// Context of the subroutine at `entry`, added if it's new.
+	uint32_t context(uint32_t entry);
+
+	bool fail(const char* error, uint32_t pc);
+
+	const Byte* m_prog{ nullptr };
+	bool m_verified{ false };
+	const char* m_error{ nullptr };
+	uint32_t m_errorPc{ 0 };
+
+	std::vector<int32_t> m_depth;		// Stack depth at each instruction, -1 if unreachable
+	std::vector<int32_t> m_contextAt;	// Index into m_contexts of each call target, -1 for none
+	std::vector<Context> m_contexts;	// 0 is the code reachable from PC 0
+};
+
+#endif // VERIFIER_H
@@ -1,11 +1,55 @@
 #include "video.h"
 
 #include <cstring>
+#include <algorithm>
 
-Video::Video(Byte* vram, uint16_t vramSize, int videoWidth, int videoHeight)
-	: m_vram(vram), m_vramSize(vramSize), m_videoWidth(videoWidth), m_videoHeight(videoHeight)
+VideoDamage::VideoDamage(int width, int height)
+	: m_rows(height), m_width(width)
+{
+	reset();
+}
+
+void VideoDamage::addSpan(int y, int begin, int end) {
+	if (begin >= end) return;
+	Span& span = m_rows[y];
+	span.begin = std::min(span.begin, begin);
+	span.end = std::max(span.end, end);
+	m_top = std::min(m_top, y);
+	m_bottom = std::max(m_bottom, y + 1);
+}
+
+void VideoDamage::addAll() {
+	for (auto&& span : m_rows) span = { 0, m_width };
+	m_top = 0;
+	m_bottom = int(m_rows.size());
+}
+
+void VideoDamage::merge(const VideoDamage& other) {
+	for (int y = other.m_top; y < other.m_bottom; y++) {
+		addSpan(y, other.m_rows[y].begin, other.m_rows[y].end);
+	}
+}
+
+void VideoDamage::reset() {
+	for (auto&& span : m_rows) span = { m_width, 0 };
+	m_top = int(m_rows.size());
+	m_bottom = 0;
+}
+
+uint32_t VideoDamage::area() const {
+	uint32_t area = 0;
+	for (int y = m_top; y < m_bottom; y++) {
+		if (!m_rows[y].empty()) area += m_rows[y].end - m_rows[y].begin;
+	}
+	return area;
+}
+
+Video::Video(Pixel* vram, uint16_t vramSize, int videoWidth, int videoHeight)
+	: m_vram(vram), m_vramSize(vramSize), m_damage(videoWidth, videoHeight),
+	  m_videoWidth(videoWidth), m_videoHeight(videoHeight)
 {
 	assert(vram != nullptr && "Invalid VRAM");
+	m_damage.addAll();
 	m_viewport[0] = 0;
 	m_viewport[1] = 0;
 	m_viewport[2] = videoWidth;
@@ -13,7 +57,43 @@ Video::Video(Byte* vram, uint16_t vramSize, int videoWidth, int videoHeight)
 }
 
 void Video::clear(uint8_t color) {
-	std::memset(m_vram, color, m_vramSize * sizeof(Byte));
+	Pixel fill;
+	std::memset(&fill, color, sizeof(Pixel));
+
+	// Only the pixels that don't hold the fill value yet are damaged.
+	for (int y = 0; y < m_videoHeight; y++) {
+		const Pixel* row = m_vram + y * m_videoWidth;
+		int begin = 0, end = m_videoWidth;
+		while (begin < end && row[begin] == fill) begin++;
+		while (end > begin && row[end - 1] == fill) end--;
+		m_damage.addSpan(y, begin, end);
+	}
+	std::memset(m_vram, color, m_vramSize * sizeof(Pixel));
+}
+
+void Video::compose(Pixel* out, const TileLayer& layer) const {
+	const uint32_t width = layer.mapWidth * SpriteSize, height = layer.mapHeight * SpriteSize;
+	const uint32_t left = layer.scrollX % width;
+
+	for (int y = 0; y < m_videoHeight; y++) {
+		const Pixel* src = m_vram + y * m_videoWidth;
+		Pixel* dst = out + y * m_videoWidth;
+
+		uint32_t by = uint32_t((uint64_t(y) + layer.scrollY) % height);
+		const Byte* mapRow = layer.map + (by / SpriteSize) * layer.mapWidth;
+		uint32_t tileRow = (by % SpriteSize) * SpriteSize;
+
+		uint32_t bx = left;
+		for (int x = 0; x < m_videoWidth; x++) {
+			if (uint8_t(src[x]) != layer.key) {
+				dst[x] = src[x];
+			} else {
+				Byte tile = mapRow[bx / SpriteSize];
+				dst[x] = tile < layer.tileCount ? uint8_t(layer.tiles[tile * SpriteSize * SpriteSize + tileRow + bx % SpriteSize]) : 0;
+			}
+			if (++bx == width) bx = 0;
+		}
+	}
 }
 
 void Video::viewport(int x, int y, int w, int h) {
@@ -34,15 +114,44 @@ void Video::put(int x, int y, uint8_t color) {
 	if (x < m_viewport[0] || x >= m_viewport[2] ||
 		y < m_viewport[1] || y >= m_viewport[3])
 		return;
-	m_vram[x + y * m_videoWidth] = color;
+	Pixel& pixel = m_vram[x + y * m_videoWidth];
+	if (pixel != color) {
+		pixel = color;
+		m_damage.add(x, y);
+	}
 	m_dirty = true;
 }
 
-void Video::sprite(int x, int y, Byte* data) {
-	for (uint32_t sy = 0; sy < SpriteSize; sy++) {
-		for (uint32_t sx = 0; sx < SpriteSize; sx++) {
-			uint32_t si = sx + sy * SpriteSize;
-			put(x+sx, y+sy, data[si]);
+void Video::blit(int x, int y, const Byte* data, uint32_t flags) {
+	int left = int(std::clamp<int64_t>(int64_t(m_viewport[0]) - x, 0, SpriteSize));
+	int right = int(std::clamp<int64_t>(int64_t(m_viewport[2]) - x, 0, SpriteSize));
+	int top = int(std::clamp<int64_t>(int64_t(m_viewport[1]) - y, 0, SpriteSize));
+	int bottom = int(std::clamp<int64_t>(int64_t(m_viewport[3]) - y, 0, SpriteSize));
+	if (left >= right || top >= bottom) return;
+
+	const bool transparent = flags & SpriteTransparent;
+	const uint8_t key = uint8_t(flags >> SpriteKeyShift);
+	const int stepX = flags & SpriteFlipX ? -1 : 1;
+	bool drawn = false;
+
+	for (int sy = top; sy < bottom; sy++) {
+		const Byte* src = data + (flags & SpriteFlipY ? SpriteSize - 1 - sy : sy) * SpriteSize;
+		src += flags & SpriteFlipX ? SpriteSize - 1 - left : left;
+		Pixel* dst = m_vram + (y + sy) * m_videoWidth + (x + left);
+
+		int begin = right, end = left;
+		for (int sx = left; sx < right; sx++, src += stepX, dst++) {
+			uint8_t color = uint8_t(*src);
+			if (transparent && color == key) continue;
+			drawn = true;
+			if (*dst != color) {
+				*dst = color;
+				begin = std::min(begin, sx);
+				end = sx + 1;
+			}
 		}
+		if (begin < end) m_damage.addSpan(y + sy, x + begin, x + end);
 	}
+
+	if (drawn) m_dirty = true;
 }
@@ -6,12 +6,103 @@
 #include <cstdint>
 #include <cassert>
 #include <queue>
+#include <vector>
+
+// Bits per VRAM pixel. 8 packs a pixel per byte, outside the 32-bit RAM;
+// 32 keeps the original layout with VRAM inside it, one word per pixel.
+#ifndef CONSOLE_VRAM_BPP
+#define CONSOLE_VRAM_BPP 8
+#endif
+
+#if CONSOLE_VRAM_BPP == 8
+using Pixel = uint8_t;
+#elif CONSOLE_VRAM_BPP == 32
+using Pixel = Byte;
+#else
+#error "CONSOLE_VRAM_BPP must be 8 or 32"
+#endif
 
 constexpr uint32_t SpriteSize = 8;
 
+enum SpriteFlags {
+	SpriteFlipX = 1 << 0,		// Mirrors the sprite horizontally
+	SpriteFlipY = 1 << 1,		// Mirrors the sprite vertically
+	SpriteTransparent = 1 << 2	// Skips the pixels of the color key, bits 8-15 of the flags
+};
+constexpr uint32_t SpriteKeyShift = 8;
+
+constexpr uint8_t PALETTE[][3] = {
+	{  21,  25,  26 },
+	{ 138,  76,  88 },
+	{ 217,  98, 117 },
+	{ 230, 184, 193 },
+	{  69, 107, 115 },
+	{  75, 151, 166 },
+	{ 165, 189, 194 },
+	{ 255, 245, 247 }
+};
+
+/**
+ * Screen area changed since the last reset(), as one span of columns per
+ * row. A span covers everything between the leftmost and rightmost change
+ * of its row, so it's a superset of what actually changed.
+*/
+class VideoDamage {
+public:
+	struct Span {
+		int begin, end;
+		bool empty() const { return begin >= end; }
+	};
+
+	VideoDamage(int width, int height);
+
+	VideoDamage() = default;
+	~VideoDamage() = default;
+
+	void add(int x, int y) {
+		Span& span = m_rows[y];
+		if (x < span.begin) span.begin = x;
+		if (x >= span.end) span.end = x + 1;
+		if (y < m_top) m_top = y;
+		if (y >= m_bottom) m_bottom = y + 1;
+	}
+	void addSpan(int y, int begin, int end);
+	void addAll();
+	void merge(const VideoDamage& other);
+	void reset();
+
+	bool empty() const { return m_top >= m_bottom; }
+
+	/// Damaged rows are in [top(), bottom()).
+	int top() const { return m_top; }
+	int bottom() const { return m_bottom; }
+	const Span& row(int y) const { return m_rows[y]; }
+
+	/// Number of pixels covered by the spans.
+	uint32_t area() const;
+
+private:
+	std::vector<Span> m_rows;
+	int m_width{ 0 }, m_top{ 0 }, m_bottom{ 0 };
+};
+
+/**
+ * Background layer composed under VRAM when a frame is presented: a map of
+ * tile indices, each tile 8x8 words in the puts sprite format, scrolled
+ * with wrap-around. VRAM pixels of the color key let it show through.
+*/
+struct TileLayer {
+	const Byte* map;
+	const Byte* tiles;
+	uint32_t mapWidth, mapHeight;	// In tiles
+	uint32_t tileCount;				// Tiles past this are drawn with color 0
+	uint32_t scrollX, scrollY;		// In pixels
+	uint8_t key;
+};
+
 class Video {
 public:
-	Video(Byte* vram, uint16_t vramSize, int videoWidth, int videoHeight);
+	Video(Pixel* vram, uint16_t vramSize, int videoWidth, int videoHeight);
 
 	Video() = default;
 	~Video() = default;
@@ -19,7 +110,19 @@ public:
 	void clear(uint8_t color = 0);
 
 	void put(int x, int y, uint8_t color);
-	void sprite(int x, int y, Byte* data);
+
+	/// Draws an 8x8 sprite, opaque and unflipped.
+	void sprite(int x, int y, const Byte* data) { blit(x, y, data, 0); }
+
+	/// Draws an 8x8 sprite (one color per word, row by row) with SpriteFlags.
+	/// Same result as put() for each pixel, but clipped once for the whole sprite.
+	void blit(int x, int y, const Byte* data, uint32_t flags);
+
+	/// Ends the frame without drawing anything.
+	void flip() { m_dirty = true; }
+
+	/// Writes VRAM composed over `layer` to `out`, a VRAM-sized buffer.
+	void compose(Pixel* out, const TileLayer& layer) const;
 
 	void viewport(int x, int y, int w, int h);
 	void viewportReset();
@@ -27,10 +130,22 @@ public:
 	bool dirty() const { return m_dirty; }
 	void markAsNotDirty() { m_dirty = false; }
 
+	/**
+	 * Pixels changed by put(), sprite() and clear() since the last
+	 * resetDamage(). Writes of the value a pixel already holds don't count.
+	 * Everything starts out damaged, since nobody has seen the screen yet.
+	*/
+	const VideoDamage& damage() const { return m_damage; }
+	void resetDamage() { m_damage.reset(); }
+
+	/// Damages the whole screen, after VRAM was written behind the video chip's back.
+	void damageAll() { m_damage.addAll(); }
+
 private:
-	Byte* m_vram;
+	Pixel* m_vram;
 	uint16_t m_vramSize;
 	bool m_dirty{ false };
+	VideoDamage m_damage;
 
 	int m_videoWidth, m_videoHeight;
 	int m_viewport[4];
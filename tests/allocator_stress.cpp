@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "allocator.h"
+
+/**
+ * allocator_stress [SEED] [OPS]
+ *
+ * Random alloc(), reserve() and free() calls on an Allocator the size of
+ * data memory, checked against a model (a used flag per cell and the
+ * live blocks) after every call: results must be what best fit on the
+ * model's free runs gives, the blocks and stats must match the model and
+ * verify() must hold.
+*/
+
+namespace {
+	constexpr uint32_t Capacity = 2560;
+
+	struct Model {
+		std::vector<bool> used = std::vector<bool>(Capacity, false);
+		std::map<uint32_t, uint32_t> blocks;
+
+		/// Free runs as (size, address), the order best fit picks them in.
+		std::vector<std::pair<uint32_t, uint32_t>> runs() const {
+			std::vector<std::pair<uint32_t, uint32_t>> runs;
+			for (uint32_t addr = 0; addr < Capacity;) {
+				if (used[addr]) {
+					addr++;
+					continue;
+				}
+				uint32_t end = addr;
+				while (end < Capacity && !used[end]) end++;
+				runs.emplace_back(end - addr, addr);
+				addr = end;
+			}
+			std::sort(runs.begin(), runs.end());
+			return runs;
+		}
+
+		bool isFree(uint32_t addr, uint32_t size) const {
+			if (size == 0 || uint64_t(addr) + size > Capacity) return false;
+			for (uint32_t i = addr; i < addr + size; i++) {
+				if (used[i]) return false;
+			}
+			return true;
+		}
+
+		void mark(uint32_t addr, uint32_t size, bool value) {
+			for (uint32_t i = addr; i < addr + size; i++) used[i] = value;
+		}
+	};
+
+	/// Mostly small blocks like carts ask for, now and then a big one.
+	uint32_t randomSize(std::mt19937& rng) {
+		uint32_t roll = rng() % 100;
+		if (roll < 2) return 0;
+		if (roll < 80) return 1 + rng() % 16;
+		if (roll < 97) return 1 + rng() % 128;
+		return 1 + rng() % Capacity;
+	}
+}
+
+int main(int argc, char** argv) {
+	const uint32_t seed = argc > 1 ? uint32_t(std::strtoul(argv[1], nullptr, 10)) : 1;
+	const uint64_t ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200000;
+
+	std::mt19937 rng(seed);
+	Allocator allocator(Capacity);
+	Model model;
+
+	auto fail = [&](uint64_t op, const std::string& what) {
+		std::cerr << "FAILED at op " << op << " (seed " << seed << "): " << what << std::endl;
+		return 1;
+	};
+
+	for (uint64_t op = 0; op < ops; op++) {
+		uint32_t roll = rng() % 100;
+		if (roll < 50) {
+			uint32_t size = randomSize(rng);
+			uint32_t expected = Allocator::Invalid;
+			if (size > 0) {
+				for (auto&& run : model.runs()) {
+					if (run.first >= size) {
+						expected = run.second;
+						break;
+					}
+				}
+			}
+			uint32_t addr = allocator.alloc(size);
+			if (addr != expected) return fail(op, "alloc(" + std::to_string(size) + ") returned " + std::to_string(addr) + ", best fit is " + std::to_string(expected));
+			if (addr != Allocator::Invalid) {
+				model.mark(addr, size, true);
+				model.blocks[addr] = size;
+			}
+		} else if (roll < 60) {
+			uint32_t addr = rng() % Capacity, size = randomSize(rng);
+			bool expected = model.isFree(addr, size);
+			if (allocator.reserve(addr, size) != expected) return fail(op, "reserve(" + std::to_string(addr) + ", " + std::to_string(size) + ")");
+			if (expected) {
+				model.mark(addr, size, true);
+				model.blocks[addr] = size;
+			}
+		} else if (roll < 95 && !model.blocks.empty()) {
+			auto it = std::next(model.blocks.begin(), rng() % model.blocks.size());
+			if (allocator.sizeOf(it->first) != it->second) return fail(op, "sizeOf(" + std::to_string(it->first) + ")");
+			if (!allocator.free(it->first)) return fail(op, "free(" + std::to_string(it->first) + ") of a live block");
+			model.mark(it->first, it->second, false);
+			model.blocks.erase(it);
+		} else if (roll < 99) {
+			// Addresses no block starts at must be refused.
+			uint32_t addr = rng() % (Capacity + 16);
+			bool live = model.blocks.count(addr) > 0;
+			if (!live && allocator.free(addr)) return fail(op, "free(" + std::to_string(addr) + ") of no block");
+		} else {
+			allocator.reset();
+			model = Model();
+		}
+
+		uint32_t used = 0;
+		for (auto&& block : model.blocks) used += block.second;
+		if (!allocator.verify()) return fail(op, "verify()");
+		if (allocator.blocks() != model.blocks) return fail(op, "blocks differ from the model");
+		if (allocator.stats().used != used) return fail(op, "stats().used differs from the model");
+	}
+
+	std::cout << ops << " operations OK (seed " << seed << "), " << allocator.stats().blocks << " blocks live" << std::endl;
+	return 0;
+}
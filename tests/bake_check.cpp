@@ -0,0 +1,156 @@
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "console.h"
+#include "asm.h"
+#include "bake.h"
+#include "demo_cart.h"
+
+/**
+ * CONSOLE_BAKE_CART re-implements the ASM driver in constexpr code. This
+ * checks that both put the same program, data and heap blocks into a
+ * fresh console, for the demo and for sources covering lets, forward
+ * and backward labels and every fusable idiom, with and without the
+ * peephole pass. A source jumping to numeric addresses must also run the
+ * same with and without the pass, which has to move those jumps along.
+*/
+
+namespace {
+	constexpr const char Lets[] = R"(
+		let a, 1
+		let list, [1, 2, 0x30, 4]
+		let b, 0
+	top:
+		pushm &a
+		push 3
+		mul
+		pop &b
+		cmp &b, 0x40
+		jgt done
+		inc &a
+		jmp top
+	done:
+		push &list
+		pop &b
+		halt
+	)";
+
+	constexpr const char Fusable[] = R"(
+		let x, 5
+		let y, 7
+	loop:
+		pushm &x
+		push 1
+		add
+		pop &x
+		pushm &y
+		push 2
+		sub
+		pop &y
+		pushm &x
+		push 3
+		mul
+		pop &x
+		pushm &x
+		push 2
+		div
+		pop &x
+		pushm &x
+		push 1
+		lsh
+		pop &x
+		pushm &x
+		push 1
+		rsh
+		pop &x
+		pushm &x
+		push 0xFF
+		and
+		pop &x
+		pushm &x
+		push 0x100
+		or
+		pop &x
+		pushm &x
+		push 0x0F
+		xor
+		pop &x
+		cmp &x, 9
+		jle skip
+		cmpm &x, &y
+		jne loop
+		call sub
+	skip:
+		jmp loop
+	sub:
+		dec &y
+		ret
+	)";
+
+	// `jlt 7` is the `inc &outer` after the fused add, and moves with it.
+	constexpr const char Literal[] = R"(
+		let cnt, 0
+		let outer, 0
+		pushm &cnt
+		push 1
+		add
+		pop &cnt
+		inc &outer
+		cmp &outer, 5
+		jlt 7
+		halt
+	)";
+
+	template <typename Baked>
+	bool check(const char* name, const std::string& source, bool optimize, const Baked& baked) {
+		std::unique_ptr<Console> expected(new Console()), actual(new Console());
+		ASM assembler(source, expected.get());
+		assembler.setOptimize(optimize);
+		ByteList code = assembler.compile();
+		expected->writeProgram(0, code.data(), uint32_t(code.size()));
+		baked.load(*actual);
+
+		const char* problem = nullptr;
+		if (assembler.errors() > 0) problem = "has errors";
+		else if (code.size() != baked.code.size()) problem = "has a different program size";
+		else if (!std::equal(code.begin(), code.end(), actual->prog())) problem = "has a different program";
+		else if (!std::equal(expected->data(), expected->data() + DataSize, actual->data())) problem = "has different data";
+		else if (expected->heap().blocks() != actual->heap().blocks()) problem = "takes different heap blocks";
+
+		std::cout << name << (optimize ? " (optimized): " : ": ") << (problem ? problem : "OK") << std::endl;
+		return problem == nullptr;
+	}
+
+	/// Runs both carts of a source that halts, they must leave the same data behind.
+	template <typename Optimized, typename Plain>
+	bool runsAlike(const char* name, const Optimized& optimized, const Plain& plain) {
+		std::unique_ptr<Console> a(new Console()), b(new Console());
+		optimized.load(*a);
+		plain.load(*b);
+		a->setEngine(EngineInterpreter);
+		b->setEngine(EngineInterpreter);
+		a->run(100000);
+		b->run(100000);
+
+		const char* problem = nullptr;
+		if (!a->halted() || !b->halted()) problem = "doesn't halt";
+		else if (!std::equal(a->data(), a->data() + DataSize, b->data())) problem = "runs differently optimized";
+		std::cout << name << " (run): " << (problem ? problem : "OK") << std::endl;
+		return problem == nullptr;
+	}
+}
+
+int main() {
+	bool ok = true;
+	ok &= check("demo", DemoSource, true, CONSOLE_BAKE_CART(DemoSource, true));
+	ok &= check("demo", DemoSource, false, CONSOLE_BAKE_CART(DemoSource, false));
+	ok &= check("lets", Lets, true, CONSOLE_BAKE_CART(Lets, true));
+	ok &= check("lets", Lets, false, CONSOLE_BAKE_CART(Lets, false));
+	ok &= check("fusable", Fusable, true, CONSOLE_BAKE_CART(Fusable, true));
+	ok &= check("fusable", Fusable, false, CONSOLE_BAKE_CART(Fusable, false));
+	ok &= check("literal", Literal, true, CONSOLE_BAKE_CART(Literal, true));
+	ok &= check("literal", Literal, false, CONSOLE_BAKE_CART(Literal, false));
+	ok &= runsAlike("literal", CONSOLE_BAKE_CART(Literal, true), CONSOLE_BAKE_CART(Literal, false));
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include "cart.h"
+#include "asm.h"
+#include "bench_source.h"
+
+namespace {
+	/// Assembles a multi-megabyte source until a second has gone by and reports the throughput.
+	int bench(size_t megabytes, bool optimize) {
+		const std::string source = benchSource(megabytes << 20);
+		using Clock = std::chrono::steady_clock;
+
+		double seconds = 0.0;
+		uint32_t runs = 0;
+		size_t words = 0;
+		while (seconds < 1.0 || runs < 3) {
+			std::unique_ptr<Console> console(new Console());
+			ASM assembler(source, console.get());
+			assembler.setOptimize(optimize);
+
+			auto start = Clock::now();
+			words = assembler.compile().size();
+			seconds += std::chrono::duration<double>(Clock::now() - start).count();
+			runs++;
+		}
+
+		const double mb = double(source.size()) / (1 << 20);
+		std::cout << mb << " MB source, " << words << " words, " << runs << " runs: "
+				  << seconds / runs * 1000.0 << " ms each, " << mb * runs / seconds << " MB/s" << std::endl;
+		return 0;
+	}
+}
+
+int main(int argc, char** argv) {
+	bool optimize = true, info = false;
+	size_t benchSize = 0;
+	std::string input, output;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--no-peephole") optimize = false;
+		else if (arg == "--info") info = true;
+		else if (arg == "--bench") benchSize = i + 1 < argc ? std::strtoul(argv[++i], nullptr, 10) : 0;
+		else if (input.empty()) input = arg;
+		else if (output.empty()) output = arg;
+		else input.clear();
+	}
+	if (benchSize > 0) return bench(benchSize, optimize);
+	if (input.empty() || (output.empty() && !info)) {
+		std::cerr << "Usage: " << argv[0] << " [--no-peephole] SOURCE.asm CART" << std::endl;
+		std::cerr << "       " << argv[0] << " --info CART" << std::endl;
+		std::cerr << "       " << argv[0] << " [--no-peephole] --bench MB" << std::endl;
+		return 1;
+	}
+
+	if (info) {
+		Cart cart;
+		if (!cart.open(input)) return 1;
+
+		static const char* names[CartSegmentCount] = { "program", "data", "opts", "heap", "symbols" };
+		const CartHeader& header = cart.header();
+		std::cout << "version " << header.version << ", source hash " << std::hex << header.sourceHash
+				  << ", content hash " << header.contentHash << std::dec << std::endl;
+		for (uint32_t i = 0; i < CartSegmentCount; i++) {
+			std::cout << names[i] << ": " << header.segments[i].size << " bytes at " << header.segments[i].offset << std::endl;
+		}
+		for (auto&& label : cart.symbols(CartSymbolLabel)) std::cout << "label " << label.first << " = " << label.second << std::endl;
+		for (auto&& ref : cart.symbols(CartSymbolData)) std::cout << "data " << ref.first << " = " << ref.second << std::endl;
+		return 0;
+	}
+
+	std::ifstream in(input);
+	if (!in.good()) {
+		std::cerr << "ERROR: Could not open \"" << input << "\"." << std::endl;
+		return 1;
+	}
+	std::stringstream source;
+	source << in.rdbuf();
+
+	std::vector<uint8_t> image;
+	if (!buildCart(source.str(), optimize, image)) return 1;
+	if (!writeCart(output, image)) {
+		std::cerr << "ERROR: Could not write \"" << output << "\"." << std::endl;
+		return 1;
+	}
+	return 0;
+}
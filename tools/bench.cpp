@@ -0,0 +1,286 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+#include "console.h"
+#include "asm.h"
+#include "palette.h"
+#include "bench_source.h"
+
+/**
+ * console_bench [--filter TEXT] [--json FILE]
+ * console_bench --compare BASE.json NEW.json [--threshold PERCENT]
+ *
+ * Microbenchmarks of the hot paths: the execution engines on ALU, branch
+ * and call heavy loops, the video chip, palette expansion and the
+ * assembler. Every result is a rate (higher is better), the median of a
+ * few samples of at least BenchSampleSeconds each, over fixed inputs.
+*/
+
+namespace {
+	constexpr uint32_t BenchSamples = 5;
+	constexpr double BenchSampleSeconds = 0.1;
+	constexpr double BenchDefaultThreshold = 5.0;
+
+	struct BenchResult {
+		std::string name, unit;
+		double value;
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	/// Rate of `batch` (which returns how much it did) per second, in `scale` units.
+	double measure(const std::function<uint64_t()>& batch, double scale) {
+		batch(); // Warm up
+
+		std::vector<double> rates;
+		for (uint32_t i = 0; i < BenchSamples; i++) {
+			uint64_t work = 0;
+			double seconds = 0.0;
+			auto start = Clock::now();
+			while (seconds < BenchSampleSeconds) {
+				work += batch();
+				seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			}
+			rates.push_back(double(work) / seconds / scale);
+		}
+		std::sort(rates.begin(), rates.end());
+		return rates[rates.size() / 2];
+	}
+
+	const char* const AluLoop = R"(
+		let a, 1
+		let b, 0
+	loop:
+		pushm &a
+		push 3
+		mul
+		push 7
+		add
+		pop &b
+		pushm &b
+		push 0xFF
+		and
+		pop &a
+		pushm &a
+		not
+		pop &b
+		jmp loop
+	)";
+
+	const char* const BranchLoop = R"(
+		let i, 0
+		let n, 0
+	loop:
+		inc &i
+		cmp &i, 3
+		jlt small
+		cmp &i, 7
+		jgt reset
+		inc &n
+		jmp loop
+	small:
+		dec &n
+		jmp loop
+	reset:
+		push 0
+		pop &i
+		jmp loop
+	)";
+
+	const char* const CallLoop = R"(
+		let d, 0
+	loop:
+		call outer
+		jmp loop
+	outer:
+		call inner
+		ret
+	inner:
+		inc &d
+		ret
+	)";
+
+	/// Ticks per second of `source` on `engine`, in millions.
+	double vmRate(const char* source, EngineType engine) {
+		std::unique_ptr<Console> console(new Console());
+		ASM assembler(source, console.get());
+		ByteList code = assembler.compile();
+		console->writeProgram(0, code.data(), uint32_t(code.size()));
+		console->setEngine(engine);
+		return measure([&]() { return console->run(1 << 16); }, 1e6);
+	}
+
+	void runBenchmarks(const std::string& filter, std::vector<BenchResult>& results) {
+		auto bench = [&](const std::string& name, const std::string& unit, const std::function<double()>& run) {
+			if (!filter.empty() && name.find(filter) == std::string::npos) return;
+			results.push_back({ name, unit, run() });
+			std::cout << std::left << std::setw(28) << name << std::right << std::setw(14) << std::fixed
+					  << std::setprecision(2) << results.back().value << " " << unit << std::endl;
+		};
+
+		const std::pair<const char*, EngineType> engines[] = {
+			{ "interp", EngineInterpreter }, { "threaded", EngineThreaded }, { "jit", EngineJIT }
+		};
+		const std::pair<const char*, const char*> loops[] = {
+			{ "alu", AluLoop }, { "branch", BranchLoop }, { "call", CallLoop }
+		};
+		for (auto&& loop : loops) {
+			for (auto&& engine : engines) {
+				bench(std::string("vm.") + loop.first + "." + engine.first, "Mticks/s",
+					  [&]() { return vmRate(loop.second, engine.second); });
+			}
+		}
+
+		std::vector<Pixel> vram(VideoSize);
+		Video video(vram.data(), VideoSize, ConsoleScreenWidth, ConsoleScreenHeight);
+		bench("video.put", "Mpixels/s", [&]() {
+			uint8_t frame = 0;
+			return measure([&]() {
+				for (int y = 0; y < ConsoleScreenHeight; y++) {
+					for (int x = 0; x < ConsoleScreenWidth; x++) video.put(x, y, uint8_t(x ^ y ^ frame));
+				}
+				frame++;
+				return uint64_t(VideoSize);
+			}, 1e6);
+		});
+
+		Byte sprite[SpriteSize * SpriteSize];
+		for (uint32_t i = 0; i < SpriteSize * SpriteSize; i++) sprite[i] = i % PaletteSize;
+		bench("video.sprite", "Msprites/s", [&]() {
+			// Partly off screen on every side, as moving sprites are.
+			return measure([&]() {
+				uint64_t count = 0;
+				for (int y = -4; y < ConsoleScreenHeight; y += 6) {
+					for (int x = -4; x < ConsoleScreenWidth; x += 6, count++) video.sprite(x, y, sprite);
+				}
+				return count;
+			}, 1e6);
+		});
+
+		bench("video.clear", "Kframes/s", [&]() {
+			uint8_t color = 0;
+			return measure([&]() { video.clear(color++ % PaletteSize); return uint64_t(1); }, 1e3);
+		});
+
+		std::vector<uint32_t> rgb(VideoSize);
+		for (uint32_t i = 0; i < VideoSize; i++) vram[i] = Pixel(i * 7 % PaletteSize);
+		for (int k = 0; k < PaletteKernelCount; k++) {
+			PaletteKernel kernel = PaletteKernel(k);
+			if (!paletteKernelSupported(kernel)) continue;
+			bench(std::string("palette.") + paletteKernelName(kernel), "Mpixels/s", [&]() {
+				return measure([&]() {
+					expandPalette(kernel, vram.data(), ConsoleScreenWidth, rgb.data(), ConsoleScreenWidth * sizeof(uint32_t),
+								  ConsoleScreenWidth, ConsoleScreenHeight);
+					return uint64_t(VideoSize);
+				}, 1e6);
+			});
+		}
+
+		for (size_t kb : { 64, 512, 4096 }) {
+			bench("asm.compile." + std::to_string(kb) + "k", "MB/s", [&]() {
+				const std::string source = benchSource(kb << 10);
+				std::unique_ptr<Console> console(new Console());
+				return measure([&]() {
+					console->heap().reset();
+					ASM assembler(source, console.get());
+					assembler.compile();
+					return uint64_t(source.size());
+				}, 1 << 20);
+			});
+		}
+	}
+
+	/// One result per line, so compare() can read them back without a JSON library.
+	bool writeJson(const std::string& path, const std::vector<BenchResult>& results) {
+		std::ofstream out(path);
+		out << "{\n\t\"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			out << "\t\t{ \"name\": \"" << results[i].name << "\", \"unit\": \"" << results[i].unit
+				<< "\", \"value\": " << std::setprecision(6) << results[i].value << " }"
+				<< (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "\t]\n}\n";
+		return out.good();
+	}
+
+	bool readJson(const std::string& path, std::map<std::string, double>& values) {
+		std::ifstream in(path);
+		if (!in.good()) {
+			std::cerr << "ERROR: Could not open \"" << path << "\"." << std::endl;
+			return false;
+		}
+		auto field = [](const std::string& line, const std::string& key) {
+			size_t at = line.find("\"" + key + "\":");
+			return at == std::string::npos ? std::string() : line.substr(at + key.size() + 3);
+		};
+		std::string line;
+		while (std::getline(in, line)) {
+			std::string name = field(line, "name"), value = field(line, "value");
+			if (name.empty() || value.empty()) continue;
+			name = name.substr(name.find('"') + 1);
+			values[name.substr(0, name.find('"'))] = std::strtod(value.c_str(), nullptr);
+		}
+		return true;
+	}
+
+	/// Flags the benchmarks more than `threshold` percent slower in `current`. Returns 1 if there are any.
+	int compare(const std::string& basePath, const std::string& currentPath, double threshold) {
+		std::map<std::string, double> base, current;
+		if (!readJson(basePath, base) || !readJson(currentPath, current)) return 1;
+
+		uint32_t regressions = 0;
+		for (auto&& entry : current) {
+			auto it = base.find(entry.first);
+			if (it == base.end() || it->second <= 0.0) {
+				std::cout << std::left << std::setw(28) << entry.first << " new" << std::endl;
+				continue;
+			}
+			double change = (entry.second / it->second - 1.0) * 100.0;
+			bool regressed = change < -threshold;
+			regressions += regressed;
+			std::cout << std::left << std::setw(28) << entry.first << std::right << std::showpos << std::fixed
+					  << std::setprecision(1) << std::setw(8) << change << "%" << std::noshowpos
+					  << (regressed ? "  REGRESSION" : "") << std::endl;
+		}
+		std::cout << regressions << " regression(s) over " << threshold << "%" << std::endl;
+		return regressions > 0 ? 1 : 0;
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string filter, jsonPath, basePath, currentPath;
+	double threshold = BenchDefaultThreshold;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+		else if (arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+		else if (arg == "--threshold" && i + 1 < argc) threshold = std::strtod(argv[++i], nullptr);
+		else if (arg == "--compare" && i + 2 < argc) {
+			basePath = argv[++i];
+			currentPath = argv[++i];
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--filter TEXT] [--json FILE]" << std::endl;
+			std::cerr << "       " << argv[0] << " --compare BASE.json NEW.json [--threshold PERCENT]" << std::endl;
+			return 1;
+		}
+	}
+	if (!basePath.empty()) return compare(basePath, currentPath, threshold);
+
+	std::vector<BenchResult> results;
+	runBenchmarks(filter, results);
+	if (!jsonPath.empty() && !writeJson(jsonPath, results)) {
+		std::cerr << "ERROR: Could not write \"" << jsonPath << "\"." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef BENCH_SOURCE_H
+#define BENCH_SOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * A synthetic source of about `bytes`, with what carts are made of: data,
+ * labels both ways, fusable idioms and comments. Shared by the assembler
+ * CLI's --bench and by console_bench, so their MB/s figures agree.
+*/
+inline std::string benchSource(size_t bytes) {
+	std::string source;
+	for (int i = 0; i < 64; i++) source += "let v" + std::to_string(i) + ", [1, 2, 0x30]\n";
+	for (uint32_t block = 0; source.size() < bytes; block++) {
+		const std::string b = std::to_string(block), v = "&v" + std::to_string(block % 64);
+		source += "loop" + b + ":\n"
+			"\tpush 1\n\tpushm " + v + "\n\tadd\n\tpop " + v + "\n"
+			"\tcmp " + v + ", 0x40\t; wrapped around yet?\n"
+			"\tjgt done" + b + "\n"
+			"\tpushm " + v + "\n\tpush 8\n\tputs " + v + "\n"
+			"\tjmp loop" + b + "\n"
+			"done" + b + ":\n"
+			"\tsys 1\n";
+	}
+	return source;
+}
+
+#endif // BENCH_SOURCE_H
@@ -0,0 +1,200 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+
+#include "runner.h"
+#include "native.h"
+
+/**
+ * console_corpus [--engine interp|threaded|jit|native] [--threads N] [--update] [DIR]
+ *
+ * Runs the reference carts in DIR (carts/corpus by default) and checks
+ * every frame against its golden hash, so speed and accuracy are measured
+ * together. Each NAME.golden there reads:
+ *
+ *     cart <path of the cart, relative to the golden>
+ *     frames <frames to run>
+ *     <frameHash() of frame 0, 16 hex digits>
+ *     ...
+ *
+ * --update reruns the carts and rewrites the hashes, keeping the rest.
+ *
+ * --engine native runs the carts recompiled into this tool (NativeCarts,
+ * built by CMakeLists.txt), picked by the name of the cart's file; carts
+ * it has none for fail to load.
+*/
+
+namespace fs = std::filesystem;
+
+extern const NativeCart NativeCart_corpus_demo;
+extern const NativeCart NativeCart_corpus_fill;
+extern const NativeCart NativeCart_corpus_idle;
+extern const NativeCart NativeCart_corpus_recursion;
+extern const NativeCart NativeCart_corpus_sprite_storm;
+extern const NativeCart NativeCart_corpus_tiles;
+
+namespace {
+	const NativeCart* const NativeCarts[] = {
+		&NativeCart_corpus_demo,
+		&NativeCart_corpus_fill,
+		&NativeCart_corpus_idle,
+		&NativeCart_corpus_recursion,
+		&NativeCart_corpus_sprite_storm,
+		&NativeCart_corpus_tiles
+	};
+
+	const NativeCart* nativeCart(const std::string& path) {
+		const std::string name = "corpus_" + fs::path(path).stem().string();
+		for (const NativeCart* cart : NativeCarts) {
+			if (name == cart->name) return cart;
+		}
+		return nullptr;
+	}
+
+	struct Golden {
+		std::string path, cart;
+		uint64_t frames{ 0 };
+		std::vector<uint64_t> hashes;
+	};
+
+	bool readGolden(const fs::path& path, Golden& golden) {
+		std::ifstream in(path);
+		std::string key;
+		if (!(in >> key) || key != "cart" || !(in >> golden.cart)) return false;
+		if (!(in >> key) || key != "frames" || !(in >> golden.frames)) return false;
+		golden.path = path.string();
+		golden.cart = (path.parent_path() / golden.cart).lexically_normal().string();
+
+		std::string hash;
+		while (in >> hash) golden.hashes.push_back(std::strtoull(hash.c_str(), nullptr, 16));
+		return true;
+	}
+
+	bool writeGolden(const Golden& golden, const std::string& cart, const std::vector<uint64_t>& hashes) {
+		std::ofstream out(golden.path);
+		out << "cart " << cart << "\nframes " << golden.frames << "\n" << std::hex << std::setfill('0');
+		for (uint64_t hash : hashes) out << std::setw(16) << hash << "\n";
+		return out.good();
+	}
+
+	/// The cart line as written, so --update doesn't turn it into a longer path.
+	std::string cartLine(const std::string& path) {
+		std::ifstream in(path);
+		std::string key, cart;
+		in >> key >> cart;
+		return cart;
+	}
+}
+
+int main(int argc, char** argv) {
+	RunnerOptions options;
+	options.frameHashes = true;
+	options.nativeCart = nativeCart;
+	uint32_t threads = 0;
+	bool update = false;
+	std::string dir = CONSOLE_CORPUS_DIR;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc) threads = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--update") update = true;
+		else if (arg == "--engine" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == "interp") options.engine = EngineInterpreter;
+			else if (name == "threaded") options.engine = EngineThreaded;
+			else if (name == "jit") options.engine = EngineJIT;
+			else if (name == "native") options.engine = EngineNative;
+			else {
+				std::cerr << "ERROR: Unknown engine \"" << name << "\"." << std::endl;
+				return 1;
+			}
+		}
+		else if (arg.size() > 1 && arg[0] == '-') {
+			std::cerr << "Usage: " << argv[0] << " [--engine interp|threaded|jit|native] [--threads N] [--update] [DIR]" << std::endl;
+			return 1;
+		}
+		else dir = arg;
+	}
+
+	std::vector<fs::path> files;
+	std::error_code error;
+	for (auto&& entry : fs::directory_iterator(dir, error)) {
+		if (entry.path().extension() == ".golden") files.push_back(entry.path());
+	}
+	if (error || files.empty()) {
+		std::cerr << "ERROR: No .golden files in \"" << dir << "\"." << std::endl;
+		return 1;
+	}
+	std::sort(files.begin(), files.end());
+
+	std::vector<Golden> goldens(files.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!readGolden(files[i], goldens[i])) {
+			std::cerr << "ERROR: Could not read \"" << files[i].string() << "\"." << std::endl;
+			return 1;
+		}
+	}
+
+	// Carts with different frame counts run in batches of one count each.
+	WorkPool pool(threads);
+	std::vector<CartRun> results(goldens.size());
+	for (size_t i = 0; i < goldens.size(); i++) {
+		if (!results[i].path.empty()) continue;
+		std::vector<size_t> batch;
+		std::vector<std::string> paths;
+		for (size_t j = i; j < goldens.size(); j++) {
+			if (goldens[j].frames != goldens[i].frames) continue;
+			batch.push_back(j);
+			paths.push_back(goldens[j].cart);
+		}
+		options.frames = goldens[i].frames;
+		std::vector<CartRun> runs = runCarts(paths, options, pool);
+		for (size_t j = 0; j < batch.size(); j++) results[batch[j]] = std::move(runs[j]);
+	}
+
+	uint32_t failed = 0;
+	for (size_t i = 0; i < goldens.size(); i++) {
+		const Golden& golden = goldens[i];
+		const CartRun& run = results[i];
+		std::cout << std::left << std::setw(24) << fs::path(golden.path).stem().string() << std::right;
+		if (!run.loaded) {
+			failed++;
+			std::cout << "FAILED to load " << golden.cart << std::endl;
+			continue;
+		}
+
+		double fps = run.runSeconds > 0.0 ? run.frames / run.runSeconds : 0.0;
+		std::cout << std::setw(6) << run.frames << " frames " << std::fixed << std::setprecision(0) << std::setw(10)
+				  << fps << " fps  ";
+
+		if (update) {
+			bool written = writeGolden(golden, cartLine(golden.path), run.frameHashes);
+			failed += !written;
+			std::cout << (written ? "UPDATED" : "FAILED to write") << std::endl;
+			continue;
+		}
+
+		size_t mismatch = 0;
+		while (mismatch < run.frameHashes.size() && mismatch < golden.hashes.size()
+			   && run.frameHashes[mismatch] == golden.hashes[mismatch]) mismatch++;
+		if (mismatch == golden.hashes.size() && mismatch == run.frameHashes.size()) {
+			std::cout << "OK" << std::endl;
+			continue;
+		}
+		failed++;
+		if (mismatch < golden.hashes.size() && mismatch < run.frameHashes.size()) {
+			std::cout << "MISMATCH at frame " << mismatch << std::endl;
+		}
+		else {
+			std::cout << "MISMATCH " << run.frameHashes.size() << " frames, expected " << golden.hashes.size() << std::endl;
+		}
+	}
+
+	std::cout << goldens.size() << " carts on " << pool.threads() << " threads, " << failed << " failed" << std::endl;
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+
+#include "console.h"
+#include "asm.h"
+#include "recompiler.h"
+
+/**
+ * console_recompile <cart.asm> <out.cpp> <name>
+ *
+ * Assembles a cart and writes it out as a native cart (see native.h)
+ * named NativeCart_<name>.
+*/
+int main(int argc, char** argv) {
+	if (argc != 4) {
+		std::cerr << "Usage: " << argv[0] << " <cart.asm> <out.cpp> <name>" << std::endl;
+		return 1;
+	}
+
+	std::ifstream in(argv[1]);
+	if (!in.good()) {
+		std::cerr << "ERROR: Could not open \"" << argv[1] << "\"." << std::endl;
+		return 1;
+	}
+	std::stringstream source;
+	source << in.rdbuf();
+
+	std::unique_ptr<Console> con(new Console());
+	ASM comp(source.str(), con.get());
+	ByteList code = comp.compile();
+	if (code.size() > ProgramSize) {
+		std::cerr << "ERROR: The program takes " << code.size() << " words, the console has " << ProgramSize << "." << std::endl;
+		return 1;
+	}
+	// The errors were printed as they were found, a broken source makes no native cart.
+	if (comp.errors() > 0) return 1;
+
+	// `let` stores its values in data memory, keep it up to the last one
+	// (and all of the heap it took, so the cart reserves the same memory).
+	const Byte* data = con->data();
+	uint32_t dataSize = DataAddressable;
+	while (dataSize > 0 && data[dataSize - 1] == 0) dataSize--;
+	dataSize = std::max(dataSize, con->heap().stats().highWater);
+
+	Recompiler rec(code, ByteList(data, data + dataSize));
+
+	std::ofstream out(argv[2]);
+	if (!out.good()) {
+		std::cerr << "ERROR: Could not open \"" << argv[2] << "\"." << std::endl;
+		return 1;
+	}
+	out << rec.generate(argv[3], argv[1]);
+	return out.good() ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+#include "runner.h"
+
+/**
+ * console_runner [options] <cart>...
+ *
+ * Runs every cart headless in a console of its own, spread over all cores,
+ * and prints the instruction count, the final RAM and VRAM hashes and the
+ * wall time of each. Carts ending in .asm are assembled first.
+*/
+int main(int argc, char** argv) {
+	RunnerOptions options;
+	uint32_t threads = 0;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc) threads = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--frames" && i + 1 < argc) options.frames = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--no-peephole") options.optimize = false;
+		else if (arg == "--engine" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == "interp") options.engine = EngineInterpreter;
+			else if (name == "threaded") options.engine = EngineThreaded;
+			else if (name == "jit") options.engine = EngineJIT;
+			else {
+				std::cerr << "ERROR: Unknown engine \"" << name << "\"." << std::endl;
+				return 1;
+			}
+		}
+		else if (arg.size() > 1 && arg[0] == '-') {
+			paths.clear();
+			break;
+		}
+		else paths.push_back(arg);
+	}
+	if (paths.empty()) {
+		std::cerr << "Usage: " << argv[0] << " [--threads N] [--frames N] [--engine interp|threaded|jit] [--no-peephole] CART..." << std::endl;
+		return 1;
+	}
+
+	WorkPool pool(threads);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<CartRun> results = runCarts(paths, options, pool);
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	double busy = 0.0;
+	uint32_t failed = 0;
+	for (auto&& run : results) {
+		busy += run.seconds;
+		if (!run.loaded) {
+			failed++;
+			std::cout << run.path << ": FAILED to load" << std::endl;
+			continue;
+		}
+		std::cout << run.path << ": " << run.instructions << " instructions, " << run.frames << " frames, "
+				  << std::hex << std::setfill('0') << "ram " << std::setw(16) << run.ramHash
+				  << ", vram " << std::setw(16) << run.vramHash << std::dec << std::setfill(' ')
+				  << ", " << run.seconds * 1000.0 << " ms" << std::endl;
+	}
+
+	// Busy time over wall time is how many cores were kept busy on average.
+	std::cout << results.size() << " carts on " << pool.threads() << " threads in " << wall << "s, "
+			  << (wall > 0.0 ? busy / wall : 0.0) << "x parallel, " << pool.steals() << " steals";
+	if (failed > 0) std::cout << ", " << failed << " failed";
+	std::cout << std::endl;
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "console.h"
+#include "asm.h"
+#include "trace.h"
+
+/**
+ * console_trace [--from CYCLE] [--limit N] TRACE
+ *
+ * Decodes a trace written by `console --trace` (a console built with
+ * CONSOLE_TRACE=ON) into one line per instruction: its cycle, the
+ * cycles since the previous instruction (a wait or a sprite table shows
+ * up there), PC, stack and call depths and the instruction itself.
+ * Where the console dropped records, a "..." line marks the gap.
+*/
+int main(int argc, char** argv) {
+	uint64_t from = 0, limit = UINT64_MAX;
+	std::string path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--from" && i + 1 < argc) from = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--limit" && i + 1 < argc) limit = std::strtoull(argv[++i], nullptr, 10);
+		else if (path.empty() && !(arg.size() > 1 && arg[0] == '-')) path = arg;
+		else {
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty()) {
+		std::cerr << "Usage: " << argv[0] << " [--from CYCLE] [--limit N] TRACE" << std::endl;
+		return 1;
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	TraceFileHeader header;
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		std::cerr << "ERROR: Could not read \"" << path << "\"." << std::endl;
+		return 1;
+	}
+	if (header.magic != TraceMagic || header.version != TraceVersion || header.recordSize != sizeof(TraceRecord)) {
+		std::cerr << "ERROR: \"" << path << "\" is not a version " << TraceVersion << " trace." << std::endl;
+		return 1;
+	}
+
+	std::cout << std::setw(12) << "cycle" << std::setw(8) << "+" << "  " << std::left << std::setw(8) << "pc"
+			  << std::right << std::setw(6) << "stack" << std::setw(6) << "calls" << "  instruction" << std::endl;
+
+	TraceRecord record;
+	uint64_t count = 0, shown = 0, previous = 0;
+	while (shown < limit && in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+		uint64_t delta = count++ > 0 ? record.cycle - previous : 0;
+		previous = record.cycle;
+		if (record.cycle < from) continue;
+		shown++;
+
+		if (record.flags & TraceAfterDrop) std::cout << std::setw(12) << "..." << "  (records dropped)" << std::endl;
+
+		std::cout << std::setw(12) << record.cycle << std::setw(8) << delta << "  0x" << std::hex << std::setfill('0')
+				  << std::setw(4) << record.pc << std::dec << std::setfill(' ') << "  " << std::setw(6) << record.stackDepth
+				  << std::setw(6) << record.callDepth << "  " << opCodeName(record.op);
+		for (uint32_t i = 0; i < operandCount(record.op); i++) std::cout << (i > 0 ? ", " : " ") << record.operands[i];
+		std::cout << std::endl;
+	}
+	return 0;
+}